@@ -0,0 +1,502 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+#include "ffmpeg_headers.h"
+#include "audioexportthread.h"
+
+// How many packets could be queued ahead of the video (about a second or two for most codecs)
+static const int AUDIO_QUEUED_PACKETS = 64;
+
+
+AudioExportThread::Reader::Reader()
+    : m_packets( AUDIO_QUEUED_PACKETS ), m_freePackets( AUDIO_QUEUED_PACKETS )
+{
+    m_failed = 0;
+}
+
+AudioExportThread::Reader::~Reader()
+{
+    close();
+
+    AVPacket * packet;
+
+    while ( m_packets.pop( &packet ) )
+        av_packet_free( &packet );
+
+    while ( m_freePackets.pop( &packet ) )
+        av_packet_free( &packet );
+}
+
+AVPacket * AudioExportThread::Reader::takePacket()
+{
+    AVPacket * packet;
+
+    if ( !m_packets.pop( &packet ) )
+        return 0;
+
+    return packet;
+}
+
+void AudioExportThread::Reader::releasePacket( AVPacket * packet )
+{
+    av_packet_unref( packet );
+
+    // Only fails if the reader is closed
+    if ( !m_freePackets.push( packet ) )
+        av_packet_free( &packet );
+}
+
+bool AudioExportThread::Reader::failed() const
+{
+    return m_failed.loadRelaxed() != 0;
+}
+
+void AudioExportThread::Reader::close()
+{
+    // Wakes up the thread if it waits for the queue space or a free packet
+    m_packets.close();
+    m_freePackets.close();
+}
+
+
+AudioExportThread::AudioExportThread()
+{
+    m_formatCtx = 0;
+    m_decoderCtx = 0;
+    m_streamIndex = -1;
+    m_encoderCtx = 0;
+    m_resampleCtx = 0;
+    m_fifo = 0;
+    m_samplesOut = 0;
+    m_decoded = 0;
+    m_resampled = 0;
+    m_resampledCapacity = 0;
+    m_encoded = 0;
+    m_encodedCapacity = 0;
+    m_packet = 0;
+    m_encodedPacket = 0;
+    m_failed = 0;
+    m_telemetry = 0;
+    m_waitNs = 0;
+}
+
+AudioExportThread::~AudioExportThread()
+{
+    stop();
+
+    av_packet_free( &m_packet );
+    av_packet_free( &m_encodedPacket );
+    av_frame_free( &m_decoded );
+    av_frame_free( &m_resampled );
+    av_frame_free( &m_encoded );
+    av_audio_fifo_free( m_fifo );
+    swr_free( &m_resampleCtx );
+    avcodec_free_context( &m_decoderCtx );
+    avformat_close_input( &m_formatCtx );
+}
+
+bool AudioExportThread::open( const QString& filename )
+{
+    const AVCodec * codec = 0;
+
+    if ( avformat_open_input( &m_formatCtx, filename.toUtf8().data(), 0, 0 ) != 0 )
+    {
+        m_errorMsg = "Could not open the audio file";
+        return false;
+    }
+
+    if ( avformat_find_stream_info( m_formatCtx, 0 ) < 0 )
+    {
+        m_errorMsg = "Could not find stream information in the audio file";
+        return false;
+    }
+
+    m_streamIndex = av_find_best_stream( m_formatCtx, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0 );
+
+    if ( m_streamIndex < 0 || !codec )
+    {
+        m_errorMsg = "Could not find the decodable audio stream in the audio file";
+        return false;
+    }
+
+    m_decoderCtx = avcodec_alloc_context3( codec );
+
+    if ( !m_decoderCtx
+    || avcodec_parameters_to_context( m_decoderCtx, m_formatCtx->streams[ m_streamIndex ]->codecpar ) < 0
+    || avcodec_open2( m_decoderCtx, codec, 0 ) < 0 )
+    {
+        m_errorMsg = "Could not open the audio decoder";
+        return false;
+    }
+
+    m_decoderCtx->pkt_timebase = m_formatCtx->streams[ m_streamIndex ]->time_base;
+
+    // Only the audio stream is read
+    for ( unsigned int i = 0; i < m_formatCtx->nb_streams; i++ )
+    {
+        if ( (int) i != m_streamIndex )
+            m_formatCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    // Everything reused while running is allocated here
+    m_decoded = av_frame_alloc();
+    m_resampled = av_frame_alloc();
+    m_encoded = av_frame_alloc();
+    m_packet = av_packet_alloc();
+    m_encodedPacket = av_packet_alloc();
+
+    if ( !m_decoded || !m_resampled || !m_encoded || !m_packet || !m_encodedPacket )
+    {
+        m_errorMsg = "Could not allocate the audio frames";
+        return false;
+    }
+
+    return true;
+}
+
+QString AudioExportThread::errorMsg() const
+{
+    return m_errorMsg;
+}
+
+AVStream * AudioExportThread::inputStream() const
+{
+    return m_formatCtx->streams[ m_streamIndex ];
+}
+
+const AVCodecContext * AudioExportThread::decoder() const
+{
+    return m_decoderCtx;
+}
+
+qint64 AudioExportThread::duration() const
+{
+    AVStream * stream = m_formatCtx->streams[ m_streamIndex ];
+
+    if ( stream->duration != AV_NOPTS_VALUE )
+        return av_rescale_q( stream->duration, stream->time_base, AVRational{ 1, 1000 } );
+
+    if ( m_formatCtx->duration != AV_NOPTS_VALUE )
+        return m_formatCtx->duration / (AV_TIME_BASE / 1000);
+
+    return 0;
+}
+
+bool AudioExportThread::setEncoder( AVCodecContext * encoder )
+{
+    m_encoderCtx = encoder;
+    m_resampleCtx = swr_alloc();
+    m_fifo = av_audio_fifo_alloc( encoder->sample_fmt, encoder->ch_layout.nb_channels, qMax( 1, encoder->frame_size ) );
+
+    if ( !m_resampleCtx || !m_fifo )
+    {
+        m_errorMsg = QObject::tr("Cannot allocate audio resampler");
+        return false;
+    }
+
+    // Some formats (i.e. WAV) do not produce the proper channel layout
+    if ( m_decoderCtx->ch_layout.nb_channels == 0 )
+        av_opt_set_chlayout( m_resampleCtx, "in_ch_layout", &encoder->ch_layout, 0 );
+    else
+        av_opt_set_chlayout( m_resampleCtx, "in_ch_layout", &m_decoderCtx->ch_layout, 0 );
+
+    av_opt_set_chlayout( m_resampleCtx, "out_ch_layout", &encoder->ch_layout, 0 );
+
+    av_opt_set_int( m_resampleCtx, "in_sample_fmt",     m_decoderCtx->sample_fmt, 0);
+    av_opt_set_int( m_resampleCtx, "out_sample_fmt",    encoder->sample_fmt, 0);
+    av_opt_set_int( m_resampleCtx, "in_sample_rate",    m_decoderCtx->sample_rate, 0);
+    av_opt_set_int( m_resampleCtx, "out_sample_rate",   encoder->sample_rate, 0);
+
+    if ( swr_init( m_resampleCtx ) < 0 )
+    {
+        m_errorMsg = QObject::tr("Cannot initialize audio resampler");
+        return false;
+    }
+
+    return true;
+}
+
+QSharedPointer<AudioExportThread::Reader> AudioExportThread::addReader()
+{
+    QSharedPointer<Reader> reader( new Reader() );
+    int packets = 0;
+
+    for ( ; packets < AUDIO_QUEUED_PACKETS; packets++ )
+    {
+        AVPacket * packet = av_packet_alloc();
+
+        if ( !packet )
+            break;
+
+        reader->m_freePackets.push( packet );
+    }
+
+    if ( packets == 0 )
+    {
+        m_errorMsg = "Could not allocate the audio packets";
+        return QSharedPointer<Reader>();
+    }
+
+    m_readers.append( reader );
+    return reader;
+}
+
+void AudioExportThread::setTelemetry( ExportTelemetry * telemetry )
+{
+    m_telemetry = telemetry;
+}
+
+void AudioExportThread::stop()
+{
+    // The readers are closed by their video encoders, which wakes the thread up if it waits for them
+    wait();
+}
+
+void AudioExportThread::run()
+{
+    AVStream * stream = m_formatCtx->streams[ m_streamIndex ];
+    int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    bool running = true;
+
+    while ( running )
+    {
+        AVPacket * packet = m_packet;
+
+        measurePacket();
+
+        if ( av_read_frame( m_formatCtx, packet ) < 0 )
+            break;
+
+        if ( packet->stream_index != m_streamIndex )
+        {
+            av_packet_unref( packet );
+            continue;
+        }
+
+        if ( m_encoderCtx )
+        {
+            running = decodePacket( packet );
+            av_packet_unref( packet );
+            continue;
+        }
+
+        // Stream copy: the audio starts together with the video, at zero
+        if ( packet->pts != AV_NOPTS_VALUE )
+            packet->pts -= start;
+
+        if ( packet->dts != AV_NOPTS_VALUE )
+            packet->dts -= start;
+
+        packet->pos = -1;
+        running = queuePacket( packet );
+    }
+
+    // The music file ended; drain the decoder and the encoder
+    if ( running && m_encoderCtx && decodePacket( 0 ) && encodeSamples( true ) )
+        sendFrame( 0 );
+
+    measurePacket();
+
+    // Nothing more to take
+    for ( int i = 0; i < m_readers.size(); i++ )
+    {
+        if ( m_failed.loadRelaxed() != 0 )
+            m_readers[i]->m_failed = 1;
+
+        m_readers[i]->m_packets.close();
+    }
+}
+
+bool AudioExportThread::decodePacket( AVPacket * packet )
+{
+    // The null packet drains the decoder
+    if ( avcodec_send_packet( m_decoderCtx, packet ) < 0 )
+    {
+        qWarning( "Error while submitting audio packet to decoder" );
+        m_failed = 1;
+        return false;
+    }
+
+    // Read all the output frames (in general there may be any number of them)
+    while ( avcodec_receive_frame( m_decoderCtx, m_decoded ) >= 0 )
+    {
+        // Run the audio resampling, and keep the samples until there are enough for the encoder frame
+        bool ret = reserveSamples( m_resampled, &m_resampledCapacity, swr_get_out_samples( m_resampleCtx, m_decoded->nb_samples ) )
+                && swr_convert_frame( m_resampleCtx, m_resampled, m_decoded ) >= 0
+                && av_audio_fifo_write( m_fifo, (void**) m_resampled->extended_data, m_resampled->nb_samples ) >= m_resampled->nb_samples;
+
+        av_frame_unref( m_decoded );
+
+        if ( !ret )
+        {
+            qWarning( "Error while converting the audio frame" );
+            m_failed = 1;
+            return false;
+        }
+
+        if ( !encodeSamples( false ) )
+            return false;
+    }
+
+    return true;
+}
+
+bool AudioExportThread::encodeSamples( bool flush )
+{
+    // Most encoders need every frame but the last one to have exactly frame_size samples; 0 means any size
+    int frameSize = qMax( 0, m_encoderCtx->frame_size );
+
+    while ( av_audio_fifo_size( m_fifo ) > 0 && ( av_audio_fifo_size( m_fifo ) >= frameSize || flush ) )
+    {
+        int samples = frameSize > 0 ? qMin( av_audio_fifo_size( m_fifo ), frameSize ) : av_audio_fifo_size( m_fifo );
+
+        if ( !reserveSamples( m_encoded, &m_encodedCapacity, samples )
+        || av_audio_fifo_read( m_fifo, (void**) m_encoded->extended_data, samples ) < samples )
+        {
+            qWarning( "Error while preparing the audio frame" );
+            m_failed = 1;
+            return false;
+        }
+
+        m_encoded->pts = m_samplesOut;
+        m_samplesOut += samples;
+
+        if ( !sendFrame( m_encoded ) )
+            return false;
+    }
+
+    return true;
+}
+
+bool AudioExportThread::sendFrame( AVFrame * frame )
+{
+    // The null frame drains the encoder
+    int error = avcodec_send_frame( m_encoderCtx, frame );
+
+    if ( error < 0 )
+    {
+        qWarning( "Could not send the audio frame for encoding (error '%d')", error );
+        m_failed = 1;
+        return false;
+    }
+
+    while ( true )
+    {
+        AVPacket * packet = m_encodedPacket;
+
+        error = avcodec_receive_packet( m_encoderCtx, packet );
+
+        if ( error < 0 )
+        {
+            if ( error == AVERROR(EAGAIN) || error == AVERROR_EOF )
+                return true;
+
+            qWarning( "Could not encode the audio frame (error '%d')", error );
+            m_failed = 1;
+            return false;
+        }
+
+        if ( !queuePacket( packet ) )
+            return false;
+    }
+}
+
+bool AudioExportThread::reserveSamples( AVFrame * frame, int * capacity, int samples )
+{
+    // The buffer is only reallocated if it is too small, which stops happening soon after the start
+    if ( samples > *capacity )
+    {
+        av_frame_unref( frame );
+
+        frame->nb_samples = samples;
+        frame->format = m_encoderCtx->sample_fmt;
+        frame->sample_rate = m_encoderCtx->sample_rate;
+        av_channel_layout_copy( &frame->ch_layout, &m_encoderCtx->ch_layout );
+
+        if ( av_frame_get_buffer( frame, 0 ) < 0 )
+            return false;
+
+        *capacity = samples;
+    }
+
+    // The encoder may still keep a reference to the previous samples
+    frame->nb_samples = *capacity;
+
+    if ( av_frame_make_writable( frame ) < 0 )
+        return false;
+
+    frame->nb_samples = samples;
+    return true;
+}
+
+bool AudioExportThread::queuePacket( AVPacket * packet )
+{
+    QElapsedTimer waitTiming;
+    bool queued = false;
+
+    if ( m_telemetry )
+        waitTiming.start();
+
+    for ( int i = 0; i < m_readers.size(); i++ )
+    {
+        Reader * reader = m_readers[i].data();
+        AVPacket * copy;
+
+        // Waits until the video encoder gives a packet back; only fails if the reader is closed
+        if ( !reader->m_freePackets.pop( &copy ) )
+            continue;
+
+        // The last reader gets the packet itself, the others the references to the same data
+        int err = 0;
+
+        if ( i + 1 < m_readers.size() )
+            err = av_packet_ref( copy, packet );
+        else
+            av_packet_move_ref( copy, packet );
+
+        if ( err < 0 || !reader->m_packets.push( copy ) )
+        {
+            reader->releasePacket( copy );
+            continue;
+        }
+
+        queued = true;
+    }
+
+    av_packet_unref( packet );
+
+    if ( m_telemetry )
+        m_waitNs += waitTiming.nsecsElapsed();
+
+    // Stop once nobody reads the packets
+    return queued;
+}
+
+void AudioExportThread::measurePacket()
+{
+    if ( !m_telemetry )
+        return;
+
+    // Everything done since the previous packet was taken, except waiting for the video encoder
+    if ( m_packetTiming.isValid() )
+        m_telemetry->add( ExportTelemetry::STAGE_AUDIO_ENCODE, m_packetTiming.nsecsElapsed() - m_waitNs );
+
+    m_packetTiming.start();
+    m_waitNs = 0;
+}
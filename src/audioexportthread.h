@@ -0,0 +1,153 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+#ifndef AUDIOEXPORTTHREAD_H
+#define AUDIOEXPORTTHREAD_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSharedPointer>
+
+#include "boundedqueue.h"
+#include "exporttelemetry.h"
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVPacket;
+struct AVFrame;
+struct AVAudioFifo;
+struct SwrContext;
+
+//
+// Produces the audio packets for the exported video in its own thread. The music file is opened
+// by its own demuxer and decoder, so the audio player is not touched and could still be used.
+// The audio is either decoded, resampled and encoded, or its packets are copied as is, and queued
+// for the video encoder which muxes them together with the video. Packets and frames are reused,
+// so nothing is allocated per packet once the export is running.
+//
+// Several video encoders could read the same packets, so the audio is decoded and encoded once
+// when the same song is exported into several files at once.
+//
+class AudioExportThread : public QThread
+{
+    public:
+        AudioExportThread();
+        ~AudioExportThread();
+
+        // Opens the music file; returns false if it has no decodable audio
+        bool    open( const QString& filename );
+        QString errorMsg() const;
+
+        // The music file audio stream and its decoder
+        AVStream *  inputStream() const;
+        const AVCodecContext * decoder() const;
+
+        // The music file length in milliseconds, 0 if unknown
+        qint64  duration() const;
+
+        // Encodes the audio by the opened encoder, which must be kept until the thread is stopped.
+        // If not called, the packets are copied as is. Must be called before start().
+        bool    setEncoder( AVCodecContext * encoder );
+
+        // Reports the time spent on every packet there, not counting the waits for the video
+        // encoder. Must be called before start().
+        void    setTelemetry( ExportTelemetry * telemetry );
+
+        // The packets queued for one video encoder. It is shared with the thread, so either of them
+        // could be deleted first.
+        class Reader
+        {
+            public:
+                Reader();
+                ~Reader();
+
+                // Takes the next packet, waiting for it if necessary. The timestamps are in the encoder time base,
+                // or in the input stream time base if copied, starting from zero. Returns 0 if the audio ended or
+                // failed. The packet must be given back by releasePacket().
+                AVPacket *  takePacket();
+                void    releasePacket( AVPacket * packet );
+                bool    failed() const;
+
+                // No more packets will be taken, the rest are dropped; the thread does not wait for this reader anymore
+                void    close();
+
+            private:
+                friend class AudioExportThread;
+
+                BoundedQueue<AVPacket*> m_packets;
+                BoundedQueue<AVPacket*> m_freePackets;
+                QAtomicInt          m_failed;
+        };
+
+        // Adds another reader of the packets; returns null if the packets could not be allocated.
+        // Must be called before start().
+        QSharedPointer<Reader>  addReader();
+
+        // Waits until the thread stops; it stops when all the readers are closed or the audio ends
+        void    stop();
+
+    protected:
+        void    run();
+
+    private:
+        bool    decodePacket( AVPacket * packet );
+        bool    encodeSamples( bool flush );
+        bool    sendFrame( AVFrame * frame );
+        bool    reserveSamples( AVFrame * frame, int * capacity, int samples );
+        bool    queuePacket( AVPacket * packet );
+        void    measurePacket();
+
+    private:
+        QString             m_errorMsg;
+
+        // Music file demuxer and decoder
+        AVFormatContext *   m_formatCtx;
+        AVCodecContext  *   m_decoderCtx;
+        int                 m_streamIndex;
+
+        // Encoder, the resampler to its format, and the resampled samples waiting for the whole encoder frame
+        AVCodecContext  *   m_encoderCtx;
+        SwrContext      *   m_resampleCtx;
+        AVAudioFifo     *   m_fifo;
+        qint64              m_samplesOut;
+
+        // Reused frames: decoded, resampled (with its capacity in samples), and sent to the encoder
+        AVFrame         *   m_decoded;
+        AVFrame         *   m_resampled;
+        int                 m_resampledCapacity;
+        AVFrame         *   m_encoded;
+        int                 m_encodedCapacity;
+
+        // The packet read from the music file, and the one received from the encoder; their data
+        // is passed on to the readers
+        AVPacket        *   m_packet;
+        AVPacket        *   m_encodedPacket;
+        QList< QSharedPointer<Reader> > m_readers;
+        QAtomicInt          m_failed;
+
+        // Stage timing: since the previous packet, and how long it waited for the queues meanwhile
+        ExportTelemetry *   m_telemetry;
+        QElapsedTimer       m_packetTiming;
+        qint64              m_waitNs;
+};
+
+#endif // AUDIOEXPORTTHREAD_H
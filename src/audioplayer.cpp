@@ -43,9 +43,9 @@ bool AudioPlayer::init()
 	return d->init();
 }
 
-bool AudioPlayer::open( const QString& filename )
+bool AudioPlayer::open( const QString& filename, bool playback )
 {
-    return d->openAudio( filename );
+    return d->openAudio( filename, playback );
 }
 
 void AudioPlayer::play()
@@ -83,6 +83,11 @@ qint64 AudioPlayer::totalTime() const
 	return d->totalTime();
 }
 
+QString AudioPlayer::fileName() const
+{
+	return d->m_fileName;
+}
+
 QString	AudioPlayer::errorMsg() const
 {
 	return d->errorMsg();
@@ -41,8 +41,10 @@ class AudioPlayer : public QObject
 		// Initialize the player
 		bool	init();
 
-		// Open the audio file. Returns true on success, false otherwise
-		bool	open( const QString& filename );
+		// Open the audio file. Returns true on success, false otherwise.
+		// If playback is false, the audio output device is not initialized,
+		// and the file could only be used for video encoding.
+		bool	open( const QString& filename, bool playback = true );
 
 		// Closes the audio file. If another file is opened, the previous will
 		// be closed automatically.
@@ -57,6 +59,9 @@ class AudioPlayer : public QObject
 		// The audio file length
 		qint64	totalTime() const;
 
+		// The opened audio file name
+		QString	fileName() const;
+
 		// Metadata
 		QString	metaTitle() const;
 		QString	metaArtist() const;
@@ -111,6 +111,7 @@ void AudioPlayerPrivate::closeAudio()
 	pFormatCtx = 0;
 	aCodecCtx = 0;
 	pCodec = 0;
+	m_fileName.clear();
 }
 
 static QString getMetaTag( AVDictionary* meta, const char * tagname )
@@ -123,7 +124,7 @@ static QString getMetaTag( AVDictionary* meta, const char * tagname )
 		return "";
 }
 
-bool AudioPlayerPrivate::openAudio( const QString& filename )
+bool AudioPlayerPrivate::openAudio( const QString& filename, bool playback )
 {
 	// Close if opened
     closeAudio();
@@ -200,6 +201,8 @@ bool AudioPlayerPrivate::openAudio( const QString& filename )
 		return false;
 	}
 
+	m_fileName = filename;
+
 	// Extract some metadata
 	AVDictionary* metadata = pFormatCtx->metadata;
 
@@ -218,22 +221,26 @@ bool AudioPlayerPrivate::openAudio( const QString& filename )
 							   pFormatCtx->streams[audioStream]->time_base,
                                baserate ) / 1000;
 
-    // Now initialize the audio device
-    QAudioFormat format;
-    format.setSampleRate( aCodecCtx->sample_rate );
-    format.setChannelCount( 2 );
-    format.setSampleFormat( QAudioFormat::Int16 );
+    // Now initialize the audio device, unless we only need the file for encoding
+    // (export hosts may have no audio output at all)
+    if ( playback )
+    {
+        QAudioFormat format;
+        format.setSampleRate( aCodecCtx->sample_rate );
+        format.setChannelCount( 2 );
+        format.setSampleFormat( QAudioFormat::Int16 );
 
-    QAudioDevice info( QMediaDevices::defaultAudioOutput() );
+        QAudioDevice info( QMediaDevices::defaultAudioOutput() );
 
-    if ( !info.isFormatSupported(format) )
-    {
-        m_errorMsg = "Your audio device cannot play this format";
-        return false;
-    }   
+        if ( !info.isFormatSupported(format) )
+        {
+            m_errorMsg = "Your audio device cannot play this format";
+            return false;
+        }
 
-    m_audioDevice = new QAudioSink( QMediaDevices::defaultAudioOutput(), format );
-    connect( m_audioDevice, &QAudioSink::stateChanged, this, &AudioPlayerPrivate::audioStateChanged );
+        m_audioDevice = new QAudioSink( QMediaDevices::defaultAudioOutput(), format );
+        connect( m_audioDevice, &QAudioSink::stateChanged, this, &AudioPlayerPrivate::audioStateChanged );
+    }
 
     // Allocate the first frame
     m_decodedFrame = av_frame_alloc();
@@ -285,6 +292,9 @@ void AudioPlayerPrivate::queueClear()
 
 void AudioPlayerPrivate::play()
 {
+    if ( !m_audioDevice )
+        return;
+
     m_mutex.lock();
     m_playing = 1;
     m_mutex.unlock();
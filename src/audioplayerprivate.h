@@ -38,7 +38,7 @@ class AudioPlayerPrivate : public QIODevice
 		AudioPlayerPrivate();
 
 		bool	init();
-        bool	openAudio( const QString& filename );
+        bool	openAudio( const QString& filename, bool playback = true );
         void	closeAudio();
 		void	play();
         void	resetAudio();
@@ -49,6 +49,9 @@ class AudioPlayerPrivate : public QIODevice
 		qint64	totalTime() const;
 		QString	errorMsg() const;
 
+		// The opened file name
+		QString			m_fileName;
+
 		// Meta tags
 		QString			m_metaTitle;
 		QString			m_metaArtist;
@@ -68,9 +71,6 @@ class AudioPlayerPrivate : public QIODevice
 		void	queueClear();
 
 	private:
-		// Video encoder private class gets direct access to ffmpeg stuff
-		friend class FFMpegVideoEncoderPriv;
-
 		QString			m_errorMsg;
 
 		// Access to everything below is guarded by mutex
@@ -0,0 +1,120 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+
+//
+// A fixed capacity queue connecting two threads. The producer blocks while the queue
+// is full, the consumer blocks while it is empty. Every time a thread has to wait
+// it is counted as a stall, which shows which side is the bottleneck.
+//
+template <typename T> class BoundedQueue
+{
+    public:
+        BoundedQueue( int capacity )
+        {
+            m_capacity = qMax( 1, capacity );
+            m_closed = false;
+            m_pushStalls = 0;
+            m_popStalls = 0;
+        }
+
+        // Blocks while the queue is full. Returns false if the queue has been closed.
+        bool push( const T& item )
+        {
+            QMutexLocker m( &m_mutex );
+
+            if ( !m_closed && m_queue.size() >= m_capacity )
+            {
+                m_pushStalls++;
+
+                while ( !m_closed && m_queue.size() >= m_capacity )
+                    m_notFull.wait( &m_mutex );
+            }
+
+            if ( m_closed )
+                return false;
+
+            m_queue.enqueue( item );
+            m_notEmpty.wakeOne();
+            return true;
+        }
+
+        // Blocks while the queue is empty. Returns false if the queue has been closed and
+        // there is nothing left in it.
+        bool pop( T * item )
+        {
+            QMutexLocker m( &m_mutex );
+
+            if ( !m_closed && m_queue.isEmpty() )
+            {
+                m_popStalls++;
+
+                while ( !m_closed && m_queue.isEmpty() )
+                    m_notEmpty.wait( &m_mutex );
+            }
+
+            if ( m_queue.isEmpty() )
+                return false;
+
+            *item = m_queue.dequeue();
+            m_notFull.wakeOne();
+            return true;
+        }
+
+        // No more items will be pushed; wakes up everyone waiting
+        void close()
+        {
+            QMutexLocker m( &m_mutex );
+            m_closed = true;
+            m_notFull.wakeAll();
+            m_notEmpty.wakeAll();
+        }
+
+        // How many times the producer waited for the queue to have space
+        unsigned int pushStalls() const
+        {
+            QMutexLocker m( &m_mutex );
+            return m_pushStalls;
+        }
+
+        // How many times the consumer waited for the queue to have data
+        unsigned int popStalls() const
+        {
+            QMutexLocker m( &m_mutex );
+            return m_popStalls;
+        }
+
+    private:
+        mutable QMutex  m_mutex;
+        QWaitCondition  m_notFull;
+        QWaitCondition  m_notEmpty;
+        QQueue<T>       m_queue;
+        int             m_capacity;
+        bool            m_closed;
+        unsigned int    m_pushStalls;
+        unsigned int    m_popStalls;
+};
+
+#endif // BOUNDEDQUEUE_H
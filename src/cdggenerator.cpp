@@ -342,8 +342,50 @@ void CDGGenerator::generate( const Lyrics& lyrics, qint64 total_length )
 	if ( dlg.exec() != QDialog::Accepted )
 		return;
 
+	// Pop up progress dialog
+	QDialog progressDialog;
+	Ui::DialogEncodingProgress progressUi;
+	progressUi.setupUi( &progressDialog );
+
+	progressUi.groupBox->setTitle( "CD+G output statistics");
+	progressUi.txtFrames->setText("CD+G packets:");
+
+	progressUi.progressBar->setMaximum( 99 );
+	progressUi.progressBar->setMinimum( -1 );
+	progressUi.progressBar->setValue( -1 );
+
+	progressUi.lblFrames->setText( "0" );
+	progressUi.lblOutput->setText( "0 Mb" );
+	progressUi.lblTime->setText( "0:00.00" );
+
+	progressDialog.show();
+
+	QString errmsg = generateFile( lyrics,
+								   total_length,
+								   dlg.m_outputVideo,
+								   dlg.m_artist,
+								   dlg.m_title,
+								   dlg.m_createdBy,
+								   dlg.fontVideoStyle->currentData().toInt(),
+								   dlg.boxEnableAntialiasing->isChecked(),
+								   &progressUi );
+
+	if ( !errmsg.isEmpty() )
+		QMessageBox::critical( 0, QObject::tr("Cannot write CD+G file"), errmsg );
+}
+
+QString CDGGenerator::generate( const Lyrics& lyrics, qint64 total_length, const QString& filename, const QString& artist,
+								const QString& title, const QString& createdBy, int fontWeight, bool antialias )
+{
+	return generateFile( lyrics, total_length, filename, artist, title, createdBy, fontWeight, antialias, 0 );
+}
+
+QString CDGGenerator::generateFile( const Lyrics& lyrics, qint64 total_length, const QString& filename, const QString& artist,
+									const QString& title, const QString& createdBy, int fontWeight, bool antialias,
+									Ui::DialogEncodingProgress * progressUi )
+{
     // Get our parameters
-    m_enableAntiAlias = dlg.boxEnableAntialiasing->isChecked();
+    m_enableAntiAlias = antialias;
 
 	// Initialize the buffer and colors
 	init();
@@ -358,9 +400,9 @@ void CDGGenerator::generate( const Lyrics& lyrics, qint64 total_length )
     lyricrenderer.setLyrics( lyrics );
 
     // Title
-    lyricrenderer.setTitlePageData( dlg.m_artist,
-                                    dlg.m_title,
-                                    dlg.m_createdBy,
+    lyricrenderer.setTitlePageData( artist,
+                                    title,
+                                    createdBy,
                                     m_project->tag( Project::Tag_CDG_titletime, "5" ).toInt() * 1000 );
 
     // Rendering font
@@ -374,7 +416,7 @@ void CDGGenerator::generate( const Lyrics& lyrics, qint64 total_length )
         renderFont.setStyleStrategy( QFont::NoAntialias );
 
     // Apply boldness and aliasing first as it affects the maximum size
-    renderFont.setWeight( (QFont::Weight) dlg.fontVideoStyle->currentData().toInt( ) );
+    renderFont.setWeight( (QFont::Weight) fontWeight );
 
     if ( fontsize == 0 )
         fontsize = lyricrenderer.autodetectFontSize( QSize(CDG_DRAW_WIDTH, CDG_DRAW_HEIGHT), renderFont );
@@ -402,25 +444,8 @@ void CDGGenerator::generate( const Lyrics& lyrics, qint64 total_length )
 	QImage lastImage( CDG_DRAW_WIDTH, CDG_DRAW_HEIGHT, QImage::Format_ARGB32 );
 	lastImage.fill( m_colorBackground.rgb() );
 
-	// Pop up progress dialog
-	QDialog progressDialog;
-	Ui::DialogEncodingProgress progressUi;
-	progressUi.setupUi( &progressDialog );
-
-	progressUi.groupBox->setTitle( "CD+G output statistics");
-	progressUi.txtFrames->setText("CD+G packets:");
-
-	progressUi.progressBar->setMaximum( 99 );
-	progressUi.progressBar->setMinimum( -1 );
-	progressUi.progressBar->setValue( -1 );
-
-	progressUi.lblFrames->setText( "0" );
-	progressUi.lblOutput->setText( "0 Mb" );
-	progressUi.lblTime->setText( "0:00.00" );
-
-	progressDialog.show();
-
-	qint64 dialog_step = total_length / 100;
+	qint64 dialog_step = qMax( (qint64) 1, total_length / 100 );
+	int dialog_value = -1;
 
     // Preallocate the arrays
 	init();
@@ -437,15 +462,16 @@ void CDGGenerator::generate( const Lyrics& lyrics, qint64 total_length )
 			qint64 timing = m_stream.size() * 1000 / 300 + 250;
 
 			// Should we show the next step?
-			if ( timing / dialog_step > progressUi.progressBar->value() )
+			if ( progressUi && timing / dialog_step > dialog_value )
 			{
-				progressUi.progressBar->setValue( timing / dialog_step );
+				dialog_value = timing / dialog_step;
+				progressUi->progressBar->setValue( dialog_value );
 
-				progressUi.lblFrames->setText( QString::number( m_stream.size() ) );
-				progressUi.lblOutput->setText( QString( "%1 Kb" ) .arg( m_stream.size() * 24 / 1024 ) );
-				progressUi.lblTime->setText( markToTime( timing ) );
+				progressUi->lblFrames->setText( QString::number( m_stream.size() ) );
+				progressUi->lblOutput->setText( QString( "%1 Kb" ) .arg( m_stream.size() * 24 / 1024 ) );
+				progressUi->lblTime->setText( markToTime( timing ) );
 
-				progressUi.image->setPixmap( QPixmap::fromImage( lastImage ) );
+				progressUi->image->setPixmap( QPixmap::fromImage( lastImage ) );
 
 				qApp->processEvents( QEventLoop::ExcludeUserInputEvents );
 			}
@@ -461,16 +487,12 @@ void CDGGenerator::generate( const Lyrics& lyrics, qint64 total_length )
 				QImage errimg = lyricrenderer.image();
 				errimg.save( "error", "bmp" );
 
-				QMessageBox::critical( 0,
-									  "Invalid lyrics",
-									  QString("Lyrics out of boundary at %1, screen requested: %2x%3")
-										.arg( markToTime( timing ) )
-										.arg( errimg.width() )
-										.arg( errimg.height() )
-									  );
-
 				m_stream.clear();
-				return ;
+
+				return QObject::tr("Lyrics out of boundary at %1, screen requested: %2x%3")
+							.arg( markToTime( timing ) )
+							.arg( errimg.width() )
+							.arg( errimg.height() );
 			}
 
 			if ( status == LyricsRenderer::UPDATE_NOCHANGE )
@@ -507,25 +529,21 @@ void CDGGenerator::generate( const Lyrics& lyrics, qint64 total_length )
 				*p &= 0x3F;
 		}
 
-		QFile file( dlg.m_outputVideo );
+		QFile file( filename );
 		if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
 		{
-			QMessageBox::critical( 0,
-								   QObject::tr("Cannot write CD+G file"),
-								   QObject::tr("Cannot write CD+G file %1: %2")
-										.arg( dlg.m_outputVideo)
-										.arg(file.errorString()) );
-			return;
+			return QObject::tr("Cannot write CD+G file %1: %2")
+						.arg( filename )
+						.arg( file.errorString() );
 		}
 
 		file.write( stream() );
 	}
 	catch ( QString& txt )
 	{
-		QMessageBox::critical( 0,
-							   QObject::tr("Cannot write CD+G file"),
-							   QObject::tr("Cannot write CD+G file: %1")
-									.arg( txt ) );
-		return;
+		return QObject::tr("Cannot write CD+G file: %1")
+					.arg( txt );
 	}
+
+	return QString();
 }
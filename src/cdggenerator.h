@@ -30,6 +30,11 @@
 #include "project.h"
 #include "textrenderer.h"
 
+namespace Ui
+{
+	class DialogEncodingProgress;
+}
+
 class CDGGenerator
 {
 	public:
@@ -38,10 +43,20 @@ class CDGGenerator
 		// Generate the CD+G lyrics
 		void	generate( const Lyrics& lyrics, qint64 total_length );
 
+		// Generates the CD+G lyrics into the file without asking anything, with the renderer set up from the
+		// project CD+G tags; returns the error message, empty if succeeded. Could be called from any thread.
+		QString	generate( const Lyrics& lyrics, qint64 total_length, const QString& filename, const QString& artist,
+						  const QString& title, const QString& createdBy, int fontWeight, bool antialias );
+
 		// Returns the CD+G stream
 		QByteArray	stream();
 
 	private:
+		// Shows the progress in the dialog if not null
+		QString	generateFile( const Lyrics& lyrics, qint64 total_length, const QString& filename, const QString& artist,
+							  const QString& title, const QString& createdBy, int fontWeight, bool antialias,
+							  Ui::DialogEncodingProgress * progressUi );
+
 		void	init();
 		void	initColors();
 		void	addColorGradations( const QColor& color, unsigned int number );
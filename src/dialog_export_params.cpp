@@ -21,6 +21,8 @@
 #include <QSettings>
 #include <QMessageBox>
 #include <QWhatsThis>
+#include <QThread>
+#include <QCoreApplication>
 
 #include "textrenderer.h"
 #include "dialog_export_params.h"
@@ -38,6 +40,8 @@ DialogExportOptions::DialogExportOptions( Project * project, const Lyrics& lyric
 	m_project = project;
 	m_lyrics = lyrics;
 	m_time = 0;
+	m_fontSizeThread = 0;
+	m_fontSizeDetected = 0;
 
 	// UIC stuff
 	setupUi( this );
@@ -70,6 +74,10 @@ DialogExportOptions::DialogExportOptions( Project * project, const Lyrics& lyric
     fontVideoStyle->addItem( "X-Bold", QFont::ExtraBold );
     fontVideoStyle->setCurrentIndex( 2 );
 
+    // The font weight and aliasing change the maximum size too
+    connect( fontVideoStyle, SIGNAL(currentIndexChanged(int)), this, SLOT(recalculateLargestFontSize()) );
+    connect( boxEnableAntialiasing, SIGNAL(toggled(bool)), this, SLOT(recalculateLargestFontSize()) );
+
 	if ( video )
 	{
 		// Set the video output params
@@ -115,7 +123,7 @@ DialogExportOptions::DialogExportOptions( Project * project, const Lyrics& lyric
 	}
 
     // This order matters!
-    // this triggers font change callback and recalculates maximum value for spinFontSize
+    // this triggers font change callback and starts detecting the maximum value for spinFontSize
     fontVideo->setCurrentFont( QFont( m_project->tag( video ? Project::Tag_Video_font : Project::Tag_CDG_font, "arial" ) ) );
     fontVideo->setFontFilters( QFontComboBox::ScalableFonts | QFontComboBox::MonospacedFonts | QFontComboBox::ProportionalFonts );
 
@@ -124,6 +132,9 @@ DialogExportOptions::DialogExportOptions( Project * project, const Lyrics& lyric
     if ( fontsizevalue > 0 )
     {
         boxFontVideoSizeType->setCurrentIndex( 0 );
+
+        // The maximum is still being detected; it lowers the size once known if it does not fit
+        spinFontSize->setMaximum( qMax( spinFontSize->maximum(), fontsizevalue ) );
         spinFontSize->setValue( fontsizevalue );
     }
     else
@@ -167,19 +178,39 @@ void DialogExportOptions::setBoxIndex( Project::Tag tag, QComboBox * box )
 	}
 }
 
-int DialogExportOptions::calculateLargestFontSize( const QFont& font )
+DialogExportOptions::~DialogExportOptions()
 {
-	// Ask the renderer
-	TextRenderer renderer( 100, 100 );
-	renderer.setLyrics( m_lyrics );
-    renderer.setRenderFont( font );
+    // The detection cannot be interrupted, but does not take long
+    if ( m_fontSizeThread )
+    {
+        m_fontSizeThread->wait();
+        delete m_fontSizeThread;
+    }
+}
 
-    renderer.setTitlePageData( leArtist->text(),
-                               leTitle->text(),
-                               leTitleCreatedBy->text(),
-                               m_project->tag( Project::Tag_CDG_titletime, "5" ).toInt() * 1000 );
+QFont DialogExportOptions::previewFont()
+{
+    QFont font = fontVideo->currentFont();
+
+    // Apply boldness and aliasing first as it affects the maximum size
+    if ( boxEnableAntialiasing->isChecked() )
+        font.setStyleStrategy( QFont::PreferAntialias );
+    else
+        font.setStyleStrategy( QFont::NoAntialias );
 
-    return renderer.autodetectFontSize( getVideoSize(), font );
+    font.setWeight( (QFont::Weight) fontVideoStyle->currentData().toInt( ) );
+    return font;
+}
+
+QString DialogExportOptions::largestFontSizeKey( const QFont& font )
+{
+    QSize size = getVideoSize();
+
+    return QStringList( { font.key(),
+                          QString( "%1x%2" ).arg( size.width() ).arg( size.height() ),
+                          leArtist->text(),
+                          leTitle->text(),
+                          leTitleCreatedBy->text() } ).join( '\n' );
 }
 
 bool DialogExportOptions::testFontSize()
@@ -248,8 +279,21 @@ void DialogExportOptions::accept()
 		return;
 	}
 
-	if ( !testFontSize() )
-		return;
+	// The autofit size is detected again by the export, so only the fixed size is checked
+	if ( boxFontVideoSizeType->currentIndex() == 0 )
+	{
+		// Its maximum must be known first; if the params changed meanwhile, it is detected again
+		while ( m_fontSizeThread )
+		{
+			m_fontSizeThread->wait();
+
+			// Delivers the finished() call to largestFontSizeDetected()
+			QCoreApplication::sendPostedEvents( this, QEvent::MetaCall );
+		}
+
+		if ( !testFontSize() )
+			return;
+	}
 
 	// Store title params
 	m_artist = leArtist->text();
@@ -267,6 +311,8 @@ void DialogExportOptions::accept()
 
         m_audioEncodingType = boxAudioEncodingType->currentIndex();
 		m_quality = boxVideoQuality->itemData( boxVideoQuality->currentIndex() ).toInt();
+		m_speedPreset = boxEncodingSpeed->itemData( boxEncodingSpeed->currentIndex() ).toString();
+		m_tune = boxEncodingTune->itemData( boxEncodingTune->currentIndex() ).toString();
 
 		// Store rendering params
 		m_project->setTag( Project::Tag_Video_activecolor, btnVideoColorActive->color().name() );
@@ -342,6 +388,8 @@ void DialogExportOptions::videoTargetChanged( int )
 	// as well as quality settings.
 	boxVideoProfile->clear();
 	boxVideoQuality->clear();
+	boxEncodingSpeed->clear();
+	boxEncodingTune->clear();
 
 	m_currentProfile = pVideoEncodingProfiles->videoProfile( boxVideoTarget->currentText() );
 
@@ -368,8 +416,27 @@ void DialogExportOptions::videoTargetChanged( int )
 	if ( m_currentProfile->bitratesEnabled[VideoEncodingProfile::BITRATE_LOW] )
 		boxVideoQuality->addItem( tr("Low"), VideoEncodingProfile::BITRATE_LOW );
 
+	// Encoder speed presets, the profile default selected
+	Q_FOREACH ( QString preset, m_currentProfile->speedPresets() )
+	{
+		if ( preset == m_currentProfile->speedPreset )
+		{
+			boxEncodingSpeed->addItem( tr("%1 (default)").arg( preset ), preset );
+			boxEncodingSpeed->setCurrentIndex( boxEncodingSpeed->count() - 1 );
+		}
+		else
+			boxEncodingSpeed->addItem( preset, preset );
+	}
+
+	boxEncodingTune->addItem( tr("none"), QString() );
+
+	Q_FOREACH ( QString tune, m_currentProfile->tunes() )
+		boxEncodingTune->addItem( tune, tune );
+
 	boxVideoProfile->setEnabled( boxVideoProfile->count() > 1 );
 	boxVideoQuality->setEnabled( boxVideoQuality->count() > 1 );
+	boxEncodingSpeed->setEnabled( boxEncodingSpeed->count() > 1 );
+	boxEncodingTune->setEnabled( boxEncodingTune->count() > 1 );
 }
 
 void DialogExportOptions::videoShowDetails()
@@ -461,21 +528,21 @@ void DialogExportOptions::activateTab( int index )
     }
 
     // Prepare the text renderer using current params
-    QFont font = fontVideo->currentFont();
+    QFont font = previewFont();
 
-    // Apply boldness and aliasing first as it affects the maximum size
-    if ( boxEnableAntialiasing->isChecked() )
-        font.setStyleStrategy( QFont::PreferAntialias );
-    else
-        font.setStyleStrategy( QFont::NoAntialias );
+    // Autofit or fixed size? The autofit preview is drawn once its size is detected
+    if ( boxFontVideoSizeType->currentIndex() == 1 )
+    {
+        recalculateLargestFontSize();
 
-    font.setWeight( (QFont::Weight) fontVideoStyle->currentData().toInt( ) );
+        if ( !m_largestFontSizes.contains( largestFontSizeKey( font ) ) )
+        {
+            adjustSize();
+            return;
+        }
+    }
 
-    // Autofit or fixed size?
-    if ( boxFontVideoSizeType->currentIndex() == 0 )
-        font.setPointSize( spinFontSize->value() );
-    else
-        font.setPointSize( calculateLargestFontSize(font) );
+    font.setPointSize( spinFontSize->value() );
 
     m_renderer = TextRenderer( getVideoSize().width(), getVideoSize().height() );
 
@@ -537,11 +604,61 @@ void DialogExportOptions::previewSliderMoved( int newvalue )
 
 void DialogExportOptions::recalculateLargestFontSize()
 {
-    int maxsize = calculateLargestFontSize( fontVideo->currentFont() );
-    spinFontSize->setMaximum( maxsize );
+    QFont font = previewFont();
+    QString key = largestFontSizeKey( font );
 
-    if ( boxFontVideoSizeType->currentIndex() == 1 )
-        spinFontSize->setValue( maxsize );
+    if ( m_largestFontSizes.contains( key ) )
+    {
+        int maxsize = m_largestFontSizes[ key ];
+        spinFontSize->setMaximum( maxsize );
+
+        if ( boxFontVideoSizeType->currentIndex() == 1 )
+            spinFontSize->setValue( maxsize );
+
+        return;
+    }
+
+    // Called again once the running detection finishes
+    if ( m_fontSizeThread )
+        return;
+
+    // The thread only gets the copies of the params
+    Lyrics lyrics = m_lyrics;
+    QSize size = getVideoSize();
+    QString artist = leArtist->text();
+    QString title = leTitle->text();
+    QString createdBy = leTitleCreatedBy->text();
+    unsigned int titletime = m_project->tag( Project::Tag_CDG_titletime, "5" ).toInt() * 1000;
+
+    m_fontSizeKey = key;
+    m_fontSizeThread = QThread::create( [this, lyrics, font, size, artist, title, createdBy, titletime]()
+    {
+        TextRenderer renderer( 100, 100 );
+        renderer.setLyrics( lyrics );
+        renderer.setRenderFont( font );
+        renderer.setTitlePageData( artist, title, createdBy, titletime );
+
+        m_fontSizeDetected = renderer.autodetectFontSize( size, font );
+    });
+
+    connect( m_fontSizeThread, SIGNAL(finished()), this, SLOT(largestFontSizeDetected()) );
+    m_fontSizeThread->start();
+}
+
+void DialogExportOptions::largestFontSizeDetected()
+{
+    m_largestFontSizes[ m_fontSizeKey ] = m_fontSizeDetected;
+    m_fontSizeThread->deleteLater();
+    m_fontSizeThread = 0;
+
+    bool current = m_fontSizeKey == largestFontSizeKey( previewFont() );
+
+    // Applies the size, or detects it again if the params changed meanwhile
+    recalculateLargestFontSize();
+
+    // The autofit preview waits for the size
+    if ( current && tabWidget->currentIndex() == 1 && boxFontVideoSizeType->currentIndex() == 1 )
+        activateTab( 1 );
 }
 
 void DialogExportOptions::fontSizeStrategyChanged(int index)
@@ -551,13 +668,11 @@ void DialogExportOptions::fontSizeStrategyChanged(int index)
         // Fixed size strategy
         spinFontSize->setEnabled( true );
         spinFontSize->setMinimum( 4 );
-        spinFontSize->setMaximum( calculateLargestFontSize( fontVideo->currentFont() ) );
-        spinFontSize->setValue( spinFontSize->maximum() );
     }
     else
-    {
-        spinFontSize->setMaximum( calculateLargestFontSize( fontVideo->currentFont() ) );
-        spinFontSize->setValue( spinFontSize->maximum() );
         spinFontSize->setEnabled( false );
-    }
+
+    // Until the maximum is detected, the previous one is used
+    recalculateLargestFontSize();
+    spinFontSize->setValue( spinFontSize->maximum() );
 }
@@ -21,6 +21,7 @@
 #define VIDEOEXPORTOPTIONS_H
 
 #include <QDialog>
+#include <QMap>
 #include "ui_dialog_export_params.h"
 
 #include "videoencodingprofiles.h"
@@ -29,12 +30,15 @@
 #include "project.h"
 
 
+class QThread;
+
 class DialogExportOptions : public QDialog, public Ui::DialogExportParams
 {
     Q_OBJECT
 
 	public:
 		DialogExportOptions( Project * project, const Lyrics& lyrics, bool video = true, QWidget *parent = 0 );
+		~DialogExportOptions();
 
 		// For both CD+G and video modes
 		QSize	getVideoSize();
@@ -54,6 +58,7 @@ class DialogExportOptions : public QDialog, public Ui::DialogExportParams
 		void	previewUpdateImage();
 		void	previewSliderMoved( int newvalue );
         void    recalculateLargestFontSize();
+        void    largestFontSizeDetected();
         void    fontSizeStrategyChanged(int index);
 
 		void	accept();
@@ -68,9 +73,14 @@ class DialogExportOptions : public QDialog, public Ui::DialogExportParams
 		QString	m_title;
 		QString	m_createdBy;
 
+		// Encoder speed preset and tuning; empty - the profile default
+		QString	m_speedPreset;
+		QString	m_tune;
+
 	private:
 		void	setBoxIndex( Project::Tag tag, QComboBox * box );
-        int     calculateLargestFontSize(const QFont &font);
+        QString largestFontSizeKey( const QFont& font );
+        QFont   previewFont();
         bool    testFontSize();
 
 	private:
@@ -82,6 +92,14 @@ class DialogExportOptions : public QDialog, public Ui::DialogExportParams
 		TextRenderer	m_renderer;
 		qint64			m_time;
 
+		// The largest font size is detected in background, so the long lyrics do not block the dialog.
+		// The detected sizes are kept per font, video size and title; if the params change while
+		// detecting, the detection runs again once finished.
+		QThread		*	m_fontSizeThread;
+		QString			m_fontSizeKey;
+		int				m_fontSizeDetected;
+		QMap< QString, int >	m_largestFontSizes;
+
 		// For current video selection tracking
 		const VideoEncodingProfile * m_currentProfile;
 		const VideoFormat * m_currentVideoFormat;
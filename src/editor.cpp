@@ -140,11 +140,17 @@ bool Editor::importFromString( const QString& lyricstr )
 
 bool Editor::importFromOldString( const QString& lyricstr )
 {
-	QString strlyrics;
-
 	clear();
 	setEnabled( true );
 
+	setPlainText( convertFromOldString( lyricstr ) );
+	return true;
+}
+
+QString Editor::convertFromOldString( const QString& lyricstr )
+{
+	QString strlyrics;
+
 	// A simple state machine
 	QString saved;
 
@@ -184,8 +190,7 @@ bool Editor::importFromOldString( const QString& lyricstr )
 			saved.push_back( lyricstr[i] );
 	}
 
-	setPlainText( strlyrics );
-	return true;
+	return strlyrics;
 }
 
 bool Editor::exportLyrics( Lyrics * lyrics )
@@ -193,7 +198,12 @@ bool Editor::exportLyrics( Lyrics * lyrics )
 	if ( !validate() )
 		return false;
 
-	QString text = toPlainText();
+	exportLyricsFromString( toPlainText(), lyrics );
+	return true;
+}
+
+void Editor::exportLyricsFromString( const QString& text, Lyrics * lyrics )
+{
 	QStringList lines = text.split( '\n' );
 
 	lyrics->beginLyrics();
@@ -281,7 +291,6 @@ bool Editor::exportLyrics( Lyrics * lyrics )
 	}
 
 	lyrics->endLyrics();
-	return true;
 }
 
 void Editor::importLyrics( const Lyrics& lyrics )
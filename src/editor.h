@@ -98,6 +98,11 @@ class Editor : public QTextEdit
 		bool	importFromString( const QString& lyricstr );
 		bool	importFromOldString( const QString& lyricstr );
 
+		// Same as above but do not require the editor widget, so could be used when
+		// exporting without GUI. No validation is performed.
+		static void		exportLyricsFromString( const QString& text, Lyrics * lyrics );
+		static QString	convertFromOldString( const QString& lyricstr );
+
     signals:
         void    lyricsChanged( qint64 time );
 
@@ -0,0 +1,491 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+
+#include <QSettings>
+#include <QFileInfo>
+#include <QDir>
+#include <QThread>
+
+#include "exportqueue.h"
+#include "audioexportthread.h"
+#include "ffmpegvideoencoder.h"
+#include "videogeneratorthread.h"
+#include "videogenerator.h"
+#include "textrenderer.h"
+#include "settings.h"
+#include "project.h"
+#include "editor.h"
+#include "lyrics.h"
+
+
+ExportQueue::ExportQueue( QObject * parent )
+    : QObject( parent )
+{
+    mNextId = 1;
+    mMaxJobs = qMax( 1, pSettings->m_videoExportQueueJobs );
+    mActive = false;
+
+    load();
+}
+
+ExportQueue::~ExportQueue()
+{
+    mActive = false;
+
+    // The interrupted exports start again next time
+    for ( QMap< VideoGeneratorThread *, int >::const_iterator it = mRunning.constBegin(); it != mRunning.constEnd(); ++it )
+        it.key()->abort();
+
+    for ( QMap< VideoGeneratorThread *, int >::const_iterator it = mRunning.constBegin(); it != mRunning.constEnd(); ++it )
+    {
+        it.key()->wait();
+        delete it.key();
+
+        int index = jobIndex( it.value() );
+
+        if ( index >= 0 )
+            mJobs[index].state = StateQueued;
+    }
+
+    mRunning.clear();
+    save();
+}
+
+void ExportQueue::load()
+{
+    if ( isRunning() )
+        return;
+
+    QSettings settings;
+
+    mJobs.clear();
+    mNextId = settings.value( "exportqueue/nextid", 1 ).toInt();
+
+    int count = settings.beginReadArray( "exportqueue/jobs" );
+
+    for ( int i = 0; i < count; i++ )
+    {
+        settings.setArrayIndex( i );
+
+        Job job;
+        job.id = settings.value( "id" ).toInt();
+        job.projectFile = settings.value( "project" ).toString();
+        job.outputFile = settings.value( "output" ).toString();
+        job.profile = settings.value( "profile" ).toString();
+        job.format = settings.value( "format" ).toString();
+        job.quality = qMin( settings.value( "quality" ).toUInt(), (unsigned int) VideoEncodingProfile::BITRATE_HIGH );
+        job.audioMode = settings.value( "audiomode" ).toUInt();
+        job.speedPreset = settings.value( "preset" ).toString();
+        job.tune = settings.value( "tune" ).toString();
+        job.artist = settings.value( "artist" ).toString();
+        job.title = settings.value( "title" ).toString();
+        job.createdBy = settings.value( "createdby" ).toString();
+        job.state = (State) settings.value( "state" ).toInt();
+        job.errorMsg = settings.value( "error" ).toString();
+
+        // The application exited while exporting, so the export starts again
+        if ( job.state == StateRunning )
+            job.state = StateQueued;
+
+        job.progress = job.state == StateFinished ? 100 : 0;
+
+        mNextId = qMax( mNextId, job.id + 1 );
+        mJobs.append( job );
+    }
+
+    settings.endArray();
+    emit queueChanged();
+}
+
+void ExportQueue::save() const
+{
+    QSettings settings;
+
+    settings.setValue( "exportqueue/nextid", mNextId );
+    settings.remove( "exportqueue/jobs" );
+    settings.beginWriteArray( "exportqueue/jobs", mJobs.size() );
+
+    for ( int i = 0; i < mJobs.size(); i++ )
+    {
+        const Job& job = mJobs[i];
+        settings.setArrayIndex( i );
+
+        settings.setValue( "id", job.id );
+        settings.setValue( "project", job.projectFile );
+        settings.setValue( "output", job.outputFile );
+        settings.setValue( "profile", job.profile );
+        settings.setValue( "format", job.format );
+        settings.setValue( "quality", job.quality );
+        settings.setValue( "audiomode", job.audioMode );
+        settings.setValue( "preset", job.speedPreset );
+        settings.setValue( "tune", job.tune );
+        settings.setValue( "artist", job.artist );
+        settings.setValue( "title", job.title );
+        settings.setValue( "createdby", job.createdBy );
+        settings.setValue( "state", (int) job.state );
+        settings.setValue( "error", job.errorMsg );
+    }
+
+    settings.endArray();
+}
+
+int ExportQueue::addJob( const Job& job )
+{
+    Job added = job;
+    added.id = mNextId++;
+    added.state = StateQueued;
+    added.errorMsg.clear();
+    added.progress = 0;
+
+    mJobs.append( added );
+    save();
+    emit queueChanged();
+
+    if ( mActive )
+        schedule();
+
+    return added.id;
+}
+
+bool ExportQueue::removeJob( int id )
+{
+    int index = jobIndex( id );
+
+    if ( index < 0 || mJobs[index].state == StateRunning )
+        return false;
+
+    mJobs.removeAt( index );
+    save();
+    emit queueChanged();
+    return true;
+}
+
+void ExportQueue::clearDone()
+{
+    for ( int i = mJobs.size() - 1; i >= 0; i-- )
+    {
+        if ( mJobs[i].state != StateQueued && mJobs[i].state != StateRunning )
+            mJobs.removeAt( i );
+    }
+
+    save();
+    emit queueChanged();
+}
+
+QList<ExportQueue::Job> ExportQueue::jobs() const
+{
+    return mJobs;
+}
+
+bool ExportQueue::isRunning() const
+{
+    return mActive || !mRunning.isEmpty();
+}
+
+void ExportQueue::setMaxJobs( int jobs )
+{
+    mMaxJobs = qMax( 1, jobs );
+
+    if ( mActive )
+        schedule();
+}
+
+int ExportQueue::maxJobs() const
+{
+    return mMaxJobs;
+}
+
+QString ExportQueue::stateName( State state )
+{
+    switch ( state )
+    {
+        case StateQueued:
+            return "Queued";
+
+        case StateRunning:
+            return "Running";
+
+        case StateFinished:
+            return "Finished";
+
+        case StateFailed:
+            return "Failed";
+
+        case StateAborted:
+            return "Aborted";
+    }
+
+    return QString();
+}
+
+void ExportQueue::start()
+{
+    mActive = true;
+    schedule();
+}
+
+void ExportQueue::stop()
+{
+    mActive = false;
+
+    if ( mRunning.isEmpty() )
+    {
+        emit idle();
+        return;
+    }
+
+    for ( QMap< VideoGeneratorThread *, int >::const_iterator it = mRunning.constBegin(); it != mRunning.constEnd(); ++it )
+    {
+        mRequeued.append( it.value() );
+        it.key()->abort();
+    }
+}
+
+void ExportQueue::abortJob( int id )
+{
+    int index = jobIndex( id );
+
+    if ( index < 0 )
+        return;
+
+    if ( mJobs[index].state == StateQueued )
+    {
+        mJobs[index].state = StateAborted;
+        save();
+        emit jobChanged( id );
+        return;
+    }
+
+    VideoGeneratorThread * thread = mRunning.key( id, 0 );
+
+    if ( thread )
+    {
+        mAborted.append( id );
+        thread->abort();
+    }
+}
+
+void ExportQueue::schedule()
+{
+    while ( mActive && mRunning.size() < mMaxJobs )
+    {
+        int index = -1, queued = 0;
+
+        for ( int i = 0; i < mJobs.size(); i++ )
+        {
+            if ( mJobs[i].state != StateQueued )
+                continue;
+
+            if ( index < 0 )
+                index = i;
+
+            queued++;
+        }
+
+        if ( index < 0 )
+            break;
+
+        // The cores are shared equally by the jobs which will run at once, so a job started
+        // alone (or the last one) gets them all, but it keeps its share once started
+        int running = qMin( mMaxJobs, mRunning.size() + queued );
+        int threads = qMax( 2, QThread::idealThreadCount() / running );
+
+        Job& job = mJobs[index];
+        job.errorMsg = startJob( job, threads );
+        job.state = job.errorMsg.isEmpty() ? StateRunning : StateFailed;
+        job.progress = 0;
+
+        emit jobChanged( job.id );
+    }
+
+    save();
+
+    if ( mActive && mRunning.isEmpty() )
+    {
+        mActive = false;
+        emit idle();
+    }
+}
+
+int ExportQueue::jobIndex( int id ) const
+{
+    for ( int i = 0; i < mJobs.size(); i++ )
+    {
+        if ( mJobs[i].id == id )
+            return i;
+    }
+
+    return -1;
+}
+
+QString ExportQueue::startJob( Job& job, int threads )
+{
+    const VideoEncodingProfile * profile = pVideoEncodingProfiles->videoProfile( job.profile );
+
+    if ( !profile )
+        return QString("Unknown video profile %1") .arg( job.profile );
+
+    const VideoFormat * format = pVideoEncodingProfiles->videoFormat( job.format );
+
+    if ( !format )
+        return QString("Unknown video format %1") .arg( job.format );
+
+    if ( !profile->bitratesEnabled[job.quality] )
+        return QString("The quality is not supported by profile %1") .arg( job.profile );
+
+    // Load the project; there is no editor, so lyrics stay in the project data
+    Project project( 0 );
+
+    if ( !project.load( job.projectFile ) )
+        return QString("Cannot load the project %1") .arg( job.projectFile );
+
+    Lyrics lyrics;
+    Editor::exportLyricsFromString( project.lyricsText(), &lyrics );
+
+    if ( lyrics.isEmpty() )
+        return QString("Project %1 contains no lyrics") .arg( job.projectFile );
+
+    // Music file is relative to the project location. The encoder reads it by itself,
+    // but the song length is needed for the renderer before.
+    QString musicFile = QFileInfo( job.projectFile ).absoluteDir().absoluteFilePath( project.musicFile() );
+    qint64 total_length;
+
+    {
+        AudioExportThread music;
+
+        if ( !music.open( musicFile ) )
+            return QString("Cannot open music file %1: %2") .arg( musicFile ) .arg( music.errorMsg() );
+
+        total_length = music.duration();
+    }
+
+    if ( total_length <= 0 )
+        return QString("Cannot find the length of music file %1") .arg( musicFile );
+
+    project.setSongLength( total_length );
+
+    TextRenderer * lyricrenderer = VideoGenerator::createRenderer( &project, lyrics, format, job.artist, job.title, job.createdBy );
+
+    // When pipelined, half of the job threads render the lyrics and the rest are left to the codec.
+    // Otherwise the rendering shares the generator thread, and the codec gets them all.
+    int renderThreads = pSettings->m_videoExportPipelineDepth > 0 ? qMax( 1, threads / 2 ) : 0;
+    int codecThreads = qMax( 1, threads - renderThreads );
+
+    FFMpegVideoEncoder * encoder = new FFMpegVideoEncoder();
+    encoder->setVariableFrameRate( FFMpegVideoEncoder::supportsVariableFrameRate( profile ) ? qMax( 0, pSettings->m_videoExportVfrKeepalive ) : 0 );
+    encoder->setAudioCopy( job.audioMode == 1 );
+    encoder->setSpeedPreset( job.speedPreset, job.tune );
+    encoder->setCodecThreads( codecThreads );
+
+    // Calculate the time step for rendering
+    qint64 time_step = (1000 * format->frame_rate_num) / format->frame_rate_den;
+
+    // The thread measures the encoder stages, so it is created before the file
+    VideoGeneratorThread * thread = new VideoGeneratorThread( encoder, lyricrenderer, total_length, time_step );
+
+    QString errmsg = encoder->createFile( job.outputFile, profile, format, job.quality, job.audioMode == 2 ? QString() : musicFile );
+
+    if ( !errmsg.isEmpty() )
+    {
+        // Also deletes the encoder and the renderer
+        delete thread;
+        return QString("Cannot create video file: %1") .arg( errmsg );
+    }
+
+    thread->setPipelineDepth( pSettings->m_videoExportPipelineDepth );
+    thread->setRenderThreads( qMax( 1, renderThreads ) );
+
+    connect( thread, SIGNAL( finished(QString)), this, SLOT(videoFinished(QString)), Qt::QueuedConnection );
+    connect( thread, SIGNAL( progress(int, QString, QString, QString, QString)), this, SLOT(videoProgress(int, QString, QString, QString, QString)), Qt::QueuedConnection );
+
+    mRunning[ thread ] = job.id;
+    thread->start();
+
+    return QString();
+}
+
+void ExportQueue::videoProgress( int progress, QString frames, QString size, QString timing, QString speed )
+{
+    VideoGeneratorThread * thread = (VideoGeneratorThread *) sender();
+    int id = mRunning.value( thread, -1 );
+    int index = jobIndex( id );
+
+    if ( index < 0 )
+        return;
+
+    mJobs[index].progress = progress;
+
+    emit jobChanged( id );
+    emit this->progress( id, progress, frames, size, timing, speed );
+}
+
+void ExportQueue::videoFinished( QString errortext )
+{
+    VideoGeneratorThread * thread = (VideoGeneratorThread *) sender();
+    int id = mRunning.take( thread );
+
+    // The signal is emitted at the end of run()
+    thread->wait();
+    thread->deleteLater();
+
+    // It might have finished before it was aborted
+    bool aborted = mAborted.removeAll( id ) > 0;
+    bool requeued = mRequeued.removeAll( id ) > 0;
+    int index = jobIndex( id );
+
+    if ( index >= 0 )
+    {
+        Job& job = mJobs[index];
+
+        if ( errortext.isEmpty() )
+        {
+            job.state = StateFinished;
+            job.progress = 100;
+        }
+        else if ( aborted )
+        {
+            job.state = StateAborted;
+            job.errorMsg = errortext;
+        }
+        else if ( requeued )
+        {
+            job.state = StateQueued;
+            job.errorMsg.clear();
+            job.progress = 0;
+        }
+        else
+        {
+            job.state = StateFailed;
+            job.errorMsg = errortext;
+        }
+
+        emit jobChanged( id );
+    }
+
+    if ( mActive )
+        schedule();
+    else
+    {
+        save();
+
+        if ( mRunning.isEmpty() )
+            emit idle();
+    }
+}
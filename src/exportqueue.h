@@ -0,0 +1,153 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+
+#ifndef EXPORTQUEUE_H
+#define EXPORTQUEUE_H
+
+#include <QObject>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+class VideoGeneratorThread;
+
+//
+// Persistent queue of video exports. Every job exports a saved project file with its own profile,
+// format and quality, so jobs for many projects could be queued, and the queue is kept in the settings
+// across restarts (the interrupted exports start again). Several jobs run at once; the cores are
+// budgeted between them, and each job splits its share between the lyrics render threads and the
+// video codec threads. A job reads its own music file, so it does not touch the audio player.
+//
+class ExportQueue : public QObject
+{
+    Q_OBJECT
+
+    public:
+        enum State
+        {
+            StateQueued = 0,
+            StateRunning,
+            StateFinished,
+            StateFailed,
+            StateAborted
+        };
+
+        typedef struct
+        {
+            int             id;
+            QString         projectFile;
+            QString         outputFile;
+            QString         profile;
+            QString         format;
+            unsigned int    quality;
+
+            // 0 - encode, 1 - copy, 2 - no audio (same as the export dialog)
+            unsigned int    audioMode;
+
+            // Encoder speed preset and tuning; empty - the profile default
+            QString         speedPreset;
+            QString         tune;
+
+            // Title page
+            QString         artist;
+            QString         title;
+            QString         createdBy;
+
+            State           state;
+            QString         errorMsg;
+            int             progress;
+        } Job;
+
+        ExportQueue( QObject * parent = 0 );
+
+        // Aborts the running jobs, which are queued again for the next start
+        ~ExportQueue();
+
+        // Reads the queue from the settings, replacing the current one; ignored while running
+        void    load();
+
+        // Adds the job to the end of the queue; returns its id. The queue is saved.
+        int     addJob( const Job& job );
+
+        // Removes a job which is not running; returns false if it is running or not found
+        bool    removeJob( int id );
+
+        QList<Job> jobs() const;
+        bool    isRunning() const;
+
+        // How many jobs run at once; the change applies to the jobs started after it
+        void    setMaxJobs( int jobs );
+        int     maxJobs() const;
+
+        static QString stateName( State state );
+
+    signals:
+        // The job state or progress changed
+        void    jobChanged( int id );
+
+        // Progress of the running job, as reported by its generator thread
+        void    progress( int id, int progress, QString frames, QString size, QString timing, QString speed );
+
+        // Jobs were added or removed
+        void    queueChanged();
+
+        // No more queued jobs are running, or the queue was stopped
+        void    idle();
+
+    public slots:
+        // Starts the queued jobs, as many as allowed at once, and then the next ones as they finish
+        void    start();
+
+        // Aborts the running jobs, which stay queued, and starts no more
+        void    stop();
+
+        // Aborts the job, which is then not started again
+        void    abortJob( int id );
+
+        // Removes all finished, failed and aborted jobs
+        void    clearDone();
+
+    private slots:
+        void    videoProgress( int progress, QString frames, QString size, QString timing, QString speed );
+        void    videoFinished( QString errortext );
+
+    private:
+        void    save() const;
+        void    schedule();
+        int     jobIndex( int id ) const;
+
+        // Loads the project and starts its export with this many threads; returns the error message if failed
+        QString startJob( Job& job, int threads );
+
+    private:
+        QList<Job>      mJobs;
+        int             mNextId;
+        int             mMaxJobs;
+
+        // Running exports; the jobs which are aborted, and which are queued again when finished
+        QMap< VideoGeneratorThread *, int > mRunning;
+        QList<int>      mAborted;
+        QList<int>      mRequeued;
+
+        // If false, no more jobs are started
+        bool            mActive;
+};
+
+#endif // EXPORTQUEUE_H
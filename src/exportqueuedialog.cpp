@@ -0,0 +1,170 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+
+#include <QFileInfo>
+#include <QSettings>
+#include <QThread>
+
+#include "exportqueuedialog.h"
+#include "settings.h"
+
+
+ExportQueueDialog::ExportQueueDialog( ExportQueue * queue, QWidget * parent )
+	: QDialog( parent ), Ui::ExportQueueDialog()
+{
+	setupUi( this );
+	m_queue = queue;
+
+	spinJobs->setValue( m_queue->maxJobs() );
+	maxJobsChanged( m_queue->maxJobs() );
+
+	connect( m_queue, SIGNAL(queueChanged()), this, SLOT(refresh()) );
+	connect( m_queue, SIGNAL(jobChanged(int)), this, SLOT(jobChanged(int)) );
+	connect( m_queue, SIGNAL(idle()), this, SLOT(updateButtons()) );
+	connect( tableJobs, SIGNAL(itemSelectionChanged()), this, SLOT(updateButtons()) );
+	connect( spinJobs, SIGNAL(valueChanged(int)), this, SLOT(maxJobsChanged(int)) );
+	connect( btnStart, SIGNAL(clicked()), m_queue, SLOT(start()) );
+	connect( btnStart, SIGNAL(clicked()), this, SLOT(updateButtons()) );
+	connect( btnStop, SIGNAL(clicked()), m_queue, SLOT(stop()) );
+	connect( btnAbort, SIGNAL(clicked()), this, SLOT(abortJob()) );
+	connect( btnRemove, SIGNAL(clicked()), this, SLOT(removeJob()) );
+	connect( btnClear, SIGNAL(clicked()), m_queue, SLOT(clearDone()) );
+
+	refresh();
+}
+
+void ExportQueueDialog::showEvent( QShowEvent * event )
+{
+	// Jobs could have been added from the command line meanwhile
+	if ( !m_queue->isRunning() )
+		m_queue->load();
+
+	QDialog::showEvent( event );
+}
+
+void ExportQueueDialog::refresh()
+{
+	QList<ExportQueue::Job> jobs = m_queue->jobs();
+	tableJobs->setRowCount( jobs.size() );
+
+	for ( int row = 0; row < jobs.size(); row++ )
+		updateRow( row, jobs[row] );
+
+	updateButtons();
+}
+
+void ExportQueueDialog::jobChanged( int id )
+{
+	QList<ExportQueue::Job> jobs = m_queue->jobs();
+
+	for ( int row = 0; row < jobs.size() && row < tableJobs->rowCount(); row++ )
+	{
+		if ( jobs[row].id == id )
+			updateRow( row, jobs[row] );
+	}
+
+	updateButtons();
+}
+
+void ExportQueueDialog::updateRow( int row, const ExportQueue::Job& job )
+{
+	QString status = ExportQueue::stateName( job.state );
+
+	if ( job.state == ExportQueue::StateRunning )
+		status += QString(" %1%") .arg( qMax( 0, job.progress ) );
+	else if ( !job.errorMsg.isEmpty() )
+		status += ": " + job.errorMsg;
+
+	QStringList columns;
+	columns << QFileInfo( job.projectFile ).fileName() << job.outputFile << job.profile << job.format << status;
+
+	for ( int column = 0; column < columns.size(); column++ )
+	{
+		QTableWidgetItem * item = tableJobs->item( row, column );
+
+		if ( !item )
+		{
+			item = new QTableWidgetItem();
+			tableJobs->setItem( row, column, item );
+		}
+
+		item->setText( columns[column] );
+		item->setToolTip( column == 0 ? job.projectFile : columns[column] );
+		item->setData( Qt::UserRole, job.id );
+	}
+}
+
+int ExportQueueDialog::selectedJob() const
+{
+	QList<QTableWidgetItem *> items = tableJobs->selectedItems();
+
+	if ( items.isEmpty() )
+		return -1;
+
+	return items.first()->data( Qt::UserRole ).toInt();
+}
+
+void ExportQueueDialog::updateButtons()
+{
+	int id = selectedJob();
+	ExportQueue::State state = ExportQueue::StateFinished;
+
+	Q_FOREACH ( const ExportQueue::Job& job, m_queue->jobs() )
+	{
+		if ( job.id == id )
+			state = job.state;
+	}
+
+	btnStart->setEnabled( !m_queue->isRunning() );
+	btnStop->setEnabled( m_queue->isRunning() );
+	btnAbort->setEnabled( id >= 0 && (state == ExportQueue::StateQueued || state == ExportQueue::StateRunning) );
+	btnRemove->setEnabled( id >= 0 && state != ExportQueue::StateRunning );
+}
+
+void ExportQueueDialog::maxJobsChanged( int jobs )
+{
+	m_queue->setMaxJobs( jobs );
+
+	if ( pSettings->m_videoExportQueueJobs != jobs )
+	{
+		pSettings->m_videoExportQueueJobs = jobs;
+		QSettings().setValue( "advanced/videoexportqueuejobs", jobs );
+	}
+
+	lblThreads->setText( tr("Each export uses %1 of %2 threads, shared between the lyrics rendering and the video codec")
+						 .arg( qMax( 2, QThread::idealThreadCount() / jobs ) )
+						 .arg( QThread::idealThreadCount() ) );
+}
+
+void ExportQueueDialog::abortJob()
+{
+	int id = selectedJob();
+
+	if ( id >= 0 )
+		m_queue->abortJob( id );
+}
+
+void ExportQueueDialog::removeJob()
+{
+	int id = selectedJob();
+
+	if ( id >= 0 )
+		m_queue->removeJob( id );
+}
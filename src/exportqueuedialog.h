@@ -0,0 +1,59 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+
+#ifndef EXPORTQUEUEDIALOG_H
+#define EXPORTQUEUEDIALOG_H
+
+#include <QDialog>
+#include "ui_exportqueuedialog.h"
+
+#include "exportqueue.h"
+
+
+// The export queue panel: shows the queued jobs and their progress, and starts or stops the queue.
+// It is not modal, so the editing goes on while the queue is running.
+class ExportQueueDialog : public QDialog, public Ui::ExportQueueDialog
+{
+	Q_OBJECT
+
+	public:
+		ExportQueueDialog( ExportQueue * queue, QWidget * parent = 0 );
+
+	protected:
+		void	showEvent( QShowEvent * event );
+
+	private slots:
+		void	refresh();
+		void	jobChanged( int id );
+		void	updateButtons();
+		void	maxJobsChanged( int jobs );
+
+		void	abortJob();
+		void	removeJob();
+
+	private:
+		int		selectedJob() const;
+		void	updateRow( int row, const ExportQueue::Job& job );
+
+	private:
+		ExportQueue	*	m_queue;
+};
+
+#endif // EXPORTQUEUEDIALOG_H
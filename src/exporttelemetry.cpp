@@ -0,0 +1,187 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+#include <QJsonArray>
+#include <QSysInfo>
+#include <QThread>
+
+#include "exporttelemetry.h"
+#include "yuvconverter.h"
+
+
+ExportTelemetry::ExportTelemetry()
+{
+    for ( int s = 0; s < STAGE_COUNT; s++ )
+    {
+        m_count[s].storeRelaxed( 0 );
+        m_totalNs[s].storeRelaxed( 0 );
+        m_maxNs[s].storeRelaxed( 0 );
+        m_liveTotalNs[s] = 0;
+
+        for ( int b = 0; b < BUCKETS; b++ )
+            m_buckets[s][b].storeRelaxed( 0 );
+    }
+
+    m_liveFrames = 0;
+    m_liveTimer.start();
+}
+
+void ExportTelemetry::add( Stage stage, qint64 nsecs )
+{
+    qint64 usecs = nsecs / 1000;
+    int bucket = 0;
+
+    while ( usecs > 0 && bucket < BUCKETS - 1 )
+    {
+        usecs >>= 1;
+        bucket++;
+    }
+
+    m_count[stage].fetchAndAddRelaxed( 1 );
+    m_totalNs[stage].fetchAndAddRelaxed( nsecs );
+    m_buckets[stage][bucket].fetchAndAddRelaxed( 1 );
+
+    qint64 max = m_maxNs[stage].loadRelaxed();
+
+    while ( nsecs > max && !m_maxNs[stage].testAndSetRelaxed( max, nsecs, max ) )
+        ;
+}
+
+QString ExportTelemetry::liveSummary( int frames )
+{
+    qint64 elapsed = m_liveTimer.restart();
+    int busiest = -1;
+    qint64 busiestNs = 0;
+
+    for ( int s = 0; s < STAGE_COUNT; s++ )
+    {
+        qint64 total = m_totalNs[s].loadRelaxed();
+
+        // The background is a part of the render stage
+        if ( s != STAGE_BACKGROUND && total - m_liveTotalNs[s] > busiestNs )
+        {
+            busiest = s;
+            busiestNs = total - m_liveTotalNs[s];
+        }
+
+        m_liveTotalNs[s] = total;
+    }
+
+    double fps = elapsed > 0 ? (frames - m_liveFrames) * 1000.0 / elapsed : 0.0;
+    m_liveFrames = frames;
+
+    if ( busiest < 0 )
+        return QString( "%1 fps" ) .arg( fps, 0, 'f', 1 );
+
+    return QString( "%1 fps, busiest: %2" ) .arg( fps, 0, 'f', 1 ) .arg( stageName( (Stage) busiest ) );
+}
+
+QJsonObject ExportTelemetry::report( const QJsonObject& info ) const
+{
+    QJsonObject stages;
+
+    for ( int s = 0; s < STAGE_COUNT; s++ )
+    {
+        qint64 count = m_count[s].loadRelaxed();
+        qint64 total = m_totalNs[s].loadRelaxed();
+        QJsonObject stage;
+        QJsonArray histogram;
+
+        stage["count"] = count;
+        stage["total_ms"] = total / 1000000.0;
+        stage["mean_us"] = count ? total / 1000.0 / count : 0.0;
+        stage["max_us"] = m_maxNs[s].loadRelaxed() / 1000.0;
+
+        // Percentiles are the upper bounds of the buckets they fall into
+        const double percentiles[] = { 0.5, 0.95, 0.99 };
+        const char * names[] = { "p50_us", "p95_us", "p99_us" };
+        qint64 cumulative = 0;
+        int p = 0;
+
+        for ( int b = 0; b < BUCKETS; b++ )
+        {
+            qint64 value = m_buckets[s][b].loadRelaxed();
+            cumulative += value;
+            histogram.append( value );
+
+            while ( p < 3 && count > 0 && cumulative >= percentiles[p] * count )
+                stage[ names[p++] ] = (qint64) 1 << b;
+        }
+
+        stage["histogram_us_log2"] = histogram;
+        stages[ stageName( (Stage) s ) ] = stage;
+    }
+
+    QJsonObject host;
+    host["name"] = QSysInfo::machineHostName();
+    host["os"] = QSysInfo::prettyProductName();
+    host["cpu"] = QSysInfo::currentCpuArchitecture();
+    host["threads"] = QThread::idealThreadCount();
+    host["converter"] = YuvConverter::name();
+
+    QJsonObject report;
+    report["info"] = info;
+    report["host"] = host;
+    report["stages"] = stages;
+    return report;
+}
+
+QString ExportTelemetry::stageName( Stage stage )
+{
+    switch ( stage )
+    {
+        case STAGE_RENDER:
+            return "render";
+
+        case STAGE_BACKGROUND:
+            return "background";
+
+        case STAGE_CONVERT:
+            return "color conversion";
+
+        case STAGE_VIDEO_ENCODE:
+            return "video encoding";
+
+        case STAGE_AUDIO_ENCODE:
+            return "audio encoding";
+
+        case STAGE_MUX:
+            return "muxing";
+
+        default:
+            break;
+    }
+
+    return QString();
+}
+
+ExportTelemetry::Timer::Timer( ExportTelemetry * telemetry, Stage stage )
+{
+    m_telemetry = telemetry;
+    m_stage = stage;
+
+    if ( m_telemetry )
+        m_timer.start();
+}
+
+ExportTelemetry::Timer::~Timer()
+{
+    if ( m_telemetry )
+        m_telemetry->add( m_stage, m_timer.nsecsElapsed() );
+}
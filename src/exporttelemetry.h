@@ -0,0 +1,88 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+#ifndef EXPORTTELEMETRY_H
+#define EXPORTTELEMETRY_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QString>
+
+//
+// Per-stage timing of the video export. The stages run in different threads, so each stage
+// keeps lock-free counters and a histogram of its durations in power-of-two microsecond buckets.
+//
+class ExportTelemetry
+{
+    public:
+        enum Stage
+        {
+            STAGE_RENDER,           // lyrics renderer update, including the background
+            STAGE_BACKGROUND,       // background drawing
+            STAGE_CONVERT,          // color conversion (or copying the unchanged frame)
+            STAGE_VIDEO_ENCODE,     // video encoder, without writing the packets
+            STAGE_AUDIO_ENCODE,     // audio decoding, resampling and encoding (reading only if copied)
+            STAGE_MUX,              // writing the packets into the output file
+            STAGE_COUNT
+        };
+
+        // Bucket 0 is below 1us, bucket N is from 2^(N-1) to 2^N us; the last one has everything longer
+        static const int BUCKETS = 25;
+
+        ExportTelemetry();
+
+        // Adds one stage run; could be called from any thread
+        void    add( Stage stage, qint64 nsecs );
+
+        // Frame rate and the stage which took the most time since the previous call, human-readable.
+        // Called from one thread only.
+        QString liveSummary( int frames );
+
+        // The whole statistics, with the info object added as is
+        QJsonObject report( const QJsonObject& info ) const;
+
+        static QString stageName( Stage stage );
+
+        // Adds the time between its construction and destruction to the stage; nothing if telemetry is null
+        class Timer
+        {
+            public:
+                Timer( ExportTelemetry * telemetry, Stage stage );
+                ~Timer();
+
+            private:
+                ExportTelemetry *   m_telemetry;
+                Stage               m_stage;
+                QElapsedTimer       m_timer;
+        };
+
+    private:
+        QAtomicInteger<qint64>  m_count[ STAGE_COUNT ];
+        QAtomicInteger<qint64>  m_totalNs[ STAGE_COUNT ];
+        QAtomicInteger<qint64>  m_maxNs[ STAGE_COUNT ];
+        QAtomicInteger<qint64>  m_buckets[ STAGE_COUNT ][ BUCKETS ];
+
+        // The state of the previous liveSummary() call
+        QElapsedTimer           m_liveTimer;
+        qint64                  m_liveTotalNs[ STAGE_COUNT ];
+        int                     m_liveFrames;
+};
+
+#endif // EXPORTTELEMETRY_H
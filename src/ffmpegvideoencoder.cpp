@@ -24,14 +24,58 @@
  **************************************************************************/
 
 #include <QFile>
+#include <QList>
+#include <QSharedPointer>
+#include <QElapsedTimer>
 #include <memory>
+#include <string.h>
 
 #include "ffmpeg_headers.h"
 #include "ffmpegvideoencoder.h"
 #include "videoencodingprofiles.h"
 #include "audioplayer.h"
-#include "audioplayerprivate.h"
+#include "audioexportthread.h"
+#include "exporttelemetry.h"
+#include "yuvconverter.h"
+
+// The image is converted by bands of this many rows, so only the changed bands are converted.
+// Must be even, so the bands start on the whole chroma rows.
+static const int CONVERSION_BAND_ROWS = 16;
+
+// The audio thread and its encoder, shared by the encoders muxing the same audio. Each encoder closes
+// its own reader when its video ends, while the thread still feeds the others; the last one to let it go
+// closes the readers never taken, waits for the thread to stop and frees the encoder.
+class SharedAudio
+{
+	public:
+		SharedAudio();
+		~SharedAudio();
+
+		AudioExportThread	*	thread;
+		AVCodecContext		*	encoder;
+
+		// Reserved for the encoders sharing the audio, until they take them
+		QList< QSharedPointer<AudioExportThread::Reader> > readers;
+};
+
+SharedAudio::SharedAudio()
+{
+	thread = 0;
+	encoder = 0;
+}
+
+SharedAudio::~SharedAudio()
+{
+	// The thread stops once nobody reads the audio
+	for ( int i = 0; i < readers.size(); i++ )
+		readers[i]->close();
 
+	readers.clear();
+
+	// Waits for the thread, which encodes until it stops
+	delete thread;
+	avcodec_free_context( &encoder );
+}
 
 class FFMpegVideoEncoderPriv
 {
@@ -41,8 +85,16 @@ class FFMpegVideoEncoderPriv
 
 		bool	createFile( const QString& filename );
 		bool	close();
-		int		encodeImage( const QImage & img, qint64 time );
+		int		encodeImage( const QImage & img, qint64 time, bool changed );
+		bool	reuseFrame( AVFrame * frame, const AVFrame * converted );
+		int		encodeVideoFrame( AVFrame * frame, bool changed );
+		bool	convertImage_sws( const QImage &img, AVFrame * frame, const AVFrame * previous );
+		bool	convertLayer( const QImage &layer, const QRect& rect, const QColor& background, AVFrame * frame );
+		int		encodeLayer( const QImage &layer, const QRect& rect, const QColor& background, bool changed );
+		AVFrame * allocFrame();
+		AVFrame * writableVideoFrame();
 		void	flush();
+		int		appendSegment( const QString& filename, qint64 startframe );
 
 	public:
 		// Video output parameters
@@ -51,16 +103,45 @@ class FFMpegVideoEncoderPriv
 		unsigned int				 m_videobitrate;
 		unsigned int				 m_audiobitrate;
 
+		// Segment-parallel encoding: m_segmentable makes the video stream compatible with
+		// the segments, and m_segment writes a video-only segment
+		bool						 m_segmentable;
+		bool						 m_segment;
+
+		// Variable frame rate keepalive; 0 - constant frame rate
+		unsigned int				 m_vfrKeepaliveMs;
+
+		// Copy the audio packets from the music file instead of encoding if possible
+		bool						 m_audioCopy;
+
+		// Audio shared between the encoders: reserved for how many others, or taken from which one
+		int							 m_audioReaders;
+		FFMpegVideoEncoderPriv	   * m_audioSource;
+
+		// Write the output sequentially (fragmented MP4) even if it could be seeked
+		bool						 m_streaming;
+
+		// Encoder speed preset and tuning; empty - the profile default
+		QString						 m_speedPreset;
+		QString						 m_tune;
+
+		// Video codec threads; 0 - automatic
+		int							 m_codecThreads;
+
 		// Do we also have an audio source?
-		AudioPlayerPrivate * m_aplayer;
+		QString						 m_audioFile;
+
+		// Stage timings; null if not measured
+		ExportTelemetry			   * m_telemetry;
 
 		// Error message
 		QString		m_errorMsg;
 
 	private:
-        int     encodeMoreAudio();
-        bool    convertImage_sws(const QImage &img);
+        double  audioTime() const;
+        int     encodeAudioUntil( qint64 videoframe );
         bool    encodeFrame(AVFrame *frame, AVCodecContext *output_codec_context, AVStream *stream);
+        bool    writePacket( AVPacket *packet, AVRational timebase, AVStream *stream );
 
 		// FFmpeg stuff
 		AVFormatContext		*	outputFormatCtx;
@@ -72,25 +153,49 @@ class FFMpegVideoEncoderPriv
 		AVCodec				*	videoCodec;
 		AVCodec				*	audioCodec;
 
-		// Video frame data
+		// Video frame data. The encoder may still keep a reference to the frame given to it
+		// (i.e. frame threading), so videoFrame is switched to a pool frame it does not use.
 		AVFrame				*	videoFrame;
-		uint8_t				*	videoImageBuffer;
+		QList<AVFrame*>			videoFramePool;
+
+		// Encoded packet, reused for every frame
+		AVPacket			*	outputPacket;
 
-        // Video conversion context
-		SwsContext			*	videoConvertCtx;
+		// The image converted last, to find the bands which changed
+		QImage					bandsImage;
+		unsigned int			bandsSkipped;
 
-        // Audio resample context
-        SwrContext          *   audioResampleCtx;
+        // Audio packets are produced by the audio thread, in audioPacketTimeBase; the end of the audio
+        // written so far is tracked to interleave it with the video. The thread and the audio encoder
+        // (owned by audioShared) are null if the audio comes from another encoder, then only the reader is used.
+        QSharedPointer<SharedAudio> audioShared;
+        AudioExportThread   *   audioThread;
+        QSharedPointer<AudioExportThread::Reader> audioReader;
+        AVRational              audioPacketTimeBase;
+        int64_t                 audioWrittenUntil;
+        bool                    audioCopied;
 
         // Output file has been opened successfully
 		bool					outputFileOpened;
 
 		// Video frame PTS
 		unsigned int			videoFrameNumber;
-        unsigned int			audioSamplesOut;
+
+		// videoFrame holds the converted previous image
+		bool					videoFrameConverted;
+		unsigned int			conversionsSkipped;
+
+		// Variable frame rate: the last frame given to encode, and the last one actually encoded
+		unsigned int			vfrKeepaliveFrames;
+		unsigned int			lastEncodedFrame;
+		AVFrame				*	lastVideoFrame;
+		unsigned int			framesSkipped;
 
 		// Total output size
         unsigned int			outputTotalSize;
+
+		// Time spent writing the packets, so it is not counted as the encoding time
+		qint64					muxNs;
 };
 
 
@@ -120,12 +225,31 @@ FFMpegVideoEncoderPriv::FFMpegVideoEncoderPriv()
 	audioCodec = 0;
 	videoCodec = 0;
 	videoFrame = 0;
-	audioResampleCtx = 0;
+	outputPacket = 0;
+	audioThread = 0;
+	audioCopied = false;
+	audioPacketTimeBase.num = 1;
+	audioPacketTimeBase.den = 1;
+	audioWrittenUntil = 0;
 
 	audioCodecCtx = 0;
-	videoImageBuffer = 0;
-	videoConvertCtx = 0;
 	outputFileOpened = false;
+
+	m_segmentable = false;
+	m_segment = false;
+	m_vfrKeepaliveMs = 0;
+	m_audioCopy = false;
+	m_audioReaders = 0;
+	m_audioSource = 0;
+	m_streaming = false;
+	m_codecThreads = 0;
+	m_telemetry = 0;
+	muxNs = 0;
+	vfrKeepaliveFrames = 0;
+	lastVideoFrame = 0;
+	conversionsSkipped = 0;
+	bandsSkipped = 0;
+	framesSkipped = 0;
 }
 
 FFMpegVideoEncoderPriv::~FFMpegVideoEncoderPriv()
@@ -145,9 +269,8 @@ bool FFMpegVideoEncoderPriv::close()
 			// Close the file
 			avio_close( outputFormatCtx->pb );
 
-            // close video and audio codecs
+            // close video codec
             avcodec_free_context( &videoCodecCtx );
-            avcodec_free_context( &audioCodecCtx );
 		}
 
 		// free the streams
@@ -161,14 +284,24 @@ bool FFMpegVideoEncoderPriv::close()
         avformat_free_context( outputFormatCtx );
 	}
 
-	delete[] videoImageBuffer;
+	// Only this reader is closed, the thread may still feed the other encoders sharing the audio.
+	// The last of them stops the thread and frees the audio encoder, also when the file was not created.
+	if ( audioReader )
+		audioReader->close();
+
+	audioReader.clear();
+	audioShared.clear();
+	audioThread = 0;
+	audioCodecCtx = 0;
 
-	if ( videoFrame )
-		av_free(videoFrame);
+	bandsImage = QImage();
+
+	foreach ( AVFrame * frame, videoFramePool )
+		av_frame_free( &frame );
+
+	videoFramePool.clear();
+	av_packet_free( &outputPacket );
 
-    //FIXME
-    //if ( audioResampleCtx )
-    //audioResampleCtx = 0;
 
 	outputFormatCtx = 0;
 	outputFormat = 0;
@@ -177,9 +310,8 @@ bool FFMpegVideoEncoderPriv::close()
 	audioStream = 0;
 	videoCodec = 0;
 	videoFrame = 0;
-	videoImageBuffer = 0;
-	videoConvertCtx = 0;
-    audioResampleCtx = 0;
+	audioCopied = false;
+	lastVideoFrame = 0;
 
 	return true;
 }
@@ -200,9 +332,236 @@ bool FFMpegVideoEncoder::close()
     return d->close();
 }
 
-int FFMpegVideoEncoder::encodeImage( const QImage & img, qint64 time )
+int FFMpegVideoEncoder::encodeImage( const QImage & img, qint64 time, bool changed )
+{
+	return d->encodeImage( img, time, changed );
+}
+
+AVFrame * FFMpegVideoEncoder::allocFrame()
+{
+	return d->allocFrame();
+}
+
+void FFMpegVideoEncoder::freeFrame( AVFrame * frame )
+{
+	av_frame_free( &frame );
+}
+
+bool FFMpegVideoEncoder::convertImage( const QImage & img, AVFrame * frame, const AVFrame * previous )
+{
+	return d->convertImage_sws( img, frame, previous );
+}
+
+int FFMpegVideoEncoder::encodeLayer( const QImage & layer, const QRect& rect, const QColor& background, qint64, bool changed )
+{
+	return d->encodeLayer( layer, rect, background, changed );
+}
+
+bool FFMpegVideoEncoder::convertLayer( const QImage & layer, const QRect& rect, const QColor& background, AVFrame * frame )
+{
+	return d->convertLayer( layer, rect, background, frame );
+}
+
+int FFMpegVideoEncoder::encodeFrame( AVFrame * frame, bool changed )
+{
+	return d->encodeVideoFrame( frame, changed );
+}
+
+void FFMpegVideoEncoder::setVariableFrameRate( unsigned int keepalivems )
+{
+	d->m_vfrKeepaliveMs = keepalivems;
+}
+
+bool FFMpegVideoEncoder::supportsVariableFrameRate( const VideoEncodingProfile * profile )
 {
-	return d->encodeImage( img, time );
+	// Containers which store the timestamp of every frame
+	static const char * containers[] = { "mp4", "mov", "matroska", "mkv", "webm", 0 };
+
+	for ( int i = 0; containers[i]; i++ )
+		if ( profile->videoContainer == containers[i] )
+			return true;
+
+	return false;
+}
+
+bool FFMpegVideoEncoder::isVideoCodecAvailable( const VideoEncodingProfile * profile )
+{
+	ffmpeg_init_once();
+	return avcodec_find_encoder_by_name( qPrintable( profile->videoCodec ) ) != 0;
+}
+
+QString FFMpegVideoEncoder::verifyFile( const QString& filename, int frames )
+{
+	AVFormatContext * formatCtx = 0;
+	AVCodecContext * codecCtx = 0;
+	AVPacket * packet = 0;
+	AVFrame * frame = 0;
+	const AVCodec * codec = 0;
+	QString errmsg;
+	int stream, decoded = 0;
+
+	ffmpeg_init_once();
+
+	if ( avformat_open_input( &formatCtx, FFMPEG_FILENAME( filename ), 0, 0 ) != 0 )
+		return "Cannot open the file";
+
+	if ( avformat_find_stream_info( formatCtx, 0 ) < 0 )
+	{
+		errmsg = "Cannot find the stream information";
+		goto cleanup;
+	}
+
+	stream = av_find_best_stream( formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0 );
+
+	if ( stream < 0 || !codec )
+	{
+		errmsg = "No decodable video stream";
+		goto cleanup;
+	}
+
+	codecCtx = avcodec_alloc_context3( codec );
+
+	if ( !codecCtx
+	|| avcodec_parameters_to_context( codecCtx, formatCtx->streams[stream]->codecpar ) < 0
+	|| avcodec_open2( codecCtx, codec, 0 ) < 0 )
+	{
+		errmsg = "Cannot open the video decoder";
+		goto cleanup;
+	}
+
+	packet = av_packet_alloc();
+	frame = av_frame_alloc();
+
+	// Decode all packets, then drain the decoder
+	while ( true )
+	{
+		bool eof = av_read_frame( formatCtx, packet ) < 0;
+
+		if ( !eof && packet->stream_index != stream )
+		{
+			av_packet_unref( packet );
+			continue;
+		}
+
+		if ( avcodec_send_packet( codecCtx, eof ? 0 : packet ) < 0 )
+		{
+			errmsg = QString("Error decoding the frame %1") .arg( decoded );
+			goto cleanup;
+		}
+
+		av_packet_unref( packet );
+
+		while ( avcodec_receive_frame( codecCtx, frame ) >= 0 )
+			decoded++;
+
+		if ( eof )
+			break;
+	}
+
+	if ( decoded != frames )
+		errmsg = QString("Decoded %1 frames instead of %2") .arg( decoded ) .arg( frames );
+
+cleanup:
+	av_frame_free( &frame );
+	av_packet_free( &packet );
+	avcodec_free_context( &codecCtx );
+	avformat_close_input( &formatCtx );
+	return errmsg;
+}
+
+unsigned int FFMpegVideoEncoder::skippedFrames() const
+{
+	return d->framesSkipped;
+}
+
+bool FFMpegVideoEncoder::reuseFrame( AVFrame * frame, const AVFrame * converted )
+{
+	return d->reuseFrame( frame, converted );
+}
+
+unsigned int FFMpegVideoEncoder::skippedConversions() const
+{
+	return d->conversionsSkipped;
+}
+
+unsigned int FFMpegVideoEncoder::skippedBands() const
+{
+	return d->bandsSkipped;
+}
+
+void FFMpegVideoEncoder::setSegmentable( bool segmentable )
+{
+	d->m_segmentable = segmentable;
+}
+
+void FFMpegVideoEncoder::setAudioCopy( bool copy )
+{
+	d->m_audioCopy = copy;
+}
+
+bool FFMpegVideoEncoder::isAudioCopied() const
+{
+	return d->audioCopied;
+}
+
+void FFMpegVideoEncoder::setStreaming( bool streaming )
+{
+	d->m_streaming = streaming;
+}
+
+void FFMpegVideoEncoder::setAudioReaders( int count )
+{
+	d->m_audioReaders = count;
+}
+
+void FFMpegVideoEncoder::setAudioSource( FFMpegVideoEncoder * source )
+{
+	d->m_audioSource = source ? source->d : 0;
+}
+
+void FFMpegVideoEncoder::setSpeedPreset( const QString& preset, const QString& tune )
+{
+	d->m_speedPreset = preset;
+	d->m_tune = tune;
+}
+
+void FFMpegVideoEncoder::setCodecThreads( int threads )
+{
+	d->m_codecThreads = qMax( 0, threads );
+}
+
+void FFMpegVideoEncoder::setTelemetry( ExportTelemetry * telemetry )
+{
+	d->m_telemetry = telemetry;
+}
+
+int FFMpegVideoEncoder::gopSize() const
+{
+	return qMax( 1U, (d->m_videoformat->frame_rate_den / d->m_videoformat->frame_rate_num) / 2 );
+}
+
+QString FFMpegVideoEncoder::createSegmentFile( const QString& filename, const FFMpegVideoEncoder * output )
+{
+	d->m_audioFile.clear();
+	d->m_profile = output->d->m_profile;
+	d->m_videoformat = output->d->m_videoformat;
+	d->m_videobitrate = output->d->m_videobitrate;
+	d->m_audiobitrate = output->d->m_audiobitrate;
+	d->m_vfrKeepaliveMs = output->d->m_vfrKeepaliveMs;
+	d->m_speedPreset = output->d->m_speedPreset;
+	d->m_tune = output->d->m_tune;
+	d->m_telemetry = output->d->m_telemetry;
+	d->m_segment = true;
+
+	if ( d->createFile( filename ) )
+		return QString();
+
+	return d->m_errorMsg;
+}
+
+int FFMpegVideoEncoder::appendSegment( const QString& filename, qint64 startframe )
+{
+	return d->appendSegment( filename, startframe );
 }
 
 
@@ -212,7 +571,16 @@ QString FFMpegVideoEncoder::createFile( const QString &filename,
 										unsigned int quality,
 										AudioPlayer *audio )
 {
-	d->m_aplayer = audio ? audio->impl() : 0;
+	return createFile( filename, profile, videoformat, quality, audio ? audio->fileName() : QString() );
+}
+
+QString FFMpegVideoEncoder::createFile( const QString &filename,
+										const VideoEncodingProfile *profile,
+										const VideoFormat * videoformat,
+										unsigned int quality,
+										const QString& audiofile )
+{
+	d->m_audioFile = audiofile;
 	d->m_profile = profile;
 	d->m_videoformat = videoformat;
 
@@ -227,13 +595,28 @@ QString FFMpegVideoEncoder::createFile( const QString &filename,
 
 void FFMpegVideoEncoderPriv::flush()
 {
-    encodeFrame( nullptr, audioCodecCtx, audioStream );
+    // Variable frame rate: the last frame must be encoded, so the video lasts until its end
+    if ( vfrKeepaliveFrames > 0 && lastVideoFrame && lastEncodedFrame + 1 < videoFrameNumber )
+    {
+        videoFrameNumber--;
+        encodeVideoFrame( lastVideoFrame, true );
+    }
+
+    // Write the audio until the end of the video; the rest is not needed. There is no audio for
+    // segments or if the audio is disabled.
+    if ( audioReader )
+    {
+        encodeAudioUntil( videoFrameNumber );
+        audioReader->close();
+    }
+
     encodeFrame( nullptr, videoCodecCtx, videoStream );
 }
 
 bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
 {
-    int err, size;
+    int err;
+    bool globalHeader;
 
 	// If we had an open video, close it.
 	close();
@@ -249,6 +632,21 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
 		goto cleanup;
 	}
 
+	// Segment codecs are still set up for the final container, so the packets could be copied there
+	globalHeader = (outputFormat->flags & AVFMT_GLOBALHEADER) != 0;
+
+	// Segments are stored in NUT which keeps the packets as they are
+	if ( m_segment )
+	{
+		outputFormat = av_guess_format( "nut", 0, 0 );
+
+		if ( !outputFormat )
+		{
+			m_errorMsg = "Could not find the NUT format for the video segments";
+			goto cleanup;
+		}
+	}
+
 	// Allocate the output context
 	outputFormatCtx = avformat_alloc_context();
 
@@ -301,16 +699,37 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
 	if ( m_videoformat->flags & VIFO_INTERLACED )
         videoCodecCtx->flags |= AV_CODEC_FLAG_INTERLACED_DCT;
 
-	// Enable multithreaded encoding: breaks FLV!
-	//videoCodecCtx->thread_count = 4;
+	// Enable multithreaded encoding as far as both the container and the codec support it.
+	// Segments are already encoded in parallel, so they are not threaded.
+	videoCodecCtx->thread_type = 0;
+
+	if ( !m_segment && (m_profile->threading & VideoEncodingProfile::THREADING_FRAME) && (videoCodec->capabilities & AV_CODEC_CAP_FRAME_THREADS) )
+		videoCodecCtx->thread_type |= FF_THREAD_FRAME;
+
+	if ( !m_segment && (m_profile->threading & VideoEncodingProfile::THREADING_SLICE) && (videoCodec->capabilities & AV_CODEC_CAP_SLICE_THREADS) )
+		videoCodecCtx->thread_type |= FF_THREAD_SLICE;
+
+	// Codecs such as libx264 use their own threads
+	if ( videoCodecCtx->thread_type != 0 || ( !m_segment && m_profile->threading != 0 && (videoCodec->capabilities & AV_CODEC_CAP_OTHER_THREADS) ) )
+		videoCodecCtx->thread_count = m_codecThreads; // 0 - automatic
+	else
+		videoCodecCtx->thread_count = 1;
+
+	// Encoder speed preset and tuning, for the codecs which have them
+	if ( !m_profile->speedPreset.isEmpty() )
+	{
+		QString preset = m_speedPreset.isEmpty() ? m_profile->speedPreset : m_speedPreset;
+		QString tune = m_tune.isEmpty() ? m_profile->tune : m_tune;
+
+		av_opt_set( videoCodecCtx->priv_data, "preset", qPrintable( preset ), 0 );
+
+		if ( !tune.isEmpty() )
+			av_opt_set( videoCodecCtx->priv_data, "tune", qPrintable( tune ), 0 );
+	}
 
 	// Video format-specific hacks
 	switch ( videoCodec->id )
 	{
-		case AV_CODEC_ID_H264:
-			av_opt_set( videoCodecCtx->priv_data, "preset", "slow", 0 );
-			break;
-
 		case AV_CODEC_ID_MPEG2VIDEO:
 			videoCodecCtx->max_b_frames = 2;
 			videoCodecCtx->bit_rate_tolerance = m_videobitrate * av_q2d(videoCodecCtx->time_base) * 2;
@@ -325,8 +744,16 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
 			break;
 	}
 
+	// Segments must be decodable on their own and concatenated as is: every segment starts with a keyframe,
+	// and no frame is referenced across the GOP. No B-frames, so DTS stays monotonic across the segments.
+	if ( m_segmentable || m_segment )
+	{
+		videoCodecCtx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+		videoCodecCtx->max_b_frames = 0;
+	}
+
 	// If we have a global header for the format, no need to duplicate the codec info in each keyframe
-	if ( outputFormatCtx->oformat->flags & AVFMT_GLOBALHEADER )
+	if ( globalHeader )
         videoCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
 	// Open the codec
@@ -356,8 +783,103 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
 	if ( videoStream->time_base.den == 0 )
 		videoStream->time_base = videoCodecCtx->time_base;
 
-	// Do we also have audio stream?
-	if ( m_aplayer )
+	// The audio already read and encoded by another encoder is muxed as is
+	if ( !m_audioFile.isEmpty() && m_audioSource )
+	{
+		if ( !m_audioSource->audioShared || m_audioSource->audioShared->readers.isEmpty() || !m_audioSource->audioStream )
+		{
+			m_errorMsg = "The audio of the other output file is not available";
+			goto cleanup;
+		}
+
+		audioShared = m_audioSource->audioShared;
+		audioReader = audioShared->readers.takeFirst();
+
+		// The stream parameters must mean the same in this container
+		const AVCodecParameters * source = m_audioSource->audioStream->codecpar;
+
+		if ( avformat_query_codec( outputFormat, source->codec_id, FF_COMPLIANCE_NORMAL ) != 1
+		|| ( !m_audioSource->audioCopied && (outputFormat->flags & AVFMT_GLOBALHEADER) != (m_audioSource->outputFormat->flags & AVFMT_GLOBALHEADER) ) )
+		{
+			m_errorMsg = "The audio of the other output file cannot be stored in this container";
+			goto cleanup;
+		}
+
+		audioStream = avformat_new_stream( outputFormatCtx, 0 );
+
+		if ( !audioStream || avcodec_parameters_copy( audioStream->codecpar, source ) < 0 )
+		{
+			m_errorMsg = "Could not allocate audio stream";
+			goto cleanup;
+		}
+
+		audioStream->codecpar->codec_tag = 0;
+		audioStream->time_base = m_audioSource->audioPacketTimeBase;
+		audioPacketTimeBase = m_audioSource->audioPacketTimeBase;
+		audioCopied = m_audioSource->audioCopied;
+	}
+
+	// Do we also have audio stream? It is read by its own demuxer, so the audio player is not used
+	if ( !m_audioFile.isEmpty() && !m_audioSource )
+	{
+		audioShared = QSharedPointer<SharedAudio>( new SharedAudio() );
+		audioThread = new AudioExportThread();
+		audioShared->thread = audioThread;
+		audioThread->setTelemetry( m_telemetry );
+
+		if ( !audioThread->open( m_audioFile ) )
+		{
+			m_errorMsg = audioThread->errorMsg();
+			goto cleanup;
+		}
+
+		// Copy the audio stream as is if the container can store the music file codec
+		AVStream * input = audioThread->inputStream();
+		audioCopied = m_audioCopy && avformat_query_codec( outputFormat, input->codecpar->codec_id, FF_COMPLIANCE_NORMAL ) == 1;
+
+		// The readers for this encoder and for the encoders sharing its audio
+		audioReader = audioThread->addReader();
+
+		for ( int i = 0; i < m_audioReaders && audioReader; i++ )
+		{
+			audioShared->readers.append( audioThread->addReader() );
+
+			if ( !audioShared->readers.last() )
+				audioReader.clear();
+		}
+
+		if ( !audioReader )
+		{
+			m_errorMsg = audioThread->errorMsg();
+			goto cleanup;
+		}
+	}
+
+	if ( audioThread && audioCopied )
+	{
+		AVStream * input = audioThread->inputStream();
+		audioStream = avformat_new_stream( outputFormatCtx, 0 );
+
+		if ( !audioStream )
+		{
+			m_errorMsg = "Could not allocate audio stream";
+			goto cleanup;
+		}
+
+		if ( avcodec_parameters_copy( audioStream->codecpar, input->codecpar ) < 0 )
+		{
+			m_errorMsg = "Failed to copy the music file parameters to output audio stream";
+			goto cleanup;
+		}
+
+		// The codec tag of the music file container may mean something else in the output container
+		audioStream->codecpar->codec_tag = 0;
+		audioStream->time_base = input->time_base;
+		audioPacketTimeBase = input->time_base;
+	}
+
+	// Do we have audio stream to encode?
+	if ( audioThread && !audioCopied )
 	{
         // Find the audio codec
         audioCodec = (AVCodec*) avcodec_find_encoder_by_name( qPrintable( m_profile->audioCodec ) );
@@ -374,6 +896,7 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
 
         // Allocate the audio context
         audioCodecCtx = avcodec_alloc_context3( audioCodec );
+        audioShared->encoder = audioCodecCtx;
 
         if ( !audioCodecCtx )
         {
@@ -384,10 +907,10 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
         audioCodecCtx->codec_id = audioCodec->id;
         audioCodecCtx->codec_type = AVMEDIA_TYPE_AUDIO;
         audioCodecCtx->bit_rate = m_audiobitrate;
-        audioCodecCtx->sample_rate = m_aplayer->aCodecCtx->sample_rate;
+        audioCodecCtx->sample_rate = audioThread->decoder()->sample_rate;
         av_channel_layout_default(&audioCodecCtx->ch_layout, m_profile->channels);
         audioCodecCtx->time_base.num = 1;
-        audioCodecCtx->time_base.den = m_profile->sampleRate;
+        audioCodecCtx->time_base.den = audioCodecCtx->sample_rate;
 
         if ( outputFormatCtx->oformat->flags & AVFMT_GLOBALHEADER )
             audioCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
@@ -435,49 +958,17 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
         }
 
         // Setup the audio resampler
-        audioResampleCtx = swr_alloc();
-
-        if ( !audioResampleCtx )
+        if ( !audioThread->setEncoder( audioCodecCtx ) )
         {
-            m_errorMsg = QObject::tr("Cannot allocate audio resampler");
-            return false;
-        }
-
-        // Some formats (i.e. WAV) do not produce the proper channel layout
-        if ( m_aplayer->aCodecCtx->ch_layout.nb_channels == 0 )
-            av_opt_set_chlayout( audioResampleCtx, "in_ch_layout", &audioCodecCtx->ch_layout, 0 );
-        else
-            av_opt_set_chlayout( audioResampleCtx, "in_ch_layout", &m_aplayer->aCodecCtx->ch_layout, 0 );
-
-        av_opt_set_chlayout( audioResampleCtx, "out_ch_layout", &audioCodecCtx->ch_layout, 0 );
-
-        av_opt_set_int( audioResampleCtx, "in_sample_fmt",     m_aplayer->aCodecCtx->sample_fmt, 0);
-        av_opt_set_int( audioResampleCtx, "out_sample_fmt",     audioCodecCtx->sample_fmt, 0);
-        av_opt_set_int( audioResampleCtx, "in_sample_rate",    m_aplayer->aCodecCtx->sample_rate, 0);
-        av_opt_set_int( audioResampleCtx, "out_sample_rate",    audioCodecCtx->sample_rate, 0);
-
-        if ( swr_init( audioResampleCtx ) < 0 )
-        {
-            m_errorMsg = QObject::tr("Cannot initialize audio resampler");
-            return false;
+            m_errorMsg = audioThread->errorMsg();
+            goto cleanup;
         }
 
-		// Rewind the audio player
-		m_aplayer->reset();
-	}
-
-	// Allocate the buffer for the picture
-    size = av_image_get_buffer_size( videoCodecCtx->pix_fmt, videoCodecCtx->width, videoCodecCtx->height, 1 );
-	videoImageBuffer = new uint8_t[size];
-
-	if ( !videoImageBuffer )
-	{
-		m_errorMsg = "Could not open allocate picture buffer";
-		goto cleanup;
+        audioPacketTimeBase = audioCodecCtx->time_base;
 	}
 
 	// Allocate the YUV frame
-    videoFrame = av_frame_alloc();
+    videoFrame = allocFrame();
 
 	if ( !videoFrame )
 	{
@@ -487,27 +978,50 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
 
 	// Reset the PTS
 	videoFrame->pts = 0;
-    videoFrame->width = videoCodecCtx->width;
-    videoFrame->height = videoCodecCtx->height;
-    videoFrame->format = videoCodecCtx->pix_fmt;
+	videoFramePool.push_back( videoFrame );
 
-    // Setup the planes
-    av_image_fill_arrays( videoFrame->data, videoFrame->linesize, videoImageBuffer,videoCodecCtx->pix_fmt, videoCodecCtx->width, videoCodecCtx->height, 1 );
+	// Allocate the packet to receive the encoded frames
+	outputPacket = av_packet_alloc();
 
-	// Create the file and write the header
-    outputFormatCtx->url = av_strdup( FFMPEG_FILENAME( fileName ) );
-
-	if ( avio_open( &outputFormatCtx->pb, FFMPEG_FILENAME( fileName ), AVIO_FLAG_WRITE) < 0 )
+	if ( !outputPacket )
 	{
-		m_errorMsg = "Could not create the video file";
+		m_errorMsg = "Could not allocate the packet";
 		goto cleanup;
 	}
 
-    if ( avformat_write_header( outputFormatCtx, 0 ) < 0 )
-    {
-        m_errorMsg = "Could not write the video file";
-        goto cleanup;
-    }
+	// Create the file and write the header; "-" is the standard output
+	{
+		QString url = fileName == "-" ? "pipe:1" : fileName;
+		AVDictionary * options = 0;
+
+		outputFormatCtx->url = av_strdup( FFMPEG_FILENAME( url ) );
+
+		if ( avio_open( &outputFormatCtx->pb, FFMPEG_FILENAME( url ), AVIO_FLAG_WRITE) < 0 )
+		{
+			m_errorMsg = "Could not create the video file";
+			goto cleanup;
+		}
+
+		// Pipes could not be seeked back to finish the file, so it is only written forward. MP4/MOV
+		// then have no index at the end, but a fragment per keyframe; the fragments are passed on as
+		// soon as written, so the reader gets the video while it is being encoded.
+		if ( !m_segment && (m_streaming || !(outputFormatCtx->pb->seekable & AVIO_SEEKABLE_NORMAL)) )
+		{
+			if ( m_profile->videoContainer == "mp4" || m_profile->videoContainer == "mov" )
+				av_dict_set( &options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0 );
+
+			outputFormatCtx->flush_packets = 1;
+		}
+
+		err = avformat_write_header( outputFormatCtx, &options );
+		av_dict_free( &options );
+
+		if ( err < 0 )
+		{
+			m_errorMsg = "Could not write the video file";
+			goto cleanup;
+		}
+	}
 
 /*
 	// Dump output streams
@@ -527,10 +1041,31 @@ bool FFMpegVideoEncoderPriv::createFile( const QString& fileName )
 	}
 */
 	videoFrameNumber = 0;
-    audioSamplesOut = 0;
+	videoFrameConverted = false;
+	conversionsSkipped = 0;
+	bandsSkipped = 0;
+
+	lastEncodedFrame = 0;
+	lastVideoFrame = 0;
+	framesSkipped = 0;
+	vfrKeepaliveFrames = 0;
+
+	// Variable frame rate needs the container to store the timestamp of every frame
+	if ( m_vfrKeepaliveMs > 0 )
+	{
+		if ( FFMpegVideoEncoder::supportsVariableFrameRate( m_profile ) )
+			vfrKeepaliveFrames = qMax( 1U, (m_vfrKeepaliveMs * m_videoformat->frame_rate_den) / (1000 * m_videoformat->frame_rate_num) );
+		else
+			qWarning( "Container %s does not support variable frame rate, using constant", qPrintable( m_profile->videoContainer ) );
+	}
+	audioWrittenUntil = 0;
 	outputTotalSize = 0;
 	outputFileOpened = true;
 
+	// The audio is prepared ahead while the video is being encoded
+	if ( audioThread )
+		audioThread->start();
+
 	return true;
 
 cleanup:
@@ -553,12 +1088,8 @@ bool FFMpegVideoEncoderPriv::encodeFrame( AVFrame *frame, AVCodecContext *output
 {
     int error = 0;
 
-    // Mark frame writable so it is not refcounted (and thus encoder would make a copy if it needs)
-    if ( frame )
-        av_frame_make_writable( frame );
-
-    // Send the audio frame stored in the temporary packet to the encoder.
-    // The output audio stream encoder is used to do this.
+    // Send the video frame to the encoder, or null to flush it. The frame is only read by the
+    // encoder; whoever writes into it makes it writable first, so a frame sent again unchanged is not copied.
     error = avcodec_send_frame( output_codec_context, frame );
 
     // The encoder signals that it has nothing more to encode.
@@ -576,16 +1107,13 @@ bool FFMpegVideoEncoderPriv::encodeFrame( AVFrame *frame, AVCodecContext *output
     // We repeat this process until we get EOF
     while ( true )
     {
-        // Packet used for temporary storage.
-        AVPacket* output_packet = av_packet_alloc();
-
-        // Receive one encoded frame from the encoder.
-        error = avcodec_receive_packet(output_codec_context, output_packet );
+        // Receive one encoded frame from the encoder into the reused packet.
+        error = avcodec_receive_packet(output_codec_context, outputPacket );
 
         // If the encoder asks for more data to be able to provide an encoded frame, return indicating that no data is present.
         if ( error == AVERROR(EAGAIN) )
         {
-            av_packet_unref( output_packet );
+            av_packet_unref( outputPacket );
             error = 0;
             break;
         }
@@ -593,189 +1121,325 @@ bool FFMpegVideoEncoderPriv::encodeFrame( AVFrame *frame, AVCodecContext *output
         // If the last frame has been encoded, stop encoding.
         if (error == AVERROR_EOF)
         {
-            av_packet_unref( output_packet );
+            av_packet_unref( outputPacket );
             error = 0;
             break;
         }
 
         if ( error < 0 )
         {
-            av_packet_unref( output_packet );
+            av_packet_unref( outputPacket );
             qWarning( "Could not encode frame (error '%d')", error );
             break;
         }
 
-        // Set up the packet index
-        output_packet->stream_index = stream->index;
-
-        // Convert the PTS from the packet base to stream base
-        if ( output_packet->pts != AV_NOPTS_VALUE )
-            output_packet->pts = av_rescale_q( output_packet->pts, output_codec_context->time_base, stream->time_base );
-
-        // Convert the DTS from the packet base to stream base
-        if ( output_packet->dts != AV_NOPTS_VALUE )
-            output_packet->dts = av_rescale_q( output_packet->dts, output_codec_context->time_base, stream->time_base );
-
-        if ( output_packet->duration > 0 )
-            output_packet->duration = av_rescale_q( output_packet->duration, output_codec_context->time_base, stream->time_base );
-
-        outputTotalSize += output_packet->size;
-
-        // Write one audio frame from the temporary packet to the output file.
-        // av_write_frame takes over the packet and unrefs it itself
-        if ( (error = av_write_frame( outputFormatCtx, output_packet)) < 0)
+        if ( !writePacket( outputPacket, output_codec_context->time_base, stream ) )
         {
-            av_packet_unref( output_packet );
-            qWarning( "Could not write frame (error '%d)", error );
+            av_packet_unref( outputPacket );
+            error = -1;
             goto cleanup;
         }
 
-        av_packet_unref( output_packet );
+        av_packet_unref( outputPacket );
     }
 
 cleanup:
     return error == 0;
 }
 
-
-int FFMpegVideoEncoderPriv::encodeMoreAudio()
+/**
+ * Write one encoded packet, with timestamps in the specified time base, into the output file.
+ * @return false in case of error
+ */
+bool FFMpegVideoEncoderPriv::writePacket( AVPacket *packet, AVRational timebase, AVStream * stream )
 {
-    AVPacket * inpkt = nullptr;
-    AVFrame * decodedAudioFrame = 0;
-    int ret = -1;
+    int error;
 
-    // Read until we've read the audio frame
-    while ( true )
-    {
-        // Read an audio frame
-        inpkt = av_packet_alloc();
+    // Set up the packet index
+    packet->stream_index = stream->index;
 
-        if ( av_read_frame( m_aplayer->pFormatCtx, inpkt ) < 0 )
-        {
-            av_packet_unref( inpkt );
-            return 0;  // Frame read failed (e.g. end of stream)
-        }
+    // Convert the PTS from the packet base to stream base
+    if ( packet->pts != AV_NOPTS_VALUE )
+        packet->pts = av_rescale_q( packet->pts, timebase, stream->time_base );
 
-        // Skip non-audio frames
-        if ( inpkt->stream_index == m_aplayer->audioStream )
-            break;
+    // Convert the DTS from the packet base to stream base
+    if ( packet->dts != AV_NOPTS_VALUE )
+        packet->dts = av_rescale_q( packet->dts, timebase, stream->time_base );
+
+    if ( packet->duration > 0 )
+        packet->duration = av_rescale_q( packet->duration, timebase, stream->time_base );
+
+    outputTotalSize += packet->size;
+
+    QElapsedTimer writeTiming;
+
+    if ( m_telemetry )
+        writeTiming.start();
+
+    // Write one frame from the packet to the output file
+    error = av_write_frame( outputFormatCtx, packet);
+
+    if ( m_telemetry )
+    {
+        qint64 nsecs = writeTiming.nsecsElapsed();
+        muxNs += nsecs;
+        m_telemetry->add( ExportTelemetry::STAGE_MUX, nsecs );
     }
 
-    // Send the packet with the compressed data to the decoder
-    if ( avcodec_send_packet( m_aplayer->aCodecCtx, inpkt ) < 0)
+    if ( error < 0 )
     {
-        qWarning( "Error while submitting audio packet to decoder" );
-        goto cleanup;
+        qWarning( "Could not write frame (error '%d)", error );
+        return false;
     }
 
-    // No longer needed
-    av_packet_unref( inpkt );
+    return true;
+}
 
-    // Read all the output frames (in general there may be any number of them)
-    decodedAudioFrame = av_frame_alloc();
 
-    while ( avcodec_receive_frame( m_aplayer->aCodecCtx, decodedAudioFrame ) >= 0 )
-    {
-        // Output audio frame
-        AVFrame * resampledAudioframe = av_frame_alloc();
+double FFMpegVideoEncoderPriv::audioTime() const
+{
+    return ((double) audioWrittenUntil * audioPacketTimeBase.num) / audioPacketTimeBase.den;
+}
 
-        av_frame_copy_props( resampledAudioframe, decodedAudioFrame );
-        av_channel_layout_copy(&resampledAudioframe->ch_layout, &audioCodecCtx->ch_layout);
-        resampledAudioframe->sample_rate = audioCodecCtx->sample_rate;
-        resampledAudioframe->format = audioCodecCtx->sample_fmt;
+AVFrame * FFMpegVideoEncoderPriv::allocFrame()
+{
+    AVFrame * frame = av_frame_alloc();
 
-        // Run the audio resampling
-        if ( swr_convert_frame( audioResampleCtx, resampledAudioframe, decodedAudioFrame ) < 0 )
-        {
-            qWarning( "Error while converting the audio frame" );
-            goto cleanup;
-        }
+    if ( !frame )
+        return 0;
 
-        // Assign the PTS to the audio frame
-      /*  AVRational rate;
-        rate.num = 1;
-        rate.den = audioCodecCtx->sample_rate;
+    frame->width = videoCodecCtx->width;
+    frame->height = videoCodecCtx->height;
+    frame->format = videoCodecCtx->pix_fmt;
 
-        output_frame->pts = av_rescale_q( audioSamplesOut, rate, audioCodecCtx->time_base);*/
-        resampledAudioframe->pts = audioSamplesOut;
-        audioSamplesOut += resampledAudioframe->nb_samples;
+    if ( av_frame_get_buffer( frame, 0 ) < 0 )
+    {
+        av_frame_free( &frame );
+        return 0;
+    }
 
-        bool ret = encodeFrame( resampledAudioframe, audioCodecCtx, audioStream );
-        av_frame_unref( resampledAudioframe );
+    return frame;
+}
 
-        if ( !ret )
-            goto cleanup;
+AVFrame * FFMpegVideoEncoderPriv::writableVideoFrame()
+{
+    if ( av_frame_is_writable( videoFrame ) )
+        return videoFrame;
+
+    // The encoder still uses it; take a frame it does not use anymore, or add one to the pool
+    // (the pool only grows until the encoder delay is covered)
+    foreach ( AVFrame * frame, videoFramePool )
+    {
+        if ( av_frame_is_writable( frame ) )
+            return frame;
     }
 
-    // We sent out the whole packet; return success
-    ret = 1;
+    AVFrame * frame = allocFrame();
 
-cleanup:
-    if ( decodedAudioFrame )
-        av_frame_unref( decodedAudioFrame );
+    if ( frame )
+        videoFramePool.push_back( frame );
 
-    return ret;
+    return frame;
 }
 
+int FFMpegVideoEncoderPriv::encodeImage( const QImage &img, qint64, bool changed )
+{
+    // Convert Qt image into FFMpeg frame (videoFrame), unless it still holds the same image
+    if ( changed || !videoFrameConverted )
+    {
+        AVFrame * frame = writableVideoFrame();
+
+        if ( !frame )
+            return -1;
 
-int FFMpegVideoEncoderPriv::encodeImage( const QImage &img, qint64 )
+        // Only the changed bands are converted, the rest is taken from the previous frame
+        convertImage_sws( img, frame, videoFrameConverted ? videoFrame : 0 );
+        videoFrame = frame;
+        videoFrameConverted = true;
+    }
+    else
+        conversionsSkipped++;
+
+    return encodeVideoFrame( videoFrame, changed );
+}
+
+int FFMpegVideoEncoderPriv::encodeLayer( const QImage &layer, const QRect& rect, const QColor& background, bool changed )
 {
-    int err;
+    if ( changed || !videoFrameConverted )
+    {
+        AVFrame * frame = writableVideoFrame();
+
+        if ( !frame )
+            return -1;
+
+        convertLayer( layer, rect, background, frame );
+        videoFrame = frame;
+        videoFrameConverted = true;
+    }
+    else
+        conversionsSkipped++;
 
+    return encodeVideoFrame( videoFrame, changed );
+}
+
+bool FFMpegVideoEncoderPriv::reuseFrame( AVFrame * frame, const AVFrame * converted )
+{
+    ExportTelemetry::Timer timer( m_telemetry, ExportTelemetry::STAGE_CONVERT );
+
+    // The encoder may still hold a reference to the frame buffer from the previous use;
+    // if so the data is copied into the new buffer, so nothing else to do for the same frame
+    if ( av_frame_make_writable( frame ) < 0 )
+        return false;
+
+    if ( frame != converted && av_frame_copy( frame, converted ) < 0 )
+        return false;
+
+    conversionsSkipped++;
+    return true;
+}
+
+int FFMpegVideoEncoderPriv::encodeAudioUntil( qint64 videoframe )
+{
     // Do we need to output audio?
-    if ( m_aplayer )
+    if ( !audioReader )
+        return 1;
+
+    double video_time = ((double) videoframe * videoCodecCtx->time_base.num) / videoCodecCtx->time_base.den;
+
+    while ( audioTime() <= video_time )
     {
-        double video_time = ((double) videoFrameNumber * videoCodecCtx->time_base.num) / videoCodecCtx->time_base.den;
-        double audio_time = ((double) audioSamplesOut * audioCodecCtx->time_base.num) / audioCodecCtx->time_base.den;
+        // Output more audio if we're behind video; usually the audio thread has it ready
+        AVPacket * packet = audioReader->takePacket();
 
-        while ( audio_time <= video_time )
-        {
-            //qDebug("Progress: A %g, V %g", audio_time, video_time );
+        if ( !packet )
+            return audioReader->failed() ? -1 : 1; // audio stream ended, or error
 
-            // Output more audio if we're behind video
-            err = encodeMoreAudio();
+        if ( packet->pts != AV_NOPTS_VALUE )
+            audioWrittenUntil = qMax( audioWrittenUntil, packet->pts + packet->duration );
+        else
+            audioWrittenUntil += packet->duration;
 
-            if ( err == 0 )
-                break; // audio stream ended
-            else if ( err < 0 )
-                return -1; // error
+        bool ret = writePacket( packet, audioPacketTimeBase, audioStream );
+        audioReader->releasePacket( packet );
 
-            // Recalculate
-            audio_time = ((double) audioSamplesOut * audioCodecCtx->time_base.num) / audioCodecCtx->time_base.den;
-            //qDebug("After encode: A %g, V %g", audio_time, video_time );
-        }
+        if ( !ret )
+            return -1;
+    }
+
+    return 1;
+}
+
+int FFMpegVideoEncoderPriv::encodeVideoFrame( AVFrame * frame, bool changed )
+{
+    // Variable frame rate: an unchanged frame is not encoded, the previous one just lasts longer
+    // (its duration comes from the next frame PTS). Still encoded every vfrKeepaliveFrames.
+    if ( vfrKeepaliveFrames > 0 && !changed && lastVideoFrame && videoFrameNumber - lastEncodedFrame < vfrKeepaliveFrames )
+    {
+        lastVideoFrame = frame;
+        videoFrameNumber++;
+        framesSkipped++;
+        return outputTotalSize;
     }
 
-    // Convert Qt image into FFMpeg frame (videoFrame)
-    convertImage_sws( img );
+    lastVideoFrame = frame;
+    lastEncodedFrame = videoFrameNumber;
+
+    if ( encodeAudioUntil( videoFrameNumber ) < 0 )
+        return -1;
 
     // Setup frame data
-    videoFrame->interlaced_frame = (m_videoformat->flags & VIFO_INTERLACED) ? 1 : 0;
-    videoFrame->pts = videoFrameNumber++;
+    frame->interlaced_frame = (m_videoformat->flags & VIFO_INTERLACED) ? 1 : 0;
+    frame->pts = videoFrameNumber++;
 
     //qDebug("Video time: %g", ((double) videoFrameNumber * videoCodecCtx->time_base.num) / videoCodecCtx->time_base.den );
 
-    if ( !encodeFrame( videoFrame, videoCodecCtx, videoStream ) )
+    QElapsedTimer encodeTiming;
+    qint64 muxedBefore = muxNs;
+
+    if ( m_telemetry )
+        encodeTiming.start();
+
+    bool encoded = encodeFrame( frame, videoCodecCtx, videoStream );
+
+    // The packets written meanwhile are counted as muxing
+    if ( m_telemetry )
+        m_telemetry->add( ExportTelemetry::STAGE_VIDEO_ENCODE, encodeTiming.nsecsElapsed() - (muxNs - muxedBefore) );
+
+    if ( !encoded )
         return -1;
 
     return outputTotalSize;
 }
 
+int FFMpegVideoEncoderPriv::appendSegment( const QString& fileName, qint64 startframe )
+{
+    AVFormatContext * segmentCtx = 0;
+    AVPacket * packet = 0;
+    AVRational segmentTimeBase;
+    int ret = -1;
+
+    if ( avformat_open_input( &segmentCtx, FFMPEG_FILENAME( fileName ), 0, 0 ) != 0 )
+    {
+        qWarning( "Could not open the video segment %s", qPrintable( fileName ) );
+        return -1;
+    }
+
+    if ( avformat_find_stream_info( segmentCtx, 0 ) < 0 || segmentCtx->nb_streams != 1 )
+    {
+        qWarning( "Invalid video segment %s", qPrintable( fileName ) );
+        goto cleanup;
+    }
+
+    segmentTimeBase = segmentCtx->streams[0]->time_base;
+    packet = av_packet_alloc();
+
+    while ( av_read_frame( segmentCtx, packet ) >= 0 )
+    {
+        // Segment timestamps start from zero; move them to the segment position in the codec time base (one tick per frame)
+        if ( packet->pts != AV_NOPTS_VALUE )
+            packet->pts = av_rescale_q( packet->pts, segmentTimeBase, videoCodecCtx->time_base ) + startframe;
+
+        if ( packet->dts != AV_NOPTS_VALUE )
+            packet->dts = av_rescale_q( packet->dts, segmentTimeBase, videoCodecCtx->time_base ) + startframe;
+
+        if ( packet->duration > 0 )
+            packet->duration = av_rescale_q( packet->duration, segmentTimeBase, videoCodecCtx->time_base );
+
+        // There are no B-frames, so the packets come in presentation order
+        videoFrameNumber = packet->pts + 1;
+
+        if ( encodeAudioUntil( packet->pts ) < 0 || !writePacket( packet, videoCodecCtx->time_base, videoStream ) )
+        {
+            av_packet_unref( packet );
+            goto cleanup;
+        }
+
+        av_packet_unref( packet );
+    }
+
+    ret = outputTotalSize;
+
+cleanup:
+    av_packet_free( &packet );
+    avformat_close_input( &segmentCtx );
+    return ret;
+}
+
 
 
 /**
   \brief Convert the QImage to the internal YUV format
 
-  SWS conversion
-
-   Caution: the QImage is allocated by QT without guarantee about the alignment and bytes per lines.
-   It *should* be okay as we make sure the image is a multiple of many bytes (8 or 16)...
-   ... however it is not guaranteed that sws_scale won't at some point require more bytes per line.
-   We keep the custom conversion for that case.
+  Converted by YuvConverter, by bands of CONVERSION_BAND_ROWS rows. If the previous converted frame
+  is given, only the bands which differ from the previously converted image are converted, and the
+  rest is copied from the previous frame (nothing to copy if it is the same frame). The chroma is
+  averaged within each 2x2 block, so a band converts the same as within the whole frame.
 
 **/
-bool FFMpegVideoEncoderPriv::convertImage_sws(const QImage &img)
+bool FFMpegVideoEncoderPriv::convertImage_sws(const QImage &img, AVFrame * frame, const AVFrame * previous)
 {
+	ExportTelemetry::Timer timer( m_telemetry, ExportTelemetry::STAGE_CONVERT );
+
 	// Check if the image matches the size
 	if ( img.width() != (int) m_videoformat->width || img.height() != (int) m_videoformat->height )
 	{
@@ -789,33 +1453,151 @@ bool FFMpegVideoEncoderPriv::convertImage_sws(const QImage &img)
 		return false;
 	}
 
-	videoConvertCtx = sws_getCachedContext( videoConvertCtx,
-										   m_videoformat->width,
-										   m_videoformat->height,
-                                           AV_PIX_FMT_BGRA,
-										   m_videoformat->width,
-										   m_videoformat->height,
-                                           AV_PIX_FMT_YUV420P,
-										   SWS_BICUBIC,
-										   NULL,
-										   NULL,
-										   NULL );
-	if ( videoConvertCtx == NULL )
-	{
-		printf("Cannot initialize the conversion context\n");
+	int width = m_videoformat->width;
+	int height = m_videoformat->height;
+
+	// The encoder may still hold a reference to the frame buffer from the previous use
+	if ( av_frame_make_writable( frame ) < 0 )
+		return false;
+
+	// Without the previous frame everything is converted
+	if ( !previous || bandsImage.size() != img.size() )
+	{
+		previous = 0;
+		bandsImage = QImage( img.size(), QImage::Format_ARGB32 );
+	}
+
+	for ( int top = 0; top < height; top += CONVERSION_BAND_ROWS )
+	{
+		int rows = qMin( CONVERSION_BAND_ROWS, height - top );
+		bool changed = !previous;
+
+		for ( int y = top; y < top + rows && !changed; y++ )
+			changed = memcmp( img.constScanLine( y ), bandsImage.constScanLine( y ), width * 4 ) != 0;
+
+		if ( !changed )
+		{
+			if ( frame != previous )
+			{
+				for ( int plane = 0; plane < 3; plane++ )
+				{
+					// Chroma planes are subsampled; the bands are even, so they start on the whole chroma row
+					int shift = plane == 0 ? 0 : 1;
+					int planerows = (top + rows + shift) >> shift;
+
+					for ( int y = top >> shift; y < planerows; y++ )
+						memcpy( frame->data[plane] + y * frame->linesize[plane],
+								previous->data[plane] + y * previous->linesize[plane],
+								(width + shift) >> shift );
+				}
+			}
+
+			bandsSkipped++;
+			continue;
+		}
+
+		for ( int y = top; y < top + rows; y++ )
+			memcpy( bandsImage.scanLine( y ), img.constScanLine( y ), width * 4 );
+
+		uint8_t * dstplanes[3] = { frame->data[0] + top * frame->linesize[0],
+								   frame->data[1] + (top / 2) * frame->linesize[1],
+								   frame->data[2] + (top / 2) * frame->linesize[2] };
+
+		YuvConverter::convert( img.constScanLine( top ), (int) img.bytesPerLine(), width, rows, dstplanes, frame->linesize );
+	}
+
+	return true;
+}
+
+
+// BT.601 limited range, the same as swscale uses by default for RGB to YUV, in 8.8 fixed point
+static inline int rgbToY( int r, int g, int b )	{ return ( 66 * r + 129 * g +  25 * b + 128 ) >> 8; }	// without the +16 offset
+static inline int rgbToU( int r, int g, int b )	{ return ( -38 * r -  74 * g + 112 * b + 128 ) >> 8; }	// without the +128 offset
+static inline int rgbToV( int r, int g, int b )	{ return ( 112 * r -  94 * g -  18 * b + 128 ) >> 8; }	// without the +128 offset
+
+/**
+  \brief Compose the lyrics layer over the solid background directly into the YUV frame
+
+   The background planes are just filled, and only the rect where the lyrics were drawn is
+   blended. Blending in YUV gives the same result as in RGB since the conversion is linear:
+   out = 16 + Y(premultiplied pixel) + (1 - alpha) * (background - 16), and the same for the
+   chroma averaged over each 2x2 block.
+**/
+bool FFMpegVideoEncoderPriv::convertLayer( const QImage &layer, const QRect& rect, const QColor& background, AVFrame * frame )
+{
+	ExportTelemetry::Timer timer( m_telemetry, ExportTelemetry::STAGE_CONVERT );
+
+	int width = m_videoformat->width;
+	int height = m_videoformat->height;
+
+	// Check if the image matches the size
+	if ( layer.width() != width || layer.height() != height || layer.format() != QImage::Format_ARGB32 )
+	{
+		printf("Wrong layer image!\n");
+		return false;
+	}
+
+	// The encoder may still hold a reference to the frame buffer from the previous use
+	if ( av_frame_make_writable( frame ) < 0 )
 		return false;
+
+	int bgY = 16 + rgbToY( background.red(), background.green(), background.blue() );
+	int bgU = 128 + rgbToU( background.red(), background.green(), background.blue() );
+	int bgV = 128 + rgbToV( background.red(), background.green(), background.blue() );
+
+	for ( int y = 0; y < height; y++ )
+		memset( frame->data[0] + y * frame->linesize[0], bgY, width );
+
+	for ( int y = 0; y < (height + 1) / 2; y++ )
+	{
+		memset( frame->data[1] + y * frame->linesize[1], bgU, (width + 1) / 2 );
+		memset( frame->data[2] + y * frame->linesize[2], bgV, (width + 1) / 2 );
 	}
 
-	uint8_t *srcplanes[3];
-	srcplanes[0]=(uint8_t*)img.bits();
-	srcplanes[1]=0;
-	srcplanes[2]=0;
+	// Align the blended area to the chroma blocks
+	QRect area = rect & layer.rect();
+
+	if ( area.isEmpty() )
+		return true;
+
+	int left = area.left() & ~1;
+	int top = area.top() & ~1;
+	int right = qMin( (area.right() + 2) & ~1, width );
+	int bottom = qMin( (area.bottom() + 2) & ~1, height );
+
+	for ( int y = top; y < bottom; y += 2 )
+	{
+		const QRgb * lines[2] = { (const QRgb*) layer.constScanLine( y ), (const QRgb*) layer.constScanLine( qMin( y + 1, height - 1 ) ) };
+		uint8_t * yplanes[2] = { frame->data[0] + y * frame->linesize[0], frame->data[0] + qMin( y + 1, height - 1 ) * frame->linesize[0] };
+		uint8_t * uplane = frame->data[1] + (y / 2) * frame->linesize[1];
+		uint8_t * vplane = frame->data[2] + (y / 2) * frame->linesize[2];
+
+		for ( int x = left; x < right; x += 2 )
+		{
+			int sumU = 0, sumV = 0;
 
-	int srcstride[3];
-	srcstride[0]=img.bytesPerLine();
-	srcstride[1]=0;
-	srcstride[2]=0;
+			for ( int i = 0; i < 4; i++ )
+			{
+				int px = qMin( x + (i & 1), width - 1 );
+				QRgb pixel = lines[ i >> 1 ][ px ];
+				int alpha = qAlpha( pixel );
+
+				// Premultiply the layer pixel
+				int r = qRed( pixel ) * alpha / 255;
+				int g = qGreen( pixel ) * alpha / 255;
+				int b = qBlue( pixel ) * alpha / 255;
+
+				if ( alpha != 0 )
+					yplanes[ i >> 1 ][ px ] = 16 + rgbToY( r, g, b ) + ( (255 - alpha) * (bgY - 16) ) / 255;
+
+				sumU += rgbToU( r, g, b ) + ( (255 - alpha) * (bgU - 128) ) / 255;
+				sumV += rgbToV( r, g, b ) + ( (255 - alpha) * (bgV - 128) ) / 255;
+			}
+
+			uplane[ x / 2 ] = qBound( 0, 128 + sumU / 4, 255 );
+			vplane[ x / 2 ] = qBound( 0, 128 + sumV / 4, 255 );
+		}
+	}
 
-	sws_scale( videoConvertCtx, srcplanes, srcstride,0, m_videoformat->height, videoFrame->data, videoFrame->linesize);
 	return true;
 }
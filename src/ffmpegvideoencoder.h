@@ -32,7 +32,9 @@
 #include "videoencodingprofiles.h"
 
 class AudioPlayer;
+class ExportTelemetry;
 class FFMpegVideoEncoderPriv;
+struct AVFrame;
 
 class FFMpegVideoEncoder
 {
@@ -47,8 +49,103 @@ class FFMpegVideoEncoder
 							unsigned int quality,
 							AudioPlayer * audio );
 
+		// Same, reading the audio from the music file directly (empty - no audio), so the file
+		// does not need to be opened by the audio player
+		QString createFile( const QString& filename,
+							const VideoEncodingProfile * profile,
+							const VideoFormat * videoformat,
+							unsigned int quality,
+							const QString& audiofile );
+
 		bool close();
-		int encodeImage( const QImage & img, qint64 time );
+		// changed is false if the image is the same as the previous one, so the previous
+		// color conversion is reused
+		int encodeImage( const QImage & img, qint64 time, bool changed = true );
+
+		// Same as encodeImage() for the lyrics drawn on a transparent image (only in rect) over
+		// a solid background; composed directly in YUV without converting the whole image
+		int encodeLayer( const QImage & layer, const QRect& rect, const QColor& background, qint64 time, bool changed = true );
+
+		// Pipelined encoding: the image conversion and the encoding of the converted frame
+		// could be run in different threads. Frames must be allocated by allocFrame(), and
+		// encodeFrame() returns the same as encodeImage(). If the previous converted frame is given
+		// to convertImage(), only the rows which changed since the previous image are converted.
+		AVFrame * allocFrame();
+		void	freeFrame( AVFrame * frame );
+		bool	convertImage( const QImage & img, AVFrame * frame, const AVFrame * previous = 0 );
+		bool	convertLayer( const QImage & layer, const QRect& rect, const QColor& background, AVFrame * frame );
+		int		encodeFrame( AVFrame * frame, bool changed = true );
+
+		// Variable frame rate: frames which did not change are not encoded, the previous frame just
+		// lasts longer, but a frame is still encoded at least every keepalivems. Must be called before
+		// createFile(); 0 (default) is the constant frame rate. Ignored if the container does not
+		// support it (see supportsVariableFrameRate()).
+		void	setVariableFrameRate( unsigned int keepalivems );
+		static bool supportsVariableFrameRate( const VideoEncodingProfile * profile );
+
+		// Copies the audio from the music file as is instead of encoding it according to the profile,
+		// if the output container supports the music file codec (otherwise it is still encoded).
+		// Must be called before createFile(); isAudioCopied() tells whether it is copied.
+		void	setAudioCopy( bool copy );
+		bool	isAudioCopied() const;
+
+		// Several files exported at once: the encoder created first reads the music file, and reserves
+		// the audio for the given number of other encoders, which then take it by setAudioSource()
+		// instead of decoding and encoding the same audio again. The other encoders must use the same
+		// audio codec parameters. Each of them could be closed first: the audio is still read for the
+		// others, and stops with the last one closed. Both must be called before createFile().
+		void	setAudioReaders( int count );
+		void	setAudioSource( FFMpegVideoEncoder * source );
+
+		// Writes the output file sequentially, so it could be read while being written: MP4/MOV are
+		// fragmented, other containers are written as is. Always so for pipes, and for "-", which is
+		// the standard output. Must be called before createFile().
+		void	setStreaming( bool streaming );
+
+		// Overrides the profile encoder speed preset and tuning (see VideoEncodingProfile::speedPresets()
+		// and tunes()); empty keeps the profile default. Must be called before createFile().
+		void	setSpeedPreset( const QString& preset, const QString& tune );
+
+		// Limits the threads used by the video codec, if the profile enables threading; 0 (default)
+		// lets the codec use all cores. Must be called before createFile().
+		void	setCodecThreads( int threads );
+
+		// Reports the conversion, encoding and muxing times there (also from the audio thread and
+		// the segment encoders). Must be called before createFile().
+		void	setTelemetry( ExportTelemetry * telemetry );
+
+		// Checks whether the video codec of the profile is available in this FFmpeg build
+		static bool isVideoCodecAvailable( const VideoEncodingProfile * profile );
+
+		// Decodes the whole video stream of the file; returns non-empty error message if it could not be
+		// decoded, or contains other than the expected number of frames
+		static QString verifyFile( const QString& filename, int frames );
+
+		// How many frames were not encoded because of the variable frame rate
+		unsigned int skippedFrames() const;
+
+		// Copies the already converted frame instead of converting the same image again
+		bool	reuseFrame( AVFrame * frame, const AVFrame * converted );
+
+		// How many color conversions were avoided by reusing the converted frames
+		unsigned int skippedConversions() const;
+
+		// How many bands of rows were not converted because they did not change
+		unsigned int skippedBands() const;
+
+		// Segment-parallel encoding: the video is cut into segments of whole GOPs, each encoded
+		// by its own encoder into a video-only segment file, and the segment packets are then
+		// appended in order into this file without re-encoding, adding the audio.
+		// setSegmentable() must be called before createFile(), as it restricts the codec
+		// settings (closed GOP, no B-frames) for this file and all its segments.
+		void	setSegmentable( bool segmentable );
+		int		gopSize() const;
+
+		// Creates a segment file with the same parameters as the output file
+		QString createSegmentFile( const QString& filename, const FFMpegVideoEncoder * output );
+
+		// Appends the segment which starts at the specific frame; returns the same as encodeImage()
+		int		appendSegment( const QString& filename, qint64 startframe );
 
 	private:
 		FFMpegVideoEncoderPriv * d;
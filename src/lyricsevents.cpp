@@ -21,6 +21,7 @@
 #include <QColor>
 #include <QPainter>
 #include <QRegularExpression>
+#include <QDataStream>
 
 #include "lyricsevents.h"
 #include "background.h"
@@ -72,6 +73,18 @@ bool LyricsEvents::isEmpty() const
 	return m_events.isEmpty();
 }
 
+QByteArray LyricsEvents::fingerprint() const
+{
+	QByteArray data;
+	QDataStream stream( &data, QIODevice::WriteOnly );
+
+	for ( QMap< qint64, Event >::const_iterator it = m_events.begin(); it != m_events.end(); ++it )
+		stream << it.key() << it.value().type << it.value().data;
+
+	stream << m_preparedEvents.keys() << m_colors;
+	return data;
+}
+
 QString LyricsEvents::validateEvent( const QString& text )
 {
 	QString errmsg;
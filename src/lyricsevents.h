@@ -49,6 +49,10 @@ class LyricsEvents
 
 		static QString validateEvent( const QString& text );
 
+		// Everything the drawn backgrounds depend on, including the adjusted timings; the same
+		// if and only if the backgrounds are drawn the same
+		QByteArray fingerprint() const;
+
 	private:
 		class Event
 		{
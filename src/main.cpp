@@ -18,18 +18,33 @@
  **************************************************************************/
 
 #include "mainwindow.h"
+#include "videoexportcli.h"
 #include <QApplication>
+#include <QGuiApplication>
 
 int main(int argc, char *argv[])
 {
 	Q_INIT_RESOURCE(resources);
-	
-	QApplication app(argc, argv);
 
 	QCoreApplication::setOrganizationName("karlyriceditor.com");
 	QCoreApplication::setOrganizationDomain("karlyriceditor.com");
 	QCoreApplication::setApplicationName("karlyriceditor");
 
+	// Headless video export: no widgets, and no display needed (unless the platform is specified explicitly)
+	if ( VideoExportCli::isRequested( argc, argv ) )
+	{
+		if ( qEnvironmentVariableIsEmpty( "QT_QPA_PLATFORM" ) )
+			qputenv( "QT_QPA_PLATFORM", "offscreen" );
+
+		// Fonts and painting on QImage need a GUI application, but not QApplication
+		QGuiApplication app(argc, argv);
+
+		VideoExportCli exporter;
+		return exporter.exec( app.arguments() );
+	}
+
+	QApplication app(argc, argv);
+
 	MainWindow wnd;
 	wnd.show();
 
@@ -27,6 +27,7 @@
 #include <QColorDialog>
 #include <QDesktopServices>
 #include <QUrl>
+#include <QFileInfo>
 
 #include "audioplayer.h"
 #include "wizard_newproject.h"
@@ -43,6 +44,9 @@
 #include "lyricswidget.h"
 #include "ui_dialog_about.h"
 #include "videogenerator.h"
+#include "dialog_export_params.h"
+#include "exportqueue.h"
+#include "exportqueuedialog.h"
 #include "cdggenerator.h"
 #include "videoencodingprofiles.h"
 #include "licensing.h"
@@ -70,6 +74,8 @@ MainWindow::MainWindow()
 	// Initialize stuff
 	m_project = 0;
 	m_testWindow = 0;
+	m_exportQueue = new ExportQueue( this );
+	m_exportQueueDialog = 0;
 
 	// Licensing
 	pLicensing = new Licensing();
@@ -154,6 +160,18 @@ void MainWindow::closeEvent(QCloseEvent *event)
 		return;
 	}
 
+	if ( m_exportQueue->isRunning()
+	&& QMessageBox::question( 0,
+							  tr("Video export is running"),
+							  tr("The queued videos are being exported. Do you want to stop the export? "
+								 "The interrupted exports will start again when the export queue is started next time."),
+							  QMessageBox::Yes,
+							  QMessageBox::No ) != QMessageBox::Yes )
+	{
+		event->ignore();
+		return;
+	}
+
 	// Save current directory
 	QSettings().setValue( "general/currentdirectory", QDir::currentPath() );
 
@@ -182,6 +200,8 @@ void MainWindow::connectActions()
 	connect( actionExport_lyric_file, SIGNAL( triggered()), this, SLOT(act_projectExportLyricFile()) );
 	connect( actionExport_video_file, SIGNAL( triggered()), this, SLOT(act_projectExportVideoFile()) );
 	connect( actionExport_CD_G_file, SIGNAL( triggered()), this, SLOT(act_projectExportCDGFile()) );
+	connect( actionQueue_video_file, SIGNAL( triggered()), this, SLOT(act_projectQueueVideoFile()) );
+	connect( actionExport_queue, SIGNAL( triggered()), this, SLOT(act_projectExportQueue()) );
 	connect( actionEdit_header_data, SIGNAL( triggered()), this, SLOT( act_projectEditHeader()) );
 	connect( actionValidate_lyrics, SIGNAL( triggered()), this, SLOT( act_projectValidateLyrics()) );
 	connect( actionView_lyric_file, SIGNAL( triggered()), this, SLOT( act_projectViewLyricFile()) );
@@ -855,6 +875,64 @@ void MainWindow::act_projectExportVideoFile()
 	videogen.generate( lyrics, m_player->totalTime() );
 }
 
+void MainWindow::act_projectQueueVideoFile()
+{
+	if ( !editor->validate() )
+		return;
+
+	Lyrics lyrics;
+
+	if ( !editor->exportLyrics( &lyrics ) )
+		return;
+
+	// The queued job exports the project file, so it must be saved
+	if ( (m_projectFile.isEmpty() || m_project->isModified()) && !act_fileSaveProject() )
+		return;
+
+	DialogExportOptions dlg( m_project, lyrics, true );
+
+	if ( dlg.exec() != QDialog::Accepted )
+		return;
+
+	const VideoEncodingProfile * profile;
+	const VideoFormat * format;
+	unsigned int		audioEncodingType;
+	unsigned int		quality;
+
+	if ( !dlg.videoParams( &profile, &format, &audioEncodingType, &quality ) )
+		return;
+
+	// The rendering options chosen in the dialog are kept in the project
+	if ( m_project->isModified() && !saveProject( m_projectFile ) )
+		return;
+
+	ExportQueue::Job job;
+	job.projectFile = QFileInfo( m_projectFile ).absoluteFilePath();
+	job.outputFile = dlg.m_outputVideo;
+	job.profile = profile->name;
+	job.format = format->name;
+	job.quality = quality;
+	job.audioMode = audioEncodingType;
+	job.speedPreset = dlg.m_speedPreset;
+	job.tune = dlg.m_tune;
+	job.artist = dlg.m_artist;
+	job.title = dlg.m_title;
+	job.createdBy = dlg.m_createdBy;
+
+	m_exportQueue->addJob( job );
+	act_projectExportQueue();
+}
+
+void MainWindow::act_projectExportQueue()
+{
+	if ( !m_exportQueueDialog )
+		m_exportQueueDialog = new ExportQueueDialog( m_exportQueue, this );
+
+	m_exportQueueDialog->show();
+	m_exportQueueDialog->raise();
+	m_exportQueueDialog->activateWindow();
+}
+
 void MainWindow::act_projectExportCDGFile()
 {
 	if ( !editor->validate() )
@@ -30,6 +30,8 @@ class ViewWidget;
 class PlayerWidget;
 class TestWindow;
 class RecentFiles;
+class ExportQueue;
+class ExportQueueDialog;
 
 
 class MainWindow : public QMainWindow, public Ui::MainWindow
@@ -74,6 +76,8 @@ class MainWindow : public QMainWindow, public Ui::MainWindow
 		void	act_projectExportLyricFile();
 		void	act_projectExportVideoFile();
 		void	act_projectExportCDGFile();
+		void	act_projectQueueVideoFile();
+		void	act_projectExportQueue();
 		void	act_projectSettings();
 
 		void	act_settingsGeneral();
@@ -116,6 +120,10 @@ class MainWindow : public QMainWindow, public Ui::MainWindow
 		RecentFiles			*	m_recentFiles;
 		QString					m_projectFile;
 
+		// Queued video exports, and their panel (created when first shown)
+		ExportQueue			*	m_exportQueue;
+		ExportQueueDialog	*	m_exportQueueDialog;
+
 		// Validator icons
 		QIcon					m_validatorIconRegular;
 		QIcon					m_validatorIconAccepted;
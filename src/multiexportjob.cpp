@@ -0,0 +1,210 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+#include <QVector>
+
+#include "multiexportjob.h"
+#include "videogeneratorthread.h"
+#include "ffmpegvideoencoder.h"
+#include "cdggenerator.h"
+
+
+MultiExportJob::MultiExportJob()
+    : QObject()
+{
+    mSharedAudio = 0;
+    mCDGGenerator = 0;
+    mCDGThread = 0;
+    mRunning = 0;
+}
+
+MultiExportJob::~MultiExportJob()
+{
+    // The audio shared by the videos stops with the last of them, whichever it is
+    for ( int i = 0; i < mVideos.size(); i++ )
+    {
+        mVideos[i].thread->wait();
+
+        // Also deletes the encoder and the renderer
+        delete mVideos[i].thread;
+    }
+
+    if ( mCDGThread )
+    {
+        mCDGThread->wait();
+        delete mCDGThread;
+    }
+
+    delete mCDGGenerator;
+}
+
+VideoGeneratorThread * MultiExportJob::addVideo( FFMpegVideoEncoder * encoder, TextRenderer * renderer, qint64 total_length,
+                                                 const QString& filename, const VideoEncodingProfile * profile,
+                                                 const VideoFormat * format, unsigned int quality, bool audioCopy )
+{
+    // The thread measures the encoder stages, so it is created before the file
+    qint64 time_step = (1000 * format->frame_rate_num) / format->frame_rate_den;
+
+    VideoTarget target;
+    target.thread = new VideoGeneratorThread( encoder, renderer, total_length, time_step );
+    target.encoder = encoder;
+    target.filename = filename;
+    target.profile = profile;
+    target.format = format;
+    target.quality = quality;
+    target.audioCopy = audioCopy;
+
+    mVideos.append( target );
+    return target.thread;
+}
+
+void MultiExportJob::addCDG( CDGGenerator * generator, const Lyrics& lyrics, qint64 total_length, const QString& filename,
+                             const QString& artist, const QString& title, const QString& createdBy, int fontWeight, bool antialias )
+{
+    mCDGGenerator = generator;
+    mCDGFile = filename;
+
+    // The CD+G stream is small and quick to render, so it just runs along with the videos
+    mCDGThread = QThread::create( [this, lyrics, total_length, filename, artist, title, createdBy, fontWeight, antialias]()
+    {
+        mCDGError = mCDGGenerator->generate( lyrics, total_length, filename, artist, title, createdBy, fontWeight, antialias );
+    } );
+}
+
+QString MultiExportJob::createFiles( AudioPlayer * audio )
+{
+    // Which video each one takes the audio from (-1 if it reads the music file itself), and how many
+    // take it from each one. The same audio could be muxed as is if it is encoded the same way into
+    // the same container.
+    QVector<int> sources( mVideos.size(), -1 );
+    QVector<int> readers( mVideos.size(), 0 );
+
+    for ( int i = 0; audio && i < mVideos.size(); i++ )
+    {
+        const VideoTarget& target = mVideos[i];
+
+        for ( int j = 0; j < i; j++ )
+        {
+            const VideoTarget& source = mVideos[j];
+
+            if ( sources[j] == -1
+            && source.profile->videoContainer == target.profile->videoContainer
+            && source.profile->audioCodec == target.profile->audioCodec
+            && source.profile->channels == target.profile->channels
+            && source.profile->bitratesAudio[ source.quality ] == target.profile->bitratesAudio[ target.quality ]
+            && source.audioCopy == target.audioCopy )
+            {
+                sources[i] = j;
+                readers[j]++;
+                break;
+            }
+        }
+    }
+
+    mSharedAudio = 0;
+
+    for ( int i = 0; i < mVideos.size(); i++ )
+    {
+        if ( sources[i] != -1 )
+        {
+            mVideos[i].encoder->setAudioSource( mVideos[ sources[i] ].encoder );
+            mSharedAudio++;
+        }
+        else
+            mVideos[i].encoder->setAudioReaders( readers[i] );
+    }
+
+    // In order, so the audio is read before it is shared
+    for ( int i = 0; i < mVideos.size(); i++ )
+    {
+        const VideoTarget& target = mVideos[i];
+        QString errmsg = target.encoder->createFile( target.filename, target.profile, target.format, target.quality, audio );
+
+        if ( !errmsg.isEmpty() )
+            return QString("%1: %2") .arg( target.filename ) .arg( errmsg );
+    }
+
+    return QString();
+}
+
+int MultiExportJob::sharedAudioCount() const
+{
+    return mSharedAudio;
+}
+
+void MultiExportJob::start()
+{
+    mRunning = mVideos.size() + (mCDGThread ? 1 : 0);
+
+    for ( int i = 0; i < mVideos.size(); i++ )
+    {
+        connect( mVideos[i].thread, SIGNAL( finished(QString)), this, SLOT(videoFinished(QString)), Qt::QueuedConnection );
+        connect( mVideos[i].thread, SIGNAL( progress(int, QString, QString, QString, QString)), this, SLOT(videoProgress(int, QString, QString, QString, QString)), Qt::QueuedConnection );
+        mVideos[i].thread->start();
+    }
+
+    if ( mCDGThread )
+    {
+        connect( mCDGThread, SIGNAL( finished()), this, SLOT(cdgFinished()), Qt::QueuedConnection );
+        mCDGThread->start();
+    }
+}
+
+void MultiExportJob::abort()
+{
+    // The CD+G rendering is not aborted, it finishes soon anyway
+    for ( int i = 0; i < mVideos.size(); i++ )
+        mVideos[i].thread->abort();
+}
+
+void MultiExportJob::videoProgress( int progress, QString frames, QString size, QString timing, QString speed )
+{
+    for ( int i = 0; i < mVideos.size(); i++ )
+    {
+        if ( mVideos[i].thread == sender() )
+            emit this->progress( mVideos[i].filename, progress, frames, size, timing, speed );
+    }
+}
+
+void MultiExportJob::videoFinished( QString errortext )
+{
+    for ( int i = 0; i < mVideos.size(); i++ )
+    {
+        if ( mVideos[i].thread == sender() )
+            targetFinished( mVideos[i].filename, errortext );
+    }
+}
+
+void MultiExportJob::cdgFinished()
+{
+    targetFinished( mCDGFile, mCDGError );
+}
+
+void MultiExportJob::targetFinished( const QString& filename, const QString& errortext )
+{
+    // The first error stops everything else
+    if ( !errortext.isEmpty() && mError.isEmpty() )
+    {
+        mError = QString("%1: %2") .arg( filename ) .arg( errortext );
+        abort();
+    }
+
+    if ( --mRunning == 0 )
+        emit finished( mError );
+}
@@ -0,0 +1,113 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+
+#ifndef MULTIEXPORTJOB_H
+#define MULTIEXPORTJOB_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QThread>
+
+#include "lyrics.h"
+#include "videoencodingprofiles.h"
+
+class AudioPlayer;
+class CDGGenerator;
+class FFMpegVideoEncoder;
+class TextRenderer;
+class VideoGeneratorThread;
+
+//
+// Exports the same lyrics into several files in one pass over the song: videos in different formats
+// and profiles, and the CD+G file. All of them are encoded at once, each by its own generator thread.
+// The audio is read and encoded once for all the videos with the same audio parameters; the videos
+// are kept in step by taking the same audio packets, so the slowest one sets the pace.
+//
+class MultiExportJob : public QObject
+{
+    Q_OBJECT
+
+    public:
+        MultiExportJob();
+        ~MultiExportJob();
+
+        // Adds the video, taking ownership of the encoder and the renderer; returns the generator thread
+        // to set it up. The encoder must be set up except for the audio sharing, and its file is created
+        // by createFiles().
+        VideoGeneratorThread * addVideo( FFMpegVideoEncoder * encoder, TextRenderer * renderer, qint64 total_length,
+                                         const QString& filename, const VideoEncodingProfile * profile,
+                                         const VideoFormat * format, unsigned int quality, bool audioCopy );
+
+        // Adds the CD+G file, taking ownership of the generator
+        void    addCDG( CDGGenerator * generator, const Lyrics& lyrics, qint64 total_length, const QString& filename,
+                        const QString& artist, const QString& title, const QString& createdBy, int fontWeight, bool antialias );
+
+        // Creates the video files in order, sharing the audio between them; returns the error message if failed
+        QString createFiles( AudioPlayer * audio );
+
+        // Starts all the exports; finished() is emitted once they are all done
+        void    start();
+
+        // How many videos share the audio read by another one
+        int     sharedAudioCount() const;
+
+    signals:
+        void    progress( QString filename, int progress, QString frames, QString size, QString timing, QString speed );
+        void    finished( QString errortext );
+
+    public slots:
+        void    abort();
+
+    private slots:
+        void    videoProgress( int progress, QString frames, QString size, QString timing, QString speed );
+        void    videoFinished( QString errortext );
+        void    cdgFinished();
+
+    private:
+        void    targetFinished( const QString& filename, const QString& errortext );
+
+    private:
+        typedef struct
+        {
+            VideoGeneratorThread *  thread;
+            FFMpegVideoEncoder   *  encoder;
+            QString                 filename;
+            const VideoEncodingProfile * profile;
+            const VideoFormat    *  format;
+            unsigned int            quality;
+            bool                    audioCopy;
+        } VideoTarget;
+
+        QList< VideoTarget >    mVideos;
+        int                     mSharedAudio;
+
+        // CD+G rendering thread and its result
+        CDGGenerator        *   mCDGGenerator;
+        QThread             *   mCDGThread;
+        QString                 mCDGFile;
+        QString                 mCDGError;
+
+        // Targets still running, and the first error
+        int                     mRunning;
+        QString                 mError;
+};
+
+#endif // MULTIEXPORTJOB_H
@@ -23,6 +23,7 @@
 #include <QRegularExpression>
 
 #include "mainwindow.h"
+#include "editor.h"
 #include "project.h"
 #include "settings.h"
 #include "version.h"
@@ -112,7 +113,10 @@ void Project::splitTimeMark( qint64 mark, int * min, int * sec, int * msec )
 Project::Project( Editor* editor )
 {
 	m_editor = editor;
-	m_editor->setProject( this );
+
+	// Editor could be null when the project is used without GUI (command-line export)
+	if ( m_editor )
+		m_editor->setProject( this );
 
 	m_modified = false;
 	clear();
@@ -165,9 +169,8 @@ bool Project::load( const QString& filename )
 
 	if ( !file.open( QIODevice::ReadOnly ) )
 	{
-		QMessageBox::critical( 0,
-			QObject::tr("Cannot open file"),
-			QObject::tr("Cannot open file %1") .arg( filename ) );
+		showError( QObject::tr("Cannot open file"),
+				   QObject::tr("Cannot open file %1") .arg( filename ) );
 
 		return false;
 	}
@@ -178,17 +181,19 @@ bool Project::load( const QString& filename )
 
 	if ( m_projectData[ PD_SIGNATURE ] != "BONIFACI" )
 	{
-		QMessageBox::critical( 0,
-			QObject::tr("Invalid project file"),
-			QObject::tr("The project file %1 is not a valid Lyric Editor project file") .arg( filename ) );
+		showError( QObject::tr("Invalid project file"),
+				   QObject::tr("The project file %1 is not a valid Lyric Editor project file") .arg( filename ) );
 
 		return false;
 	}
 
-	if ( !m_projectData[ PD_LYRICS_NEW ].isEmpty() )
-		m_editor->importFromString( m_projectData[ PD_LYRICS_NEW ] );
-	else
-		m_editor->importFromOldString( m_projectData[ PD_LYRICS_OLD ] );
+	if ( m_editor )
+	{
+		if ( !m_projectData[ PD_LYRICS_NEW ].isEmpty() )
+			m_editor->importFromString( m_projectData[ PD_LYRICS_NEW ] );
+		else
+			m_editor->importFromOldString( m_projectData[ PD_LYRICS_OLD ] );
+	}
 
 	// Check the lyrics type, and reset it to LRC2 if not specified
 	switch ( type() )
@@ -221,7 +226,7 @@ bool Project::save( const QString& filename )
 		return false;
 	}
 
-	m_projectData[ PD_LYRICS_NEW ] = m_editor->exportToString();
+	m_projectData[ PD_LYRICS_NEW ] = lyricsText();
 
 	QDataStream stream( &file );
 	stream.setVersion( QDataStream::Qt_4_5 );
@@ -231,6 +236,27 @@ bool Project::save( const QString& filename )
 	return true;
 }
 
+QString Project::lyricsText() const
+{
+	// With the editor present its content is more recent than the stored one
+	if ( m_editor )
+		return m_editor->exportToString();
+
+	if ( !m_projectData[ PD_LYRICS_NEW ].isEmpty() )
+		return m_projectData[ PD_LYRICS_NEW ];
+
+	return Editor::convertFromOldString( m_projectData[ PD_LYRICS_OLD ] );
+}
+
+void Project::showError( const QString& title, const QString& message ) const
+{
+	// No GUI in headless mode, so no message boxes either
+	if ( m_editor )
+		QMessageBox::critical( 0, title, message );
+	else
+		qWarning( "%s: %s", qPrintable( title ), qPrintable( message ) );
+}
+
 int	Project::tagToId( Tag tag  ) const
 {
 	int tagid = -1;
@@ -416,7 +442,10 @@ void Project::update( int id, const QString& value )
 void Project::setModified()
 {
 	m_modified = true;
-	pMainWindow->updateState();
+
+	// No main window in headless mode
+	if ( pMainWindow )
+		pMainWindow->updateState();
 }
 
 void Project::appendIfPresent( int id, const QString& prefix, QString& src, LyricType type )
@@ -78,12 +78,17 @@ class Project
             Tag_Video_TextAlignVertical,
 		};
 
+		// Editor may be null if the project is used without GUI (i.e. command-line export).
+		// In this case the lyrics are only kept in the project data, see lyricsText()
 		Project( Editor * editor );
 
 		// load/save project from/to file
 		bool	save( const QString& filename );
 		bool	load( const QString& filename );
 
+		// Lyrics in the editor format
+		QString	lyricsText() const;
+
 		// lyric type
 		void	setType( LyricType type );
 		LyricType	type() const;
@@ -135,6 +140,8 @@ class Project
 		QString	generateUStarheader();
 		void	update( int id, const QString& value );
 
+		void	showError( const QString& title, const QString& message ) const;
+
 		int		tagToId( Tag tagid ) const;
 		bool	m_modified;
 		Editor* m_editor;
@@ -20,6 +20,7 @@
 #include <QSettings>
 #include <QDateTime>
 #include <QDialog>
+#include <QThread>
 #include "ui_dialog_settings.h"
 
 #include "settings.h"
@@ -34,6 +35,15 @@ Settings::Settings()
 
 	m_phononSoundDelay = settings.value( "advanced/phononsounddelay", 250 ).toInt();
 	m_checkForUpdates = settings.value( "advanced/checkforupdates", true ).toBool();
+	m_videoExportPipelineDepth = settings.value( "advanced/videoexportpipelinedepth", 4 ).toInt();
+	m_videoExportRenderThreads = settings.value( "advanced/videoexportrenderthreads", qMax( 1, QThread::idealThreadCount() - 2 ) ).toInt();
+	m_videoExportSegmentThreads = settings.value( "advanced/videoexportsegmentthreads", 0 ).toInt();
+	m_videoExportVfrKeepalive = settings.value( "advanced/videoexportvfrkeepalive", 0 ).toInt();
+	m_videoExportReport = settings.value( "advanced/videoexportreport", false ).toBool();
+	m_videoExportResumable = settings.value( "advanced/videoexportresumable", false ).toBool();
+	m_videoExportIncremental = settings.value( "advanced/videoexportincremental", false ).toBool();
+	m_videoExportSmoothWipe = settings.value( "advanced/videoexportsmoothwipe", false ).toBool();
+	m_videoExportQueueJobs = settings.value( "advanced/videoexportqueuejobs", qBound( 1, QThread::idealThreadCount() / 4, 4 ) ).toInt();
 
 	m_editorStopAtLineEnd = settings.value( "editor/stopatlineend", true ).toBool();
 	m_editorStopNextWord = settings.value( "editor/stopatnextword", false ).toBool();
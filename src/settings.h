@@ -43,6 +43,40 @@ class Settings
 		// Check for updates
 		bool		m_checkForUpdates;
 
+		// How many frames could be queued between video export stages (render, color
+		// conversion, encoding) running in parallel. Zero disables the pipelining.
+		int			m_videoExportPipelineDepth;
+
+		// How many threads render the lyrics for the pipelined video export. By default
+		// all cores except those used by the conversion and encoding stages.
+		int			m_videoExportRenderThreads;
+
+		// How many threads encode the video segments in parallel; 0 or 1 disables the segmented
+		// export. Segments need closed GOPs without B-frames, costing some quality per bitrate.
+		int			m_videoExportSegmentThreads;
+
+		// Variable frame rate video export (MP4/MOV/WebM only): unchanged frames are not encoded,
+		// but a frame is still encoded at least every keepalive ms. Zero keeps the constant rate.
+		int			m_videoExportVfrKeepalive;
+
+		// Write the per-stage timing of the video export into <output file>.export.json
+		bool		m_videoExportReport;
+
+		// Keep the encoded video segments in <output file>.checkpoint until the export succeeds,
+		// so an interrupted export is resumed. Uses the segmented export even with one thread.
+		bool		m_videoExportResumable;
+
+		// Keep the checkpoint even after the export succeeds, so the next export of the same video
+		// only encodes the segments where the lyrics changed
+		bool		m_videoExportIncremental;
+
+		// Wipe the sung color through each character during its time in the exported videos,
+		// instead of coloring the character at once
+		bool		m_videoExportSmoothWipe;
+
+		// How many exports of the export queue run at once; the cores are shared between them
+		int			m_videoExportQueueJobs;
+
 		// When moving the cursor after inserting the tag,
 		// also stop at the line ends.
 		bool		m_editorStopAtLineEnd;
@@ -56,7 +56,15 @@ HEADERS += mainwindow.h \
     util.h \
     videoencodingprofiles.h \
     videogeneratorthread.h \
-    dialog_export_params.h
+    dialog_export_params.h \
+    videoexportcli.h \
+    boundedqueue.h \
+    audioexportthread.h \
+    exporttelemetry.h \
+    yuvconverter.h \
+    multiexportjob.h \
+    exportqueue.h \
+    exportqueuedialog.h
 SOURCES += mainwindow.cpp \
     ffmpegvideodecoder.cpp \
     ffmpegvideoencoder.cpp \
@@ -95,7 +103,14 @@ SOURCES += mainwindow.cpp \
     util.cpp \
     videoencodingprofiles.cpp \
     videogeneratorthread.cpp \
-    dialog_export_params.cpp
+    dialog_export_params.cpp \
+    videoexportcli.cpp \
+    audioexportthread.cpp \
+    exporttelemetry.cpp \
+    yuvconverter.cpp \
+    multiexportjob.cpp \
+    exportqueue.cpp \
+    exportqueuedialog.cpp
 RESOURCES += resources.qrc
 FORMS += mainwindow.ui \
     wiznewproject_lyrictype.ui \
@@ -114,6 +129,7 @@ FORMS += mainwindow.ui \
     dialog_testwindow.ui \
     dialog_registration.ui \
     dialog_timeadjustment.ui \
-    video_profile_dialog.ui
+    video_profile_dialog.ui \
+    exportqueuedialog.ui
 
 QT += widgets multimedia
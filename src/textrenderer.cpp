@@ -20,6 +20,11 @@
 #include <QVector>
 #include <QPainter>
 #include <QMessageBox>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QMutex>
+#include <string.h>
+#include <algorithm>
 
 #include "textrenderer.h"
 #include "settings.h"
@@ -35,16 +40,64 @@ static const int PREAMBLE_MIN_PAUSE = 5000; // 5000ms minimum pause between vers
 // Font size difference
 static const int SMALL_FONT_DIFF = 4; // 4px less
 
+// Font size autodetection bounds; the guess is measured at the reference size
+static const int AUTODETECT_REFERENCE_SIZE = 100;
+static const int AUTODETECT_MAX_SIZE = 1024;
+
+// Text measured by boundingRect(), per QFont::key(). Every font size check creates a new renderer,
+// and they run in the export threads too, so this is shared between them.
+typedef struct
+{
+	int					height;
+	QHash< QString, int >	widths;		// of the text runs
+} FontMeasures;
+
+static const int MEASURES_MAX_FONTS = 64;
+static QMutex measuresMutex;
+static QHash< QString, FontMeasures > measuresCache;
+
+// The caller holds measuresMutex
+static FontMeasures * fontMeasures( const QFont& font )
+{
+	QString key = font.key();
+	QHash< QString, FontMeasures >::iterator it = measuresCache.find( key );
+
+	if ( it == measuresCache.end() )
+	{
+		FontMeasures measures;
+		measures.height = QFontMetrics( font ).height();
+		it = measuresCache.insert( key, measures );
+	}
+
+	return &it.value();
+}
+
 
 TextRenderer::TextRenderer( int width, int height )
 	: LyricsRenderer()
 {
 	m_currentAlignment = VerticalBottom;
 	m_cdgMode = false;
+	m_smoothWipe = false;
+	m_transparentBackground = false;
+	m_telemetry = 0;
 	m_image = QImage( width, height, QImage::Format_ARGB32 );
 	init();
 }
 
+TextRenderer * TextRenderer::clone() const
+{
+	TextRenderer * renderer = new TextRenderer( *this );
+
+	// LyricsEvents copy does not share the prepared backgrounds, so the copy needs its own
+	renderer->prepareEvents();
+	renderer->m_lastBlockPlayed = -2;
+	renderer->m_lastPosition = -2;
+	renderer->m_forceRedraw = true;
+
+	return renderer;
+}
+
 void TextRenderer::setLyrics( const Lyrics& lyrics )
 {
 	init();
@@ -146,6 +199,8 @@ void TextRenderer::setLyrics( const Lyrics& lyrics )
 		}
 	}
 */
+	buildTimeline();
+
 	m_lyricEvents = lyrics.events();
 	prepareEvents();
 }
@@ -247,6 +302,7 @@ void TextRenderer::compileLine( const QString& line, qint64 starttime, qint64 en
 void TextRenderer::setRenderFont( const QFont& font )
 {
 	m_renderFont = font;
+	m_blockLayouts.clear();
 	m_forceRedraw = true;
 }
 
@@ -279,6 +335,7 @@ void TextRenderer::setColorAlpha( int alpha )
 	m_colorTitle.setAlpha( alpha );
 	m_colorToSing.setAlpha( alpha );
     m_colorSang.setAlpha( alpha );
+	m_forceRedraw = true;
 }
 
 void TextRenderer::setDefaultVerticalAlign(TextRenderer::VerticalAlignment align)
@@ -317,6 +374,8 @@ void TextRenderer::setTitlePageData( const QString& artist, const QString& title
 	bool intitle = true;
 	compileLine( titletext, m_lyricBlocks[0].timestart, m_lyricBlocks[0].timeend, &m_lyricBlocks[0], &intitle );
 
+	buildTimeline();
+	m_blockLayouts.clear();
 	m_forceRedraw = true;
 }
 
@@ -334,18 +393,19 @@ void TextRenderer::init()
 	m_preambleLengthMs = 0;
 	m_preambleCount = 0;
 
-	m_preambleTimeLeft = 0;
-	m_lastDrawnPreamble = 0;
-	m_lastSungTime = 0;
-	m_drawPreamble = false;
 	m_lastBlockPlayed = -2;
 	m_lastPosition = -2;
+	m_lastPreambleSquares = 0;
+	m_lastWipe = 0;
+	m_layerBlock = -1;
 
 	m_beforeDuration = 5000;
 	m_afterDuration = 1000;
 	m_prefetchDuration = 0;
 
 	m_lyricBlocks.clear();
+	m_blockLayouts.clear();
+	buildTimeline();
 }
 
 void TextRenderer::setPreambleData( unsigned int height, unsigned int timems, unsigned int count )
@@ -361,6 +421,41 @@ void TextRenderer::forceCDGmode()
 {
 	m_forceRedraw = true;
     m_cdgMode = true;
+
+	// The glyphs were drawn anti-aliased
+	m_glyphCache.clear();
+}
+
+void TextRenderer::setSmoothWipe( bool enable )
+{
+	m_smoothWipe = enable;
+	m_forceRedraw = true;
+}
+
+bool TextRenderer::setTransparentBackground( bool enable )
+{
+	if ( enable && !m_lyricEvents.isEmpty() )
+		return false;
+
+	m_transparentBackground = enable;
+	m_drawnRect = m_image.rect();
+	m_forceRedraw = true;
+	return true;
+}
+
+QColor TextRenderer::backgroundColor() const
+{
+	return m_colorBackground;
+}
+
+QRect TextRenderer::drawnRect() const
+{
+	return m_drawnRect & m_image.rect();
+}
+
+void TextRenderer::setTelemetry( ExportTelemetry * telemetry )
+{
+	m_telemetry = telemetry;
 }
 
 void TextRenderer::setDurations( unsigned int before, unsigned int after )
@@ -377,92 +472,247 @@ void TextRenderer::setPrefetch( unsigned int prefetch )
 	m_forceRedraw = true;
 }
 
-int TextRenderer::lyricForTime( qint64 tickmark, int * sungpos )
+void TextRenderer::buildTimeline()
 {
-	int nextblk = -1;
+	m_timeline.sorted = true;
+	m_timeline.starts.clear();
+	m_timeline.ends.clear();
+	m_timeline.sungEnds.clear();
+	m_timelineCursor = 0;
+
+	qint64 sungend = 0;
 
-	// Find the next playable lyric block
 	for ( int bl = 0; bl < m_lyricBlocks.size(); bl++ )
 	{
-		if ( tickmark < m_lyricBlocks[bl].timestart )
+		LyricBlockInfo& binfo = m_lyricBlocks[bl];
+
+		binfo.offsetTimes.clear();
+		binfo.offsetPositions.clear();
+
+		for ( QMap< qint64, unsigned int >::const_iterator it = binfo.offsets.begin(); it != binfo.offsets.end(); ++it )
 		{
-			nextblk = bl;
-			break;
+			binfo.offsetTimes.append( it.key() );
+			binfo.offsetPositions.append( it.value() );
 		}
+
+		if ( bl > 0 && ( binfo.timestart < m_timeline.starts.last() || binfo.timeend < m_timeline.ends.last() ) )
+			m_timeline.sorted = false;
+
+		// A block is being sung from its start until its last timed character or its end
+		if ( !binfo.offsets.isEmpty() && qMin( binfo.timeend, binfo.offsets.lastKey() ) >= binfo.timestart )
+			sungend = qMax( sungend, qMin( binfo.timeend, binfo.offsets.lastKey() ) );
+
+		m_timeline.starts.append( binfo.timestart );
+		m_timeline.ends.append( binfo.timeend );
+		m_timeline.sungEnds.append( sungend );
 	}
+}
 
-	// If there is a block within the prefetch timing, show it even if it overwrites the currently played block
-	// (this is why this check is on top)
-	if ( m_prefetchDuration > 0 && nextblk != -1 && m_lyricBlocks[nextblk].timestart - tickmark <= m_prefetchDuration )
+int TextRenderer::nextBlock( qint64 tickmark ) const
+{
+	if ( !m_timeline.sorted )
 	{
-		// We update the timing, but the preamble show/noshow does not change here
-		m_preambleTimeLeft = qMax( 0, (int) (m_lyricBlocks[nextblk].timestart - tickmark) );
-		*sungpos = -1;
-		return nextblk;
+		for ( int bl = 0; bl < m_lyricBlocks.size(); bl++ )
+		{
+			if ( tickmark < m_lyricBlocks[bl].timestart )
+				return bl;
+		}
+
+		return -1;
 	}
 
-	// Find the block which should be currently played, if any.
-	int curblk = -1;
-	int pos = -1;
+	const QVector< qint64 >& starts = m_timeline.starts;
+	int count = starts.size();
 
-	for ( int bl = 0; bl < m_lyricBlocks.size(); bl++ )
+	// Check the block found last time and the one after it first
+	for ( int bl = m_timelineCursor; bl <= qMin( m_timelineCursor + 1, count ); bl++ )
 	{
-		if ( tickmark < m_lyricBlocks[bl].timestart || tickmark > m_lyricBlocks[bl].timeend )
-			continue;
+		if ( (bl == 0 || starts[bl - 1] <= tickmark) && (bl == count || tickmark < starts[bl]) )
+		{
+			m_timelineCursor = bl;
+			return bl < count ? bl : -1;
+		}
+	}
 
-		curblk = bl;
+	m_timelineCursor = std::upper_bound( starts.begin(), starts.end(), tickmark ) - starts.begin();
+	return m_timelineCursor < count ? m_timelineCursor : -1;
+}
+
+int TextRenderer::currentBlock( qint64 tickmark, int nextblk ) const
+{
+	if ( !m_timeline.sorted )
+	{
+		for ( int bl = 0; bl < m_lyricBlocks.size(); bl++ )
+		{
+			if ( tickmark >= m_lyricBlocks[bl].timestart && tickmark <= m_lyricBlocks[bl].timeend )
+				return bl;
+		}
 
-		QMap< qint64, unsigned int >::const_iterator it = m_lyricBlocks[bl].offsets.find( tickmark );
+		return -1;
+	}
 
-		if ( it == m_lyricBlocks[bl].offsets.end() )
-			it = m_lyricBlocks[bl].offsets.lowerBound( tickmark );
+	// Only the blocks before the next one have started
+	const QVector< qint64 >& ends = m_timeline.ends;
+	int started = nextblk == -1 ? ends.size() : nextblk;
 
-		if ( it == m_lyricBlocks[bl].offsets.end() )
+	// Mostly it is the block started last
+	if ( started > 0 && ends[started - 1] >= tickmark && (started == 1 || ends[started - 2] < tickmark) )
+		return started - 1;
+
+	int bl = std::lower_bound( ends.begin(), ends.begin() + started, tickmark ) - ends.begin();
+	return bl < started ? bl : -1;
+}
+
+int TextRenderer::lastEndedBlock( qint64 tickmark ) const
+{
+	if ( !m_timeline.sorted )
+	{
+		int lastblk = -1;
+
+		for ( int bl = 0; bl < m_lyricBlocks.size(); bl++ )
 		{
-			// This may happen if the whole block is title
-			break;
+			if ( m_lyricBlocks[bl].timeend >= tickmark )
+				continue;
+
+			if ( lastblk == -1 || m_lyricBlocks[bl].timeend >= m_lyricBlocks[lastblk].timeend )
+				lastblk = bl;
 		}
 
-		pos = it.value();
+		return lastblk;
+	}
 
-		++it;
-		break;
+	const QVector< qint64 >& ends = m_timeline.ends;
+	return (std::lower_bound( ends.begin(), ends.end(), tickmark ) - ends.begin()) - 1;
+}
+
+TextRenderer::FrameState TextRenderer::frameState( qint64 tickmark ) const
+{
+	FrameState state;
+	state.blockid = -1;
+	state.sungpos = -1;
+	state.preambleSquares = 0;
+	state.wipe = 0;
+
+	// Find the next playable lyric block
+	int nextblk = nextBlock( tickmark );
+
+	// If there is a block within the prefetch timing, show it even if it overwrites the currently played block
+	// (this is why this check is on top)
+	if ( m_prefetchDuration > 0 && nextblk != -1 && m_lyricBlocks[nextblk].timestart - tickmark <= m_prefetchDuration )
+	{
+		state.blockid = nextblk;
+		state.preambleSquares = preambleSquares( nextblk, tickmark );
+		return state;
 	}
 
+	// Find the block which should be currently played, if any.
+	int curblk = currentBlock( tickmark, nextblk );
+
 	// Anything to play right now?
-	if ( curblk == -1 )
+	if ( curblk != -1 )
 	{
-		// Nothing active to show, so if there is a block within next five seconds, show it.
-		if ( nextblk != -1 && m_lyricBlocks[nextblk].timestart - tickmark <= m_beforeDuration )
+		const LyricBlockInfo& binfo = m_lyricBlocks[curblk];
+		int idx = std::lower_bound( binfo.offsetTimes.begin(), binfo.offsetTimes.end(), tickmark ) - binfo.offsetTimes.begin();
+
+		state.blockid = curblk;
+
+		// This may happen if the whole block is title
+		if ( idx < binfo.offsetTimes.size() )
 		{
-			m_preambleTimeLeft = qMax( 0, (int) (m_lyricBlocks[nextblk].timestart - tickmark) );
+			state.sungpos = binfo.offsetPositions[idx];
 
-			// We show preamble if there was silence over PREAMBLE_MIN_PAUSE and the block
-			// actually contains any time changes
-			if ( tickmark - m_lastSungTime > PREAMBLE_MIN_PAUSE && !m_lyricBlocks[nextblk].offsets.isEmpty() )
+			// The smooth wipe goes through the characters since the previous timing, reaching this one at its time
+			if ( m_smoothWipe && idx > 0 )
 			{
-				// m_preambleHeight == 0 disables the preamble
-				if ( m_preambleHeight > 0 )
-					m_drawPreamble = true;
+				qint64 wiped = (qint64) (binfo.offsetPositions[idx] - binfo.offsetPositions[idx - 1]) * 256
+						* (tickmark - binfo.offsetTimes[idx - 1]) / (binfo.offsetTimes[idx] - binfo.offsetTimes[idx - 1]);
+
+				state.sungpos = binfo.offsetPositions[idx - 1] + wiped / 256;
+				state.wipe = wiped % 256;
 			}
+		}
+
+		return state;
+	}
+
+	// Nothing active to show, so if there is a block within next five seconds, show it.
+	if ( nextblk != -1 && m_lyricBlocks[nextblk].timestart - tickmark <= m_beforeDuration )
+	{
+		state.blockid = nextblk;
+		state.preambleSquares = preambleSquares( nextblk, tickmark );
+		return state;
+	}
+
+	// If we just finished playing something, keep it for 5 more seconds (i.e. post-delay).
+	// This is the block which ended last, shown as it was at its end.
+	if ( tickmark - lastSungTime( tickmark ) < 5000 )
+	{
+		state.blockid = lastEndedBlock( tickmark );
+
+		if ( state.blockid != -1 )
+		{
+			const LyricBlockInfo& binfo = m_lyricBlocks[state.blockid];
+			int idx = std::lower_bound( binfo.offsetTimes.begin(), binfo.offsetTimes.end(), binfo.timeend ) - binfo.offsetTimes.begin();
 
-			*sungpos = -1;
-			return nextblk;
+			if ( idx < binfo.offsetTimes.size() )
+				state.sungpos = binfo.offsetPositions[idx];
 		}
+	}
 
-		// No next block or too far away yet
-		m_drawPreamble = false;
-		return -1;
+	return state;
+}
+
+qint64 TextRenderer::lastSungTime( qint64 tickmark ) const
+{
+	if ( m_timeline.sorted )
+	{
+		// The blocks started by now are the ones before the next block
+		int nextblk = nextBlock( tickmark );
+		int started = nextblk == -1 ? m_timeline.sungEnds.size() : nextblk;
+
+		if ( started == 0 )
+			return 0;
+
+		return qMax( (qint64) 0, qMin( tickmark, m_timeline.sungEnds[started - 1] ) );
+	}
+
+	qint64 lastsung = 0;
+
+	// A block is being sung from its start until its last timed character or its end
+	for ( int bl = 0; bl < m_lyricBlocks.size(); bl++ )
+	{
+		const LyricBlockInfo& binfo = m_lyricBlocks[bl];
+
+		if ( binfo.timestart > tickmark || binfo.offsets.isEmpty() )
+			continue;
+
+		qint64 sungend = qMin( tickmark, qMin( binfo.timeend, binfo.offsets.lastKey() ) );
+
+		if ( sungend >= binfo.timestart )
+			lastsung = qMax( lastsung, sungend );
 	}
 
-	m_drawPreamble = false;
+	return lastsung;
+}
+
+int TextRenderer::preambleSquares( int nextblk, qint64 tickmark ) const
+{
+	// m_preambleHeight == 0 disables the preamble
+	if ( m_preambleHeight == 0 || m_preambleCount == 0 )
+		return 0;
+
+	// We show preamble if there was silence over PREAMBLE_MIN_PAUSE and the block
+	// actually contains any time changes
+	if ( tickmark - lastSungTime( tickmark ) <= PREAMBLE_MIN_PAUSE || m_lyricBlocks[nextblk].offsets.isEmpty() )
+		return 0;
 
-	// If we're singing something (i.e. pos > 0), remember the timing
-	if ( pos >= 0 )
-		m_lastSungTime = tickmark;
+	// A square for each PREAMBLE_SQUARE; we do not draw anything for the last one, and speed up it 0.15sec
+	qint64 timeleft = m_lyricBlocks[nextblk].timestart - tickmark;
 
-	*sungpos = pos;
-	return curblk;
+	if ( timeleft <= PREAMBLE_SQUARE + 50 )
+		return 0;
+
+	return qMin( (int) m_preambleCount, (int) ((timeleft - PREAMBLE_SQUARE - 50) / PREAMBLE_SQUARE) + 1 );
 }
 
 bool TextRenderer::verifyFontSize( const QSize& size, const QFont& font )
@@ -490,18 +740,52 @@ int	TextRenderer::autodetectFontSize( const QSize& size, const QFont& font )
 {
 	QFont normalfont = font;
 
-	// Start with 8
-	int fontsize = 8;
+	// A scalable font text grows almost linearly with its size, so the size which fits the largest block
+	// measured at the reference size is close; the hinting makes it off by a few points.
+	normalfont.setPointSize( AUTODETECT_REFERENCE_SIZE );
+	qint64 guess = AUTODETECT_MAX_SIZE;
 
-	while ( 1 )
+	for ( int bl = 0; bl < m_lyricBlocks.size(); bl++ )
+	{
+		QRect rect = boundingRect( bl, normalfont );
+
+		if ( rect.width() > 0 )
+			guess = qMin( guess, (qint64) AUTODETECT_REFERENCE_SIZE * (size.width() - 1) / rect.width() );
+
+		if ( rect.height() > 0 )
+			guess = qMin( guess, (qint64) AUTODETECT_REFERENCE_SIZE * (size.height() - 1) / rect.height() );
+	}
+
+	// The largest size known to fit and the smallest known not to; 8 is the smallest one checked
+	int fits = 7;
+	int fails = AUTODETECT_MAX_SIZE + 1;
+
+	// Step away from the guess with growing steps until both are found, then bisect
+	int fontsize = qBound( 8, (int) guess, AUTODETECT_MAX_SIZE );
+	int step = 1;
+
+	while ( fails - fits > 1 )
 	{
 		normalfont.setPointSize( fontsize );
 
-		if ( !verifyFontSize( size, normalfont ) )
-			return fontsize - 1;
+		if ( verifyFontSize( size, normalfont ) )
+		{
+			fits = fontsize;
+			fontsize += step;
+		}
+		else
+		{
+			fails = fontsize;
+			fontsize -= step;
+		}
+
+		step *= 2;
 
-		fontsize++;
+		if ( fontsize <= fits || fontsize >= fails )
+			fontsize = fits + (fails - fits) / 2;
 	}
+
+	return fits;
 }
 
 bool TextRenderer::checkFit( const QSize& imagesize, const QFont& font, const QString& text )
@@ -525,71 +809,209 @@ bool TextRenderer::checkFit( const QSize& imagesize, const QFont& font, const QS
 
 QRect TextRenderer::boundingRect( int blockid, const QFont& font )
 {
-	QString block = m_lyricBlocks[blockid].text;
+	const LyricBlockInfo& binfo = m_lyricBlocks[blockid];
+	const QString& block = binfo.text;
+
+	QMutexLocker locker( &measuresMutex );
+
+	if ( measuresCache.size() > MEASURES_MAX_FONTS )
+		measuresCache.clear();
 
 	// Calculate the height
 	QFont curFont(font);
-	QFontMetrics metrics = QFontMetrics( curFont );
+	FontMeasures * measures = fontMeasures( curFont );
 
-	// Calculate the width and height for every line
+	// Calculate the width and height for every line; the text between the line breaks and the font
+	// changes is measured at once
 	int linewidth = 0, lineheight = 0, totalheight = 0, totalwidth = 0;
-	int cur = 0;
+	int runstart = 0;
 
-	while ( 1 )
+	for ( int cur = 0; cur <= block.length(); cur++ )
 	{
-		// Line/text end
-		if ( cur >= block.length() || block[cur] == '\n' )
+		bool lineend = cur == block.length() || block[cur] == '\n';
+
+		// The font changes at the line breaks are ignored
+		QMap< unsigned int, int >::const_iterator fontchange = lineend ? binfo.fonts.end() : binfo.fonts.find( cur );
+
+		if ( !lineend && fontchange == binfo.fonts.end() )
+			continue;
+
+		if ( cur > runstart )
 		{
-			// Adjust the total height
-			totalheight += lineheight;
-			totalwidth = qMax( totalwidth, linewidth );
+			QString run = block.mid( runstart, cur - runstart );
+			QHash< QString, int >::const_iterator width = measures->widths.constFind( run );
 
-			if ( cur >= block.length() )
-				break; // we're done here
+			if ( width == measures->widths.constEnd() )
+			{
+				QFontMetrics metrics( curFont );
+				int runwidth = 0;
 
-			cur++;
-			linewidth = 0;
+				for ( int i = 0; i < run.length(); i++ )
+					runwidth += metrics.horizontalAdvance( run[i] );
 
-			continue;
+				width = measures->widths.insert( run, runwidth );
+			}
+
+			linewidth += width.value();
+			lineheight = qMax( lineheight, measures->height );
 		}
 
-		// We're calculating line width here, so check for any font change events
-		QMap< unsigned int, int >::const_iterator fontchange = m_lyricBlocks[blockid].fonts.find( cur );
+		runstart = lineend ? cur + 1 : cur;
 
-		if ( fontchange != m_lyricBlocks[blockid].fonts.end() )
+		if ( fontchange != binfo.fonts.end() )
 		{
 			curFont.setPointSize( curFont.pointSize() + fontchange.value() );
-			metrics = QFontMetrics( curFont );
+			measures = fontMeasures( curFont );
 		}
 
-        linewidth += metrics.horizontalAdvance( block[cur] );
-		lineheight = qMax( lineheight, metrics.height() );
-		cur++;
+		// Line/text end
+		if ( lineend )
+		{
+			// Adjust the total height
+			totalheight += lineheight;
+			totalwidth = qMax( totalwidth, linewidth );
+			linewidth = 0;
+		}
 	}
 
 	return QRect( 0, 0, totalwidth, totalheight );
 }
 
-void TextRenderer::drawLyrics( int blockid, int pos, const QRect& boundingRect )
+void TextRenderer::drawLyrics( int blockid, int pos, int wipe )
 {
-    QString block = m_lyricBlocks[blockid].text;
+    if ( blockid != m_layerBlock )
+        prepareLayers( blockid );
+
+    if ( m_layerRect.isEmpty() )
+        return;
+
+    // Sang are the lines before the sung position, and its line up to it
+    QRegion sang;
+
+    // The last timing is past the text end; the block is all sung then, and while kept after its end
+    if ( pos >= m_layerChars.size() )
+        sang = m_layerRect;
+    else if ( pos >= 0 )
+    {
+        const CharLayout& sung = m_layerChars[pos];
+        int top = m_layerRect.top();
+
+        for ( int line = 0; line <= sung.line; line++ )
+        {
+            int right = line < sung.line ? m_layerRect.right() + 1 : sung.x + sung.advance * wipe / 256;
 
-    // Prepare the painter
+            sang += QRect( m_layerRect.left(), top, right - m_layerRect.left(), m_layerLineBottoms[line] - top );
+            top = m_layerLineBottoms[line];
+        }
+    }
+
+    QRegion tosing = QRegion( m_layerRect ).subtracted( sang );
     QPainter painter( &m_image );
-    painter.setFont( m_renderFont );
 
-    if ( m_cdgMode )
-        painter.setRenderHints( QPainter::Antialiasing | QPainter::SmoothPixmapTransform | QPainter::TextAntialiasing, false );
+    if ( !sang.isEmpty() )
+    {
+        painter.setClipRegion( sang );
+        painter.drawImage( m_layerRect.topLeft(), m_layerSang );
+    }
+
+    if ( !tosing.isEmpty() )
+    {
+        painter.setClipRegion( tosing );
+        painter.drawImage( m_layerRect.topLeft(), m_layerToSing );
+    }
+
+    m_drawnRect |= m_layerRect;
+}
+
+const TextRenderer::BlockLayout& TextRenderer::blockLayout( int blockid )
+{
+    if ( m_blockLayouts.size() != m_lyricBlocks.size() )
+        m_blockLayouts.resize( m_lyricBlocks.size() );
 
-    // Used in calculations only
+    BlockLayout& layout = m_blockLayouts[blockid];
+
+    // Every laid out block has at least one line
+    if ( !layout.lineEnds.isEmpty() )
+        return layout;
+
+    const LyricBlockInfo& binfo = m_lyricBlocks[blockid];
+    const QString& block = binfo.text;
+
+    layout.rect = boundingRect( blockid, m_renderFont );
+
+    // The line widths are calculated as in boundingRect()
     QFont curFont( m_renderFont );
     QFontMetrics metrics( curFont );
-    QColor fallbackColor = m_colorToSing;
 
-    if ( pos == -1 )
-        painter.setPen( m_colorToSing );
-    else
-        painter.setPen( m_colorSang );
+    // The glyphs are drawn in the image device font
+    QFont drawFont( m_renderFont );
+    QFontMetrics drawMetrics( drawFont, &m_image );
+    layout.drawFonts.append( drawFont );
+
+    layout.advances.resize( block.length() );
+    layout.fonts.resize( block.length() );
+    layout.colors.resize( block.length() );
+
+    int linewidth = 0;
+    int color = -1;
+
+    for ( int cur = 0; cur <= block.length(); cur++ )
+    {
+        // Line/text end; the font and color changes here are ignored
+        if ( cur == block.length() || block[cur] == '\n' )
+        {
+            layout.lineEnds.append( cur );
+            layout.lineWidths.append( linewidth );
+            layout.lineHeights.append( drawMetrics.height() );
+            layout.lineDescents.append( drawMetrics.descent() );
+
+            if ( cur < block.length() )
+            {
+                layout.advances[cur] = 0;
+                layout.fonts[cur] = layout.drawFonts.size() - 1;
+                layout.colors[cur] = color;
+            }
+
+            linewidth = 0;
+            continue;
+        }
+
+        QMap< unsigned int, int >::const_iterator fontchange = binfo.fonts.find( cur );
+
+        if ( fontchange != binfo.fonts.end() )
+        {
+            curFont.setPointSize( curFont.pointSize() + fontchange.value() );
+            metrics = QFontMetrics( curFont );
+
+            drawFont = QFont( drawFont.family(), drawFont.pointSize() + fontchange.value() );
+            drawMetrics = QFontMetrics( drawFont, &m_image );
+            layout.drawFonts.append( drawFont );
+        }
+
+        // The color changes only change the characters not sung yet
+        QMap< unsigned int, QString >::const_iterator colchange = binfo.colors.find( cur );
+
+        if ( colchange != binfo.colors.end() )
+        {
+            layout.colorChanges.append( QColor( colchange.value() ) );
+            color = layout.colorChanges.size() - 1;
+        }
+
+        linewidth += metrics.horizontalAdvance( block[cur] );
+
+        layout.advances[cur] = drawMetrics.horizontalAdvance( block[cur] );
+        layout.fonts[cur] = layout.drawFonts.size() - 1;
+        layout.colors[cur] = color;
+    }
+
+    return layout;
+}
+
+void TextRenderer::prepareLayers( int blockid )
+{
+    const BlockLayout& layout = blockLayout( blockid );
+    const QString& block = m_lyricBlocks[blockid].text;
+    int firstLineHeight = QFontMetrics( layout.drawFonts.first(), &m_image ).height();
 
     // Get the height offset from the rect.
     int start_y = 0;
@@ -597,100 +1019,156 @@ void TextRenderer::drawLyrics( int blockid, int pos, const QRect& boundingRect )
 
     // Draw title in the center, the rest according to the current vertical alignment
     if ( blockid == 0 || verticalAlignment == VerticalMiddle )
-        start_y = (m_image.height() - boundingRect.height()) / 2 + painter.fontMetrics().height();
+        start_y = (m_image.height() - layout.rect.height()) / 2 + firstLineHeight;
     else if ( verticalAlignment == VerticalTop )
-        start_y = painter.fontMetrics().height() + m_image.width() / 50;	// see drawPreamble() for the offset
+        start_y = firstLineHeight + m_image.width() / 50;	// see drawPreamble() for the offset
     else
-        start_y = (m_image.height() - boundingRect.height());
+        start_y = (m_image.height() - layout.rect.height());
 
-    // Draw the whole text
+    // Both glyphs of every character, where they are drawn
+    typedef struct
+    {
+        QPoint  corner;
+        Glyph   tosing;
+        Glyph   sang;
+    } PlacedGlyph;
+
+    QVector< PlacedGlyph > placed;
+
+    m_layerChars.resize( block.length() );
+    m_layerLineBottoms.clear();
+    m_layerRect = QRect();
+
+    int font = -1;
+    GlyphCache * glyphs = 0;
     int linestart = 0;
-    int linewidth = 0;
-    int cur = 0;
 
-    while ( 1 )
+    for ( int line = 0; line < layout.lineEnds.size(); line++ )
     {
-        // Line/text end
-        if ( cur >= block.length() || block[cur] == '\n' )
-        {
-            // Now we know the width, calculate the start offset
-            int start_x = (m_image.width() - linewidth) / 2;
+        int lineend = layout.lineEnds[line];
+        int start_x = (m_image.width() - layout.lineWidths[line]) / 2;
 
-            // Draw the line
-            for ( int i = linestart; i < cur; i++ )
+        for ( int i = linestart; i < lineend; i++ )
+        {
+            if ( layout.fonts[i] != font )
             {
-                // Handle the font change events
-                QMap< unsigned int, int >::const_iterator fontchange = m_lyricBlocks[blockid].fonts.find( i );
+                font = layout.fonts[i];
+                glyphs = &m_glyphCache[ layout.drawFonts[font].key() ];
+            }
 
-                if ( fontchange != m_lyricBlocks[blockid].fonts.end() )
-                {
-                    painter.setFont( QFont(painter.font().family(), painter.font().pointSize() + fontchange.value() ) );
-                }
+            const QFont& drawFont = layout.drawFonts[font];
+            QColor color = layout.colors[i] < 0 ? m_colorToSing : layout.colorChanges[ layout.colors[i] ];
 
-                // Handle the color change events if pos doesn't cover them
-                QMap< unsigned int, QString >::const_iterator colchange = m_lyricBlocks[blockid].colors.find( i );
+            PlacedGlyph glyphpair;
+            glyphpair.tosing = glyph( *glyphs, drawFont, color, block[i] );
+            glyphpair.sang = glyph( *glyphs, drawFont, m_colorSang, block[i] );
+            glyphpair.corner = QPoint( start_x, start_y ) + glyphpair.tosing.offset;
 
-                if ( colchange != m_lyricBlocks[blockid].colors.end() )
-                {
-                    QColor newcolor( colchange.value() );
-                    fallbackColor = newcolor;
+            placed.append( glyphpair );
+            m_layerRect |= QRect( glyphpair.corner, glyphpair.tosing.image.size() );
 
-                    if ( i > pos )
-                        painter.setPen( newcolor );
-                }
+            CharLayout charlayout = { line, start_x, layout.advances[i] };
+            m_layerChars[i] = charlayout;
 
-                if ( pos != -1 && i >= pos )
-                {
-                    painter.setPen( fallbackColor );
-                }
+            start_x += charlayout.advance;
+        }
 
-                // Outline
-                const int OL = 1;
-                painter.save();
-                painter.setPen( Qt::black );
-                painter.drawText( start_x - OL, start_y - OL, (QString) block[i] );
-                painter.drawText( start_x + OL, start_y - OL, (QString) block[i] );
-                painter.drawText( start_x - OL, start_y + OL, (QString) block[i] );
-                painter.drawText( start_x + OL, start_y + OL, (QString) block[i] );
-                painter.restore();
-
-                painter.drawText( start_x, start_y, (QString) block[i] );
-                start_x += painter.fontMetrics().horizontalAdvance( block[i] );
-            }
+        // The line break is at the line end
+        if ( lineend < block.length() )
+        {
+            CharLayout charlayout = { line, start_x, 0 };
+            m_layerChars[lineend] = charlayout;
+        }
 
-            if ( cur >= block.length() )
-                break; // we're done here
+        m_layerLineBottoms.append( start_y + layout.lineDescents[line] + 1 );
 
-            // Start the next line
-            start_y += painter.fontMetrics().height();
-            cur++;
-            linewidth = 0;
-            linestart = cur;
-            continue;
-        }
+        // Start the next line
+        start_y += layout.lineHeights[line];
+        linestart = lineend + 1;
+    }
 
-        // We're calculating line width here, so check for any font change events
-        QMap< unsigned int, int >::const_iterator fontchange = m_lyricBlocks[blockid].fonts.find( cur );
+    m_layerBlock = blockid;
 
-        if ( fontchange != m_lyricBlocks[blockid].fonts.end() )
-        {
-            curFont.setPointSize( curFont.pointSize() + fontchange.value() );
-            metrics = QFontMetrics( curFont );
-        }
+    if ( m_layerRect.isEmpty() )
+    {
+        m_layerToSing = QImage();
+        m_layerSang = QImage();
+        return;
+    }
 
-        linewidth += metrics.horizontalAdvance( block[cur] );
-        cur++;
+    // The line bands cover the layers from top to bottom without overlapping
+    int top = m_layerRect.top();
+
+    for ( int line = 0; line < m_layerLineBottoms.size(); line++ )
+    {
+        if ( line == m_layerLineBottoms.size() - 1 )
+            m_layerLineBottoms[line] = m_layerRect.bottom() + 1;
+        else
+            m_layerLineBottoms[line] = qBound( top, m_layerLineBottoms[line], m_layerRect.bottom() + 1 );
+
+        top = m_layerLineBottoms[line];
+    }
+
+    m_layerToSing = QImage( m_layerRect.size(), QImage::Format_ARGB32_Premultiplied );
+    m_layerToSing.fill( Qt::transparent );
+    m_layerSang = QImage( m_layerRect.size(), QImage::Format_ARGB32_Premultiplied );
+    m_layerSang.fill( Qt::transparent );
+
+    QPainter tosing( &m_layerToSing );
+    QPainter sang( &m_layerSang );
+
+    Q_FOREACH ( const PlacedGlyph& glyphpair, placed )
+    {
+        tosing.drawImage( glyphpair.corner - m_layerRect.topLeft(), glyphpair.tosing.image );
+        sang.drawImage( glyphpair.corner - m_layerRect.topLeft(), glyphpair.sang.image );
     }
 }
 
-void TextRenderer::drawPreamble()
+const TextRenderer::Glyph& TextRenderer::glyph( GlyphCache& cache, const QFont& font, const QColor& color, QChar ch )
 {
-    // Is there anything to draw?
-    if ( m_preambleTimeLeft <= PREAMBLE_SQUARE + 50 )
-        return;
+    quint64 key = ((quint64) color.rgba() << 32) | ch.unicode();
+    GlyphCache::const_iterator it = cache.constFind( key );
+
+    if ( it != cache.constEnd() )
+        return it.value();
+
+    // The glyph ink may go beyond its advance; the outline, and one more pixel for anti-aliasing
+    const int OL = 1;
+    QRect rect = QFontMetrics( font, &m_image ).boundingRect( ch ).adjusted( -OL - 1, -OL - 1, OL + 1, OL + 1 );
+
+    Glyph glyph;
+    glyph.offset = rect.topLeft();
+    glyph.image = QImage( rect.size().expandedTo( QSize( 1, 1 ) ), QImage::Format_ARGB32_Premultiplied );
+    glyph.image.setDotsPerMeterX( m_image.dotsPerMeterX() );
+    glyph.image.setDotsPerMeterY( m_image.dotsPerMeterY() );
+    glyph.image.fill( Qt::transparent );
+
+    QPainter painter( &glyph.image );
+    painter.setFont( font );
+
+    if ( m_cdgMode )
+        painter.setRenderHints( QPainter::Antialiasing | QPainter::SmoothPixmapTransform | QPainter::TextAntialiasing, false );
+
+    // Baseline origin within the image
+    int x = -rect.left();
+    int y = -rect.top();
+
+    // Outline
+    painter.setPen( Qt::black );
+    painter.drawText( x - OL, y - OL, QString( ch ) );
+    painter.drawText( x + OL, y - OL, QString( ch ) );
+    painter.drawText( x - OL, y + OL, QString( ch ) );
+    painter.drawText( x + OL, y + OL, QString( ch ) );
+
+    painter.setPen( color );
+    painter.drawText( x, y, QString( ch ) );
+    painter.end();
 
-    int cutoff_time = m_preambleTimeLeft - PREAMBLE_SQUARE - 50;
+    return cache.insert( key, glyph ).value();
+}
 
+void TextRenderer::drawPreamble( int squares )
+{
     int preamble_spacing = m_image.width() / 100;
     int preamble_width = (m_image.width() - preamble_spacing * m_preambleCount ) / m_preambleCount;
 
@@ -701,24 +1179,37 @@ void TextRenderer::drawPreamble()
     if ( m_cdgMode )
         painter.setRenderHints( QPainter::Antialiasing | QPainter::SmoothPixmapTransform | QPainter::TextAntialiasing, false );
 
-    // Draw a square for each PREAMBLE_SQUARE; we do not draw anything for the last one, and speed up it 0.15sec
-    for ( int i = 0; i < (int) m_preambleCount; i++ )
+    for ( int i = 0; i < squares; i++ )
     {
-        if ( i * PREAMBLE_SQUARE > cutoff_time )
-            continue;
+        QRect square( preamble_spacing + i * (preamble_spacing + preamble_width),
+                      preamble_spacing,
+                      preamble_width,
+                      m_preambleHeight );
 
-        painter.drawRect( preamble_spacing + i * (preamble_spacing + preamble_width),
-                          preamble_spacing,
-                          preamble_width,
-                          m_preambleHeight );
+        painter.drawRect( square );
+        m_drawnRect |= square.adjusted( -1, -1, 2, 2 );
     }
-
-    m_lastDrawnPreamble = m_preambleTimeLeft;
 }
 
 
 void TextRenderer::drawBackground( qint64 timing )
 {
+	ExportTelemetry::Timer timer( m_telemetry, ExportTelemetry::STAGE_BACKGROUND );
+
+	if ( m_transparentBackground )
+	{
+		// Only the lyrics are drawn, so only the area drawn last time needs to be cleared
+		QRect clear = m_drawnRect & m_image.rect();
+
+		for ( int y = clear.top(); y <= clear.bottom(); y++ )
+			memset( m_image.scanLine( y ) + clear.left() * 4, 0, clear.width() * 4 );
+
+		m_drawnRect = QRect();
+		return;
+	}
+
+	m_drawnRect = QRect();
+
 	// Fill the image background
 	m_image.fill( m_colorBackground.rgb() );
 
@@ -728,12 +1219,14 @@ void TextRenderer::drawBackground( qint64 timing )
 
 int TextRenderer::update( qint64 timing )
 {
+	ExportTelemetry::Timer timer( m_telemetry, ExportTelemetry::STAGE_RENDER );
 	int result = UPDATE_COLORCHANGE;
-	bool redrawPreamble = false;
-	int sungpos = 0;
 
-	// Should we show the title?
-	int blockid = lyricForTime( timing, &sungpos );
+	// Everything drawn is derived from the timing only, so the timings could come in any order
+	FrameState state = frameState( timing );
+	int blockid = state.blockid;
+	int sungpos = state.sungpos;
+	int wipe = state.wipe;
 /*
 	if ( blockid != -1 )
 	{
@@ -765,28 +1258,16 @@ int TextRenderer::update( qint64 timing )
 	else
 		qDebug("Time %d: no block!", (int) timing );
 */
-	// Force the full redraw if time went backward
-	if ( timing < m_lastSungTime )
-		m_forceRedraw = true;
-
-	// Is it time to redraw the preamble?
-	if ( m_drawPreamble && abs( m_lastDrawnPreamble - m_preambleTimeLeft ) > 450 )
-		redrawPreamble = true;
-
 	// Check whether we can skip the redraws
 	bool background_updated = (m_lyricEvents.isEmpty() || !m_lyricEvents.updated( timing )) ? false : true;
 
-	if ( !m_forceRedraw && !redrawPreamble && !background_updated )
-	{
-		// Did lyrics change at all?
-		if ( blockid == m_lastBlockPlayed && sungpos == m_lastPosition )
-			return UPDATE_NOCHANGE;
-
-		// If the new lyrics is empty, but we just finished playing something, keep it for 5 more seconds
-		// (i.e. post-delay)
-		if ( blockid == -1 && timing - m_lastSungTime < 5000 )
-			return UPDATE_NOCHANGE;
-	}
+	if ( !m_forceRedraw && !background_updated
+	&& blockid == m_lastBlockPlayed && sungpos == m_lastPosition && wipe == m_lastWipe && state.preambleSquares == m_lastPreambleSquares )
+		return UPDATE_NOCHANGE;
+
+	// The rendering params changed, so the block layers must be drawn again
+	if ( m_forceRedraw )
+		m_layerBlock = -1;
 
 	// Draw the background first
 	drawBackground( timing );
@@ -795,13 +1276,15 @@ int TextRenderer::update( qint64 timing )
 	if ( blockid != -1 )
 	{
 		// Do the new lyrics fit into the image without resizing?
-		QRect imgrect = boundingRect( blockid, m_renderFont );
+		QRect imgrect = blockLayout( blockid ).rect;
 
 		if ( imgrect.width() > m_image.width() || imgrect.height() > m_image.height() )
 		{
 			QSize newsize = QSize( qMax( imgrect.width() + 10, m_image.width() ),
 								   qMax( imgrect.height() + 10, m_image.height() ) );
 			m_image = QImage( newsize, QImage::Format_ARGB32 );
+			m_drawnRect = m_image.rect();
+			m_layerBlock = -1;
 			result = UPDATE_RESIZED;
 
 			// Draw the background again on the resized image
@@ -809,11 +1292,11 @@ int TextRenderer::update( qint64 timing )
 		}
 
 		// Draw the lyrics
-		drawLyrics( blockid, sungpos, imgrect );
+		drawLyrics( blockid, sungpos, wipe );
 
 		// Draw the preamble if needed
-		if ( m_drawPreamble )
-			drawPreamble();
+		if ( state.preambleSquares > 0 )
+			drawPreamble( state.preambleSquares );
 	}
 
 	// Is the text change significant enough to warrant full screen redraw?
@@ -827,12 +1310,53 @@ int TextRenderer::update( qint64 timing )
 
 	m_lastBlockPlayed = blockid;
 	m_lastPosition = sungpos;
+	m_lastWipe = wipe;
+	m_lastPreambleSquares = state.preambleSquares;
 
 	m_forceRedraw = false;
 	return result;
 }
 
 
+QByteArray TextRenderer::contentHash( qint64 start, qint64 end, qint64 step ) const
+{
+	QCryptographicHash hash( QCryptographicHash::Sha1 );
+
+	if ( !m_lyricEvents.isEmpty() )
+		hash.addData( m_lyricEvents.fingerprint() );
+
+	// Only the frames where the drawn state changes are hashed, with the block content rather than
+	// its index, so adding a block does not change the frames of the other blocks
+	FrameState last = { -2, -2, -1, 0 };
+
+	for ( qint64 timing = start; timing < end; timing += step )
+	{
+		FrameState state = frameState( timing );
+
+		if ( state.blockid == last.blockid && state.sungpos == last.sungpos && state.wipe == last.wipe && state.preambleSquares == last.preambleSquares )
+			continue;
+
+		QByteArray data;
+		QDataStream stream( &data, QIODevice::WriteOnly );
+
+		stream << timing << state.sungpos << state.preambleSquares;
+
+		if ( m_smoothWipe )
+			stream << state.wipe;
+
+		if ( state.blockid != -1 )
+		{
+			const LyricBlockInfo& block = m_lyricBlocks[ state.blockid ];
+			stream << block.text << block.colors << block.fonts << block.verticalAlignment;
+		}
+
+		hash.addData( data );
+		last = state;
+	}
+
+	return hash.result();
+}
+
 void TextRenderer::prepareEvents()
 {
 	m_lyricEvents.prepare();
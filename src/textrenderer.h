@@ -22,10 +22,12 @@
 
 #include <QFont>
 #include <QColor>
+#include <QHash>
 
 #include "lyricsrenderer.h"
 #include "lyricsevents.h"
 #include "lyrics.h"
+#include "exporttelemetry.h"
 
 class Project;
 
@@ -42,6 +44,11 @@ class TextRenderer : public LyricsRenderer
 
 		TextRenderer( int width, int height );
 
+		// Creates an independent copy of a fully set up renderer, so several renderers could draw
+		// different timings in parallel. The image for a specific timing does not depend on which
+		// timings were drawn before, so all copies produce the same images.
+		TextRenderer * clone() const;
+
 		// Sets the lyrics to render. Resets all previously set params to defaults except setDisplaySize.
 		void	setLyrics( const Lyrics& lyrics );
 
@@ -59,6 +66,21 @@ class TextRenderer : public LyricsRenderer
 		// Force CD+G rendering mode (no anti-aliasing)
 		void	forceCDGmode();
 
+		// Wipe the sung color through each character during its time, instead of coloring it
+		// at once when its time starts. Off by default.
+		void	setSmoothWipe( bool enable );
+
+		// Draw only the lyrics on a transparent image, leaving the solid background to the video
+		// encoder. Returns false if the background is not solid (there are background events).
+		bool	setTransparentBackground( bool enable );
+		QColor	backgroundColor() const;
+
+		// The image area where anything was drawn by the last update() which changed the image
+		QRect	drawnRect() const;
+
+		// Reports the update and background drawing times there; shared by the clones
+		void	setTelemetry( ExportTelemetry * telemetry );
+
 		// Typically lyrics are shown a little before they are being sung, and kept after they end.
 		// This function overrides default before (5000ms) and after (1000ms) lengths
 		void	setDurations( unsigned int before, unsigned int after );
@@ -73,6 +95,11 @@ class TextRenderer : public LyricsRenderer
 		// Draw a new lyrics image
 		virtual int	update( qint64 timing );
 
+		// Fingerprint of everything drawn for the timings from start (inclusive) to end by step,
+		// the same if and only if those frames are drawn the same with the same rendering params.
+		// Finds the video parts which changed since the previous export.
+		QByteArray	contentHash( qint64 start, qint64 end, qint64 step ) const;
+
 		// Checks if a line or block fits into the requested image.
 		static	bool checkFit( const QSize& imagesize, const QFont& font, const QString& text );
 
@@ -87,13 +114,61 @@ class TextRenderer : public LyricsRenderer
 		// or the default font if not specified
 		QRect	boundingRect( int blockid, const QFont& font );
 
+		// Everything which is drawn for a specific timing
+		typedef struct
+		{
+			int		blockid;			// -1 - no lyrics shown
+			int		sungpos;			// -1 - nothing sung yet
+			int		preambleSquares;	// 0 - no preamble shown
+			int		wipe;				// 1/256ths of the sungpos character sung (smooth wipe only)
+		} FrameState;
+
 		void	init();
 		void	prepareEvents();
-		int		lyricForTime( qint64 tickmark, int * sungpos );
+		FrameState	frameState( qint64 tickmark ) const;
+		qint64	lastSungTime( qint64 tickmark ) const;
+
+		// Block lookups by time; -1 if there is no such block
+		void	buildTimeline();
+		int		nextBlock( qint64 tickmark ) const;						// first block starting after tickmark
+		int		currentBlock( qint64 tickmark, int nextblk ) const;		// first block played at tickmark
+		int		lastEndedBlock( qint64 tickmark ) const;				// block ended last before tickmark
+		int		preambleSquares( int nextblk, qint64 tickmark ) const;
 		QString	titleScreen() const;
 		void	fixActionSequences( QString& block );
-		void	drawLyrics( int blockid, int pos, const QRect& boundingRect );
-		void	drawPreamble();
+		void	drawLyrics( int blockid, int pos, int wipe );
+		void	prepareLayers( int blockid );
+
+		// Block text laid out in the render font: the line breaks, and every character font, advance
+		// and "to sing" color. The positions within the image are only known when drawn.
+		typedef struct
+		{
+			QRect			rect;			// as boundingRect() with the render font
+			QVector< int >	lineEnds;		// the line break or the text end offset of every line
+			QVector< int >	lineWidths;
+			QVector< int >	lineHeights;	// to the next line baseline, in the font at the line end
+			QVector< int >	lineDescents;
+			QVector< int >	advances;		// per character, in its drawn font
+			QVector< int >	fonts;			// per character, the drawFonts index
+			QVector< int >	colors;			// per character, the colorChanges index; -1 - the "to sing" color
+			QList< QFont >	drawFonts;
+			QList< QColor >	colorChanges;
+		} BlockLayout;
+
+		const BlockLayout&	blockLayout( int blockid );
+
+		// Outlined glyph drawn once, and then only blended into the image
+		typedef struct
+		{
+			QImage	image;
+			QPoint	offset;		// of the image corner from the glyph baseline origin
+		} Glyph;
+
+		// Glyphs of one font, keyed by the fill color (high 32 bits) and the character
+		typedef QHash< quint64, Glyph >	GlyphCache;
+
+		const Glyph&	glyph( GlyphCache& cache, const QFont& font, const QColor& color, QChar ch );
+		void	drawPreamble( int squares );
 		void	drawBackground( qint64 timing );
 
 	private:
@@ -109,6 +184,10 @@ class TextRenderer : public LyricsRenderer
 			// Text offsets in block per specific time
 			QMap< qint64, unsigned int > offsets;
 
+			// The same offsets as sorted arrays, for the lookups while rendering
+			QVector< qint64 >		offsetTimes;
+			QVector< unsigned int >	offsetPositions;
+
 			// Per-character color changes for following (non-sung) characters in the block.
 			// if none, the default color is used
 			QMap< unsigned int, QString > colors;
@@ -123,6 +202,21 @@ class TextRenderer : public LyricsRenderer
 
 		QVector< LyricBlockInfo >	m_lyricBlocks;
 
+		// Block timings for the binary search. The blocks normally follow each other, but the time marks
+		// could be out of order while the lyrics are edited; then the blocks are scanned one by one.
+		typedef struct
+		{
+			bool				sorted;		// the starts and the ends are both in the block order
+			QVector< qint64 >	starts;
+			QVector< qint64 >	ends;
+			QVector< qint64 >	sungEnds;	// the latest sung time of this and the previous blocks
+		} Timeline;
+
+		Timeline				m_timeline;
+
+		// The next block found last time; the playback mostly stays in the same block or moves to the next one
+		mutable int				m_timelineCursor;
+
 		// Compile a single line
 		void	compileLine( const QString& line, qint64 starttime, qint64 endtime, LyricBlockInfo * binfo, bool *intitle );
 
@@ -132,6 +226,13 @@ class TextRenderer : public LyricsRenderer
         // True if CD+G mode - no antialiasing
         bool                    m_cdgMode;
 
+		// True if the background is left transparent
+		bool					m_transparentBackground;
+		QRect					m_drawnRect;
+
+		// Not owned; null if not measured
+		ExportTelemetry		*	m_telemetry;
+
 		// Rendering params
 		QColor					m_colorBackground;
 		QColor					m_colorTitle;
@@ -145,18 +246,41 @@ class TextRenderer : public LyricsRenderer
 		unsigned int			m_afterDuration;
 		unsigned int			m_prefetchDuration;
 
-		// Handling the preamble stuff
-		int						m_preambleTimeLeft;	// Time left to show the current preamble - 5000 ... 0
-		int						m_lastDrawnPreamble; // Timing when the last time the preamble changed
-		qint64					m_lastSungTime;
-		bool					m_drawPreamble;
-
+		// The state drawn last time; only used to skip the redraws
 		int						m_lastBlockPlayed;
 		int						m_lastPosition;
+		int						m_lastPreambleSquares;
+		int						m_lastWipe;
 
 		// Background events
 		LyricsEvents			m_lyricEvents;
 
+		// Per block, laid out when first drawn; cleared when the lyrics or the render font change
+		QVector< BlockLayout >	m_blockLayouts;
+
+		// Drawn glyphs per QFont::key(); the clones start with the copy
+		QHash< QString, GlyphCache >	m_glyphCache;
+
+		// Character position within the drawn block
+		typedef struct
+		{
+			int		line;
+			int		x;			// start of the advance in the image
+			int		advance;
+		} CharLayout;
+
+		// The block drawn once all in the "to sing" colors and all in the "sang" color; each frame takes
+		// the sang layer up to the sung position and the other one after it. Redrawn when the block
+		// or the rendering params change.
+		int						m_layerBlock;		// -1 - none
+		QImage					m_layerToSing;
+		QImage					m_layerSang;
+		QRect					m_layerRect;		// where the layers are in the image
+		QVector< CharLayout >	m_layerChars;		// per block character, and per line break
+		QVector< int >			m_layerLineBottoms;	// each line takes the layer rows down to its bottom (exclusive)
+
+		bool					m_smoothWipe;
+
 		// Vertical alignment
 		int						m_currentAlignment;
 };
@@ -86,10 +86,72 @@ static VideoFormat video_formats[] =
 
 
 
+// Codec threading each container works with. Frame threading only delays the encoder output,
+// but FLV files written with the threaded encoder were broken, so it is kept single-threaded.
+static const struct
+{
+	const char *	container;
+	unsigned int	threading;
+} container_threading[] =
+{
+	{ "mp4",	VideoEncodingProfile::THREADING_SLICE | VideoEncodingProfile::THREADING_FRAME },
+	{ "mov",	VideoEncodingProfile::THREADING_SLICE | VideoEncodingProfile::THREADING_FRAME },
+	{ "webm",	VideoEncodingProfile::THREADING_SLICE | VideoEncodingProfile::THREADING_FRAME },
+	{ "ogg",	VideoEncodingProfile::THREADING_SLICE | VideoEncodingProfile::THREADING_FRAME },
+	{ "mpeg",	VideoEncodingProfile::THREADING_SLICE | VideoEncodingProfile::THREADING_FRAME },
+	{ "mpegts",	VideoEncodingProfile::THREADING_SLICE | VideoEncodingProfile::THREADING_FRAME },
+	{ "avi",	VideoEncodingProfile::THREADING_SLICE | VideoEncodingProfile::THREADING_FRAME },
+	{ "flv",	0 },
+	{ 0, 0 }
+};
+
+
+// Default speed preset of the codecs which have the presets; the first matching entry is used (type -1
+// matches any). Web videos are re-encoded by the site anyway, so they are encoded faster.
+static const struct
+{
+	const char *	codec;
+	int				type;
+	const char *	preset;
+} codec_presets[] =
+{
+	{ "libx264",	VideoEncodingProfile::TYPE_WEB,	"fast" },
+	{ "libx264",	-1,								"slow" },
+	{ "libx265",	-1,								"medium" },
+	{ 0, 0, 0 }
+};
+
+
+QStringList VideoEncodingProfile::speedPresets() const
+{
+	// Same names for x264 and x265; the slower ones are not worth it for the lyrics video
+	QStringList list;
+
+	if ( !speedPreset.isEmpty() )
+		list << "ultrafast" << "superfast" << "veryfast" << "faster" << "fast" << "medium" << "slow";
+
+	return list;
+}
+
+QStringList VideoEncodingProfile::tunes() const
+{
+	QStringList list;
+
+	if ( videoCodec == "libx264" )
+		list << "animation" << "stillimage";
+	else if ( videoCodec == "libx265" )
+		list << "animation";
+
+	return list;
+}
+
+
 VideoEncodingProfiles::VideoEncodingProfiles()
 {
 	initVideoFormats();
 	initInternalProfiles();
+	initThreading();
+	initPresets();
 }
 
 QStringList VideoEncodingProfiles::videoMediumTypes() const
@@ -284,6 +346,30 @@ void VideoEncodingProfiles::initInternalProfiles()
 	m_videoProfiles[ "MP4 (h.264)" ] = p;
 
 
+	// MPEG-TS (h.264), which could be read while being written
+	p.type = VideoEncodingProfile::TYPE_FILE;
+	p.name = "MPEG-TS (h.264)";
+	p.videoContainer = "mpegts";
+	p.videoCodec = "libx264";
+	p.audioCodec = "aac";
+	p.sampleRate = 48000;
+	p.channels = 2;
+	p.limitFormats.clear();
+	p.bitratesEnabled[ VideoEncodingProfile::BITRATE_LOW ] = true;
+	p.bitratesEnabled[ VideoEncodingProfile::BITRATE_MEDIUM ] = true;
+	p.bitratesEnabled[ VideoEncodingProfile::BITRATE_HIGH ] = true;
+
+	p.bitratesVideo[ VideoEncodingProfile::BITRATE_LOW ] = 384;
+	p.bitratesVideo[ VideoEncodingProfile::BITRATE_MEDIUM ] = 5120;
+	p.bitratesVideo[ VideoEncodingProfile::BITRATE_HIGH ] = 15360;
+
+	p.bitratesAudio[ VideoEncodingProfile::BITRATE_LOW ] = 96;
+	p.bitratesAudio[ VideoEncodingProfile::BITRATE_MEDIUM ] = 128;
+	p.bitratesAudio[ VideoEncodingProfile::BITRATE_HIGH ] = 192;
+
+	m_videoProfiles[ "MPEG-TS (h.264)" ] = p;
+
+
     // MP4 (h.265)
     p.type = VideoEncodingProfile::TYPE_FILE;
     p.name = "MP4 (h.265)";
@@ -728,6 +814,40 @@ void VideoEncodingProfiles::initInternalProfiles()
 	m_videoProfiles[ "YouTube-HD" ] = p;
 }
 
+void VideoEncodingProfiles::initThreading()
+{
+	// Containers not in the table are not threaded
+	for ( QMap< QString, VideoEncodingProfile >::iterator it = m_videoProfiles.begin(); it != m_videoProfiles.end(); ++it )
+	{
+		it.value().threading = 0;
+
+		for ( int i = 0; container_threading[i].container; i++ )
+		{
+			if ( it.value().videoContainer == container_threading[i].container )
+				it.value().threading = container_threading[i].threading;
+		}
+	}
+}
+
+void VideoEncodingProfiles::initPresets()
+{
+	// Codecs not in the table have no presets
+	for ( QMap< QString, VideoEncodingProfile >::iterator it = m_videoProfiles.begin(); it != m_videoProfiles.end(); ++it )
+	{
+		it.value().speedPreset.clear();
+		it.value().tune.clear();
+
+		for ( int i = 0; codec_presets[i].codec; i++ )
+		{
+			if ( it.value().videoCodec == codec_presets[i].codec && (codec_presets[i].type == -1 || codec_presets[i].type == it.value().type) )
+			{
+				it.value().speedPreset = codec_presets[i].preset;
+				break;
+			}
+		}
+	}
+}
+
 void VideoEncodingProfiles::initVideoFormats()
 {
 	for ( VideoFormat * f = video_formats; f->name; f++ )
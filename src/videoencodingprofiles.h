@@ -59,6 +59,13 @@ class VideoEncodingProfile
 			TYPE_WEB
 		};
 
+		// Codec threading allowed for the profile (bitmask)
+		enum
+		{
+			THREADING_SLICE = (1<<0),
+			THREADING_FRAME = (1<<1)
+		};
+
 		Type			type;
 		QString			name;
 
@@ -66,6 +73,9 @@ class VideoEncodingProfile
 		QString			videoContainer;	// i.e. avi, mp4, flv
 		QString			videoCodec;		// i.e. h264, libtheora
 		QStringList		limitFormats;	// limited to specific video encoding params
+		unsigned int	threading;		// THREADING_ flags, from the container compatibility table
+		QString			speedPreset;	// default encoder speed preset; empty if the codec has none
+		QString			tune;			// default encoder tuning; empty for none
 
 		// Audio params
 		QString			audioCodec;		// i.e. ac3, mp3
@@ -76,6 +86,13 @@ class VideoEncodingProfile
 		bool			bitratesEnabled[3];
 		unsigned int	bitratesVideo[3]; // in KILOBYTES
 		unsigned int	bitratesAudio[3]; // in KILOBYTES
+
+		// Encoder speed presets the profile could use, from the fastest; faster presets give
+		// lower quality at the same bitrate. Empty if the codec has no presets.
+		QStringList		speedPresets() const;
+
+		// Encoder tunings suited to the lyrics video (flat colors, mostly unchanged frames)
+		QStringList		tunes() const;
 };
 
 
@@ -102,6 +119,8 @@ class VideoEncodingProfiles
 	private:
 		void	initInternalProfiles();
 		void	initVideoFormats();
+		void	initThreading();
+		void	initPresets();
 
 		QMap< QString, VideoFormat * >			m_videoFormats;
 		QMap< QString, VideoEncodingProfile >	m_videoProfiles;
@@ -0,0 +1,873 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QDir>
+#include <QColor>
+#include <QImage>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QFont>
+#include <QMap>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "videoexportcli.h"
+#include "videogenerator.h"
+#include "videogeneratorthread.h"
+#include "multiexportjob.h"
+#include "exportqueue.h"
+#include "cdggenerator.h"
+#include "videoencodingprofiles.h"
+#include "ffmpegvideoencoder.h"
+#include "textrenderer.h"
+#include "audioplayer.h"
+#include "licensing.h"
+#include "settings.h"
+#include "project.h"
+#include "editor.h"
+#include "lyrics.h"
+
+
+VideoExportCli::VideoExportCli()
+    : QObject()
+{
+    mVideoGeneratorThread = 0;
+    mMultiExportJob = 0;
+    mExportQueue = 0;
+    mQueueFailed = false;
+    mStatus = stdout;
+}
+
+VideoExportCli::~VideoExportCli()
+{
+    delete mVideoGeneratorThread;
+    delete mMultiExportJob;
+    delete mExportQueue;
+}
+
+bool VideoExportCli::isRequested( int argc, char ** argv )
+{
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( !strcmp( argv[i], "--export" ) || !strncmp( argv[i], "--export=", 9 )
+        || !strcmp( argv[i], "--cdg" ) || !strncmp( argv[i], "--cdg=", 6 )
+        || !strcmp( argv[i], "--queue" ) || !strncmp( argv[i], "--queue=", 8 )
+        || !strcmp( argv[i], "--run-queue" ) || !strcmp( argv[i], "--list-queue" ) || !strcmp( argv[i], "--clear-queue" )
+        || !strcmp( argv[i], "--list-profiles" ) || !strcmp( argv[i], "--benchmark-presets" )
+        || !strcmp( argv[i], "--check-profiles" ) || !strncmp( argv[i], "--check-profiles=", 17 )
+        || !strcmp( argv[i], "--check-renderer" ) )
+            return true;
+    }
+
+    return false;
+}
+
+static int printError( const QString& msg )
+{
+    fprintf( stderr, "%s\n", qPrintable( msg ) );
+    return 1;
+}
+
+// Looks up and checks the video parameters; returns the error message if they could not be used
+static QString videoTarget( const QString& profilename, const QString& formatname, const QString& qualityname,
+                            const QString& preset, const QString& tune,
+                            const VideoEncodingProfile ** profile, const VideoFormat ** format, unsigned int * quality )
+{
+    *profile = pVideoEncodingProfiles->videoProfile( profilename );
+
+    if ( !*profile )
+        return QString("Unknown video profile %1, see --list-profiles") .arg( profilename );
+
+    *format = pVideoEncodingProfiles->videoFormat( formatname );
+
+    if ( !*format )
+        return QString("Unknown video format %1, see --list-profiles") .arg( formatname );
+
+    if ( !(*profile)->limitFormats.empty() && !(*profile)->limitFormats.contains( formatname ) )
+        return QString("Video format %1 is not supported by profile %2") .arg( formatname ) .arg( profilename );
+
+    if ( qualityname.toLower() == "low" )
+        *quality = VideoEncodingProfile::BITRATE_LOW;
+    else if ( qualityname.toLower() == "medium" )
+        *quality = VideoEncodingProfile::BITRATE_MEDIUM;
+    else if ( qualityname.toLower() == "high" )
+        *quality = VideoEncodingProfile::BITRATE_HIGH;
+    else
+        return QString("Invalid quality %1") .arg( qualityname );
+
+    if ( !(*profile)->bitratesEnabled[*quality] )
+        return QString("Quality %1 is not supported by profile %2") .arg( qualityname ) .arg( profilename );
+
+    if ( !preset.isEmpty() && !(*profile)->speedPresets().contains( preset ) )
+        return QString("Preset %1 is not supported by profile %2, see --list-profiles") .arg( preset ) .arg( profilename );
+
+    if ( !tune.isEmpty() && !(*profile)->tunes().contains( tune ) )
+        return QString("Tuning %1 is not supported by profile %2, see --list-profiles") .arg( tune ) .arg( profilename );
+
+    return QString();
+}
+
+// The n-th value of the repeated option, or the last one given, or the default
+static QString optionValue( const QStringList& values, int index, const QString& defaultValue )
+{
+    if ( values.isEmpty() )
+        return defaultValue;
+
+    return values.at( qMin( index, values.size() - 1 ) );
+}
+
+int VideoExportCli::exec( const QStringList& arguments )
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Exports the karaoke project into a video file without GUI" );
+    parser.addHelpOption();
+    parser.addPositionalArgument( "project", "Project file (.kleproj) to export" );
+
+    QCommandLineOption optExport( "export", "Output video file name; could be repeated to export several videos at once, the n-th --profile, --format, --quality and --preset are then for the n-th video (the last one given for the rest)", "file" );
+    QCommandLineOption optCDG( "cdg", "Also export the CD+G file (with the project CD+G settings) together with the videos", "file" );
+    QCommandLineOption optProfile( "profile", "Video encoding profile, i.e. \"MP4 (h.264)\"", "name", "MP4 (h.264)" );
+    QCommandLineOption optFormat( "format", "Video format, i.e. \"HD 1080p 25 fps\"", "name", "HD 1080p 25 fps" );
+    QCommandLineOption optQuality( "quality", "Encoding quality: low, medium or high", "quality", "high" );
+    QCommandLineOption optNoAudio( "no-audio", "Do not add the audio stream" );
+    QCommandLineOption optAudioCopy( "audio-copy", "Copy the audio from the music file without re-encoding if the container supports its codec" );
+    QCommandLineOption optFont( "font", "Font family (overrides the project)", "family" );
+    QCommandLineOption optFontSize( "fontsize", "Font size, 0 to autodetect (overrides the project)", "size" );
+    QCommandLineOption optBgColor( "bgcolor", "Background color (overrides the project)", "color" );
+    QCommandLineOption optInfoColor( "infocolor", "Title color (overrides the project)", "color" );
+    QCommandLineOption optActiveColor( "activecolor", "Not yet sung text color (overrides the project)", "color" );
+    QCommandLineOption optInactiveColor( "inactivecolor", "Sung text color (overrides the project)", "color" );
+    QCommandLineOption optArtist( "artist", "Artist shown on title page (overrides the project)", "text" );
+    QCommandLineOption optTitle( "title", "Song title shown on title page (overrides the project)", "text" );
+    QCommandLineOption optCreatedBy( "createdby", "Created by text shown on title page", "text" );
+    QCommandLineOption optPipelineDepth( "pipeline-depth", "Frames queued between render, conversion and encoding threads; 0 to run serially", "frames" );
+    QCommandLineOption optRenderThreads( "render-threads", "Threads rendering the lyrics when pipelined", "threads" );
+    QCommandLineOption optSegmentThreads( "segment-threads", "Encode video segments in parallel threads, stitched without re-encoding; 0 to disable", "threads" );
+    QCommandLineOption optVfr( "vfr", "Variable frame rate (MP4/MOV/WebM): encode unchanged frames only every given ms", "keepalive ms" );
+    QCommandLineOption optSmoothWipe( "smooth-wipe", "Wipe the sung color through each character during its time instead of coloring it at once" );
+    QCommandLineOption optPreset( "preset", "Encoder speed preset, i.e. ultrafast or slow (default depends on the profile, see --list-profiles)", "name" );
+    QCommandLineOption optTune( "tune", "Encoder tuning, i.e. animation or stillimage (see --list-profiles)", "name" );
+    QCommandLineOption optBenchmarkPresets( "benchmark-presets", "Encode the project video (first minute, no audio) with every speed preset of the profile, print the frame rate and bitrate of each, and exit" );
+    QCommandLineOption optStream( "stream", "Write the video sequentially (fragmented MP4/MOV), so it could be read while being written; always so for pipes and - (standard output)" );
+    QCommandLineOption optResume( "resume", "Keep the encoded segments in <output file>.checkpoint until the export succeeds, and resume an interrupted export from them" );
+    QCommandLineOption optIncremental( "incremental", "Same as --resume, but keep the segments after the export succeeds, so the next export only encodes the segments where the lyrics changed" );
+    QCommandLineOption optReport( "report", "Write the per-stage timing of the export into a JSON file", "file" );
+    QCommandLineOption optListProfiles( "list-profiles", "List supported video profiles and formats, and exit" );
+    QCommandLineOption optQueue( "queue", "Add the export of the saved project (with its own video settings) to the export queue shared with the GUI, and exit; the fonts and colors could not be overridden", "file" );
+    QCommandLineOption optRunQueue( "run-queue", "Run the queued exports, several at once sharing the cores, until none is left" );
+    QCommandLineOption optJobs( "jobs", "How many queued exports run at once (overrides the settings)", "count" );
+    QCommandLineOption optListQueue( "list-queue", "List the queued exports and their state, and exit" );
+    QCommandLineOption optClearQueue( "clear-queue", "Remove the finished, failed and aborted exports from the queue, and exit" );
+    QCommandLineOption optCheckProfiles( "check-profiles", "Encode a short test video with every profile into the directory, verify it decodes, and exit", "directory" );
+    QCommandLineOption optCheckRenderer( "check-renderer", "Render a test song and verify the sung and not yet sung colors, and exit" );
+
+    parser.addOptions( { optExport, optCDG, optProfile, optFormat, optQuality, optNoAudio, optAudioCopy,
+                         optFont, optFontSize, optBgColor, optInfoColor, optActiveColor, optInactiveColor,
+                         optArtist, optTitle, optCreatedBy, optPipelineDepth, optRenderThreads, optSegmentThreads, optVfr, optSmoothWipe, optPreset, optTune, optBenchmarkPresets, optStream, optResume, optIncremental, optReport, optListProfiles, optCheckProfiles, optCheckRenderer,
+                         optQueue, optRunQueue, optJobs, optListQueue, optClearQueue } );
+
+    if ( !parser.parse( arguments ) )
+        return printError( parser.errorText() );
+
+    if ( parser.isSet( "help" ) )
+    {
+        printf( "%s", qPrintable( parser.helpText() ) );
+        return 0;
+    }
+
+    // Global objects which are normally created by the main window
+    pSettings = new Settings();
+    pVideoEncodingProfiles = new VideoEncodingProfiles();
+    pLicensing = new Licensing();
+
+    if ( pLicensing->init() )
+        pLicensing->validate( QSettings().value( "general/registrationkey", "" ).toString() );
+
+    if ( parser.isSet( optListProfiles ) )
+    {
+        printf( "Profiles:\n" );
+
+        Q_FOREACH ( QString name, pVideoEncodingProfiles->videoProfiles() )
+        {
+            const VideoEncodingProfile * profile = pVideoEncodingProfiles->videoProfile( name );
+            printf( "  %s\n", qPrintable( name ) );
+
+            if ( !profile->speedPreset.isEmpty() )
+                printf( "      presets: %s (default %s); tunes: %s\n",
+                        qPrintable( profile->speedPresets().join( ", " ) ),
+                        qPrintable( profile->speedPreset ),
+                        qPrintable( profile->tunes().join( ", " ) ) );
+        }
+
+        printf( "Formats:\n" );
+
+        Q_FOREACH ( QString name, pVideoEncodingProfiles->videoFormats() )
+            printf( "  %s\n", qPrintable( name ) );
+
+        return 0;
+    }
+
+    if ( parser.isSet( optCheckProfiles ) )
+        return checkProfiles( parser.value( optCheckProfiles ) );
+
+    if ( parser.isSet( optCheckRenderer ) )
+        return checkRenderer();
+
+    if ( parser.isSet( optListQueue ) )
+        return listQueue();
+
+    if ( parser.isSet( optClearQueue ) )
+    {
+        ExportQueue queue;
+        queue.clearDone();
+        return 0;
+    }
+
+    if ( parser.isSet( optRunQueue ) )
+        return runQueue( parser.isSet( optJobs ) ? parser.value( optJobs ).toInt() : 0 );
+
+    if ( parser.isSet( optQueue ) )
+        return queueExport( parser );
+
+    if ( parser.positionalArguments().size() != 1 || (parser.value( optExport ).isEmpty() && !parser.isSet( optCDG ) && !parser.isSet( optBenchmarkPresets )) )
+        return printError( "Usage: karlyriceditor --export <output file> [options] <project.kleproj>" );
+
+    // Several videos, or the CD+G file, are exported in one pass
+    bool multiple = parser.values( optExport ).size() > 1 || parser.isSet( optCDG );
+
+    if ( multiple && (parser.isSet( optBenchmarkPresets ) || parser.isSet( optResume ) || parser.isSet( optIncremental ) || parser.isSet( optReport )) )
+        return printError( "Several files could not be benchmarked, resumed or reported at once" );
+
+    if ( multiple && parser.values( optExport ).contains( "-" ) )
+        return printError( "Only a single video could be exported to the standard output" );
+
+    // Video parameters
+    const VideoEncodingProfile * profile;
+    const VideoFormat * format;
+    unsigned int quality;
+    QString targetError = videoTarget( parser.value( optProfile ), parser.value( optFormat ), parser.value( optQuality ),
+                                       parser.value( optPreset ), parser.value( optTune ), &profile, &format, &quality );
+
+    if ( !multiple && !targetError.isEmpty() )
+        return printError( targetError );
+
+    bool checkpoint = parser.isSet( optResume ) || parser.isSet( optIncremental );
+
+    if ( checkpoint && parser.value( optExport ) == "-" )
+        return printError( "The export to the standard output could not be resumed" );
+
+    if ( parser.isSet( optBenchmarkPresets ) && profile->speedPresets().isEmpty() )
+        return printError( QString("Profile %1 has no speed presets") .arg( profile->name ) );
+
+    // Load the project; there is no editor, so lyrics stay in the project data
+    QString projectFile = parser.positionalArguments().first();
+    Project project( 0 );
+
+    if ( !project.load( projectFile ) )
+        return 1;
+
+    Lyrics lyrics;
+    Editor::exportLyricsFromString( project.lyricsText(), &lyrics );
+
+    if ( lyrics.isEmpty() )
+        return printError( QString("Project %1 contains no lyrics") .arg( projectFile ) );
+
+    // Music file is relative to the project location
+    QString musicFile = QFileInfo( projectFile ).absoluteDir().absoluteFilePath( project.musicFile() );
+
+    pAudioPlayer = new AudioPlayer();
+    pAudioPlayer->init();
+
+    if ( !pAudioPlayer->open( musicFile, false ) )
+        return printError( QString("Cannot open music file %1: %2") .arg( musicFile ) .arg( pAudioPlayer->errorMsg() ) );
+
+    qint64 total_length = pAudioPlayer->totalTime();
+    project.setSongLength( total_length );
+
+    if ( parser.isSet( optSmoothWipe ) )
+        pSettings->m_videoExportSmoothWipe = true;
+
+    // Command-line overrides of the project tags (the project is never saved)
+    if ( parser.isSet( optFont ) )
+        project.setTag( Project::Tag_Video_font, parser.value( optFont ) );
+
+    if ( parser.isSet( optFontSize ) )
+        project.setTag( Project::Tag_Video_fontsize, parser.value( optFontSize ) );
+
+    if ( parser.isSet( optBgColor ) )
+        project.setTag( Project::Tag_Video_bgcolor, parser.value( optBgColor ) );
+
+    if ( parser.isSet( optInfoColor ) )
+        project.setTag( Project::Tag_Video_infocolor, parser.value( optInfoColor ) );
+
+    if ( parser.isSet( optActiveColor ) )
+        project.setTag( Project::Tag_Video_activecolor, parser.value( optActiveColor ) );
+
+    if ( parser.isSet( optInactiveColor ) )
+        project.setTag( Project::Tag_Video_inactivecolor, parser.value( optInactiveColor ) );
+
+    QString artist = parser.isSet( optArtist ) ? parser.value( optArtist ) : project.tag( Project::Tag_Artist, "" );
+    QString title = parser.isSet( optTitle ) ? parser.value( optTitle ) : project.tag( Project::Tag_Title, "" );
+
+    if ( multiple )
+        return exportMultiple( parser, &project, lyrics, total_length, artist, title );
+
+    TextRenderer * lyricrenderer = VideoGenerator::createRenderer( &project, lyrics, format, artist, title, parser.value( optCreatedBy ) );
+
+    if ( parser.isSet( optBenchmarkPresets ) )
+    {
+        int ret = benchmarkPresets( profile, format, quality, parser.value( optTune ), lyricrenderer, total_length );
+        delete lyricrenderer;
+        return ret;
+    }
+
+    // Video encoder
+    int segmentThreads = parser.isSet( optSegmentThreads ) ? parser.value( optSegmentThreads ).toInt() : pSettings->m_videoExportSegmentThreads;
+
+    int vfrKeepalive = parser.isSet( optVfr ) ? parser.value( optVfr ).toInt() : pSettings->m_videoExportVfrKeepalive;
+
+    if ( vfrKeepalive > 0 && !FFMpegVideoEncoder::supportsVariableFrameRate( profile ) )
+    {
+        delete lyricrenderer;
+        return printError( QString("Profile %1 does not support variable frame rate") .arg( profile->name ) );
+    }
+
+    FFMpegVideoEncoder * encoder = new FFMpegVideoEncoder();
+    encoder->setSegmentable( segmentThreads > 1 || checkpoint );
+    encoder->setVariableFrameRate( qMax( 0, vfrKeepalive ) );
+    encoder->setAudioCopy( parser.isSet( optAudioCopy ) );
+    encoder->setSpeedPreset( parser.value( optPreset ), parser.value( optTune ) );
+    encoder->setStreaming( parser.isSet( optStream ) );
+
+    // The video itself goes to the standard output, so the status is printed on the error output
+    if ( parser.value( optExport ) == "-" )
+        mStatus = stderr;
+
+    // Calculate the time step for rendering
+    qint64 time_step = (1000 * format->frame_rate_num) / format->frame_rate_den;
+
+    // The thread measures the encoder stages, so it is created before the file
+    mVideoGeneratorThread = new VideoGeneratorThread( encoder, lyricrenderer, total_length, time_step );
+
+    QString errmsg = encoder->createFile( parser.value( optExport ),
+                                          profile,
+                                          format,
+                                          quality,
+                                          parser.isSet( optNoAudio ) ? 0 : pAudioPlayer );
+
+    if ( !errmsg.isEmpty() )
+    {
+        // Also deletes the encoder and the renderer
+        delete mVideoGeneratorThread;
+        mVideoGeneratorThread = 0;
+        return printError( QString("Cannot create video file: %1") .arg( errmsg ) );
+    }
+
+    if ( parser.isSet( optAudioCopy ) && !parser.isSet( optNoAudio ) && !encoder->isAudioCopied() )
+        fprintf( mStatus, "The music file codec cannot be stored in this container, the audio is encoded\n" );
+
+    if ( parser.isSet( optReport ) )
+        mVideoGeneratorThread->setReportFile( parser.value( optReport ) );
+
+    if ( checkpoint )
+    {
+        QStringList params;
+        params << profile->name << format->name << QString::number( quality ) << QString::number( total_length )
+               << parser.value( optPreset ) << parser.value( optTune ) << QString::number( vfrKeepalive )
+               << artist << title << parser.value( optCreatedBy );
+
+        mVideoGeneratorThread->setCheckpoint( parser.value( optExport ) + ".checkpoint", VideoGenerator::exportFingerprint( &project, params ), parser.isSet( optIncremental ) );
+    }
+
+    mVideoGeneratorThread->setPipelineDepth( parser.isSet( optPipelineDepth ) ? parser.value( optPipelineDepth ).toInt() : pSettings->m_videoExportPipelineDepth );
+    mVideoGeneratorThread->setRenderThreads( parser.isSet( optRenderThreads ) ? parser.value( optRenderThreads ).toInt() : pSettings->m_videoExportRenderThreads );
+    mVideoGeneratorThread->setSegmentThreads( segmentThreads );
+
+    connect( mVideoGeneratorThread, SIGNAL( finished(QString)), this, SLOT(finished(QString)), Qt::QueuedConnection );
+    connect( mVideoGeneratorThread, SIGNAL( progress(int, QString, QString, QString, QString)), this, SLOT(progress(int, QString, QString, QString, QString)), Qt::QueuedConnection );
+
+    mVideoGeneratorThread->start();
+
+    // Returns when finished() is called
+    return QCoreApplication::exec();
+}
+
+int VideoExportCli::queueExport( const QCommandLineParser& parser )
+{
+    if ( parser.positionalArguments().size() != 1 )
+        return printError( "Usage: karlyriceditor --queue <output file> [options] <project.kleproj>" );
+
+    if ( parser.value( "queue" ) == "-" )
+        return printError( "The queued export could not be written to the standard output" );
+
+    const VideoEncodingProfile * profile;
+    const VideoFormat * format;
+    unsigned int quality;
+    QString targetError = videoTarget( parser.value( "profile" ), parser.value( "format" ), parser.value( "quality" ),
+                                       parser.value( "preset" ), parser.value( "tune" ), &profile, &format, &quality );
+
+    if ( !targetError.isEmpty() )
+        return printError( targetError );
+
+    // The project is exported when the job runs; it is only checked here
+    QString projectFile = QFileInfo( parser.positionalArguments().first() ).absoluteFilePath();
+    Project project( 0 );
+
+    if ( !project.load( projectFile ) )
+        return 1;
+
+    if ( project.lyricsText().isEmpty() )
+        return printError( QString("Project %1 contains no lyrics") .arg( projectFile ) );
+
+    ExportQueue::Job job;
+    job.projectFile = projectFile;
+    job.outputFile = QFileInfo( parser.value( "queue" ) ).absoluteFilePath();
+    job.profile = profile->name;
+    job.format = format->name;
+    job.quality = quality;
+    job.audioMode = parser.isSet( "no-audio" ) ? 2 : (parser.isSet( "audio-copy" ) ? 1 : 0);
+    job.speedPreset = parser.value( "preset" );
+    job.tune = parser.value( "tune" );
+    job.artist = parser.isSet( "artist" ) ? parser.value( "artist" ) : project.tag( Project::Tag_Artist, "" );
+    job.title = parser.isSet( "title" ) ? parser.value( "title" ) : project.tag( Project::Tag_Title, "" );
+    job.createdBy = parser.value( "createdby" );
+
+    ExportQueue queue;
+    int id = queue.addJob( job );
+
+    fprintf( mStatus, "Queued export %d: %s\n", id, qPrintable( job.outputFile ) );
+    return 0;
+}
+
+int VideoExportCli::runQueue( int jobs )
+{
+    mExportQueue = new ExportQueue();
+
+    if ( jobs > 0 )
+        mExportQueue->setMaxJobs( jobs );
+
+    int queued = 0;
+
+    Q_FOREACH ( const ExportQueue::Job& job, mExportQueue->jobs() )
+    {
+        if ( job.state == ExportQueue::StateQueued )
+            queued++;
+    }
+
+    if ( queued == 0 )
+    {
+        fprintf( mStatus, "No queued exports\n" );
+        return 0;
+    }
+
+    fprintf( mStatus, "Exporting %d queued videos, %d at once\n", queued, mExportQueue->maxJobs() );
+
+    connect( mExportQueue, SIGNAL(progress(int, int, QString, QString, QString, QString)), this, SLOT(queueProgress(int, int, QString, QString, QString, QString)) );
+    connect( mExportQueue, SIGNAL(jobChanged(int)), this, SLOT(queueJobChanged(int)) );
+    connect( mExportQueue, SIGNAL(idle()), this, SLOT(queueIdle()) );
+
+    // Started from the event loop, so it could be quit even if no job could be started
+    QMetaObject::invokeMethod( mExportQueue, "start", Qt::QueuedConnection );
+    return QCoreApplication::exec();
+}
+
+int VideoExportCli::listQueue()
+{
+    ExportQueue queue;
+
+    Q_FOREACH ( const ExportQueue::Job& job, queue.jobs() )
+    {
+        printf( "%4d  %-8s  %s\n      %s, %s\n      project %s\n",
+                job.id,
+                qPrintable( ExportQueue::stateName( job.state ) ),
+                qPrintable( job.outputFile ),
+                qPrintable( job.profile ),
+                qPrintable( job.format ),
+                qPrintable( job.projectFile ) );
+
+        if ( !job.errorMsg.isEmpty() )
+            printf( "      %s\n", qPrintable( job.errorMsg ) );
+    }
+
+    return 0;
+}
+
+int VideoExportCli::exportMultiple( const QCommandLineParser& parser, Project * project, const Lyrics& lyrics, qint64 total_length,
+                                    const QString& artist, const QString& title )
+{
+    QStringList exports = parser.values( "export" );
+    QString createdBy = parser.value( "createdby" );
+    int segmentThreads = parser.isSet( "segment-threads" ) ? parser.value( "segment-threads" ).toInt() : pSettings->m_videoExportSegmentThreads;
+    int vfrKeepalive = parser.isSet( "vfr" ) ? parser.value( "vfr" ).toInt() : pSettings->m_videoExportVfrKeepalive;
+
+    mMultiExportJob = new MultiExportJob();
+
+    // The lyrics are laid out once for every video size, the videos of the same size use the copies
+    QMap< QString, TextRenderer * > renderers;
+
+    for ( int i = 0; i < exports.size(); i++ )
+    {
+        const VideoEncodingProfile * profile;
+        const VideoFormat * format;
+        unsigned int quality;
+        QString preset = optionValue( parser.values( "preset" ), i, QString() );
+
+        QString targetError = videoTarget( optionValue( parser.values( "profile" ), i, "MP4 (h.264)" ),
+                                           optionValue( parser.values( "format" ), i, "HD 1080p 25 fps" ),
+                                           optionValue( parser.values( "quality" ), i, "high" ),
+                                           preset, parser.value( "tune" ), &profile, &format, &quality );
+
+        if ( targetError.isEmpty() && vfrKeepalive > 0 && !FFMpegVideoEncoder::supportsVariableFrameRate( profile ) )
+            targetError = QString("Profile %1 does not support variable frame rate") .arg( profile->name );
+
+        if ( !targetError.isEmpty() )
+            return printError( QString("%1: %2") .arg( exports[i] ) .arg( targetError ) );
+
+        QString size = QString("%1x%2") .arg( format->width ) .arg( format->height );
+        TextRenderer * lyricrenderer;
+
+        if ( renderers.contains( size ) )
+            lyricrenderer = renderers[ size ]->clone();
+        else
+        {
+            lyricrenderer = VideoGenerator::createRenderer( project, lyrics, format, artist, title, createdBy );
+            renderers[ size ] = lyricrenderer;
+        }
+
+        FFMpegVideoEncoder * encoder = new FFMpegVideoEncoder();
+        encoder->setSegmentable( segmentThreads > 1 );
+        encoder->setVariableFrameRate( qMax( 0, vfrKeepalive ) );
+        encoder->setAudioCopy( parser.isSet( "audio-copy" ) );
+        encoder->setSpeedPreset( preset, parser.value( "tune" ) );
+        encoder->setStreaming( parser.isSet( "stream" ) );
+
+        VideoGeneratorThread * thread = mMultiExportJob->addVideo( encoder, lyricrenderer, total_length, exports[i],
+                                                                   profile, format, quality, parser.isSet( "audio-copy" ) );
+
+        thread->setPipelineDepth( parser.isSet( "pipeline-depth" ) ? parser.value( "pipeline-depth" ).toInt() : pSettings->m_videoExportPipelineDepth );
+        thread->setRenderThreads( parser.isSet( "render-threads" ) ? parser.value( "render-threads" ).toInt() : pSettings->m_videoExportRenderThreads );
+        thread->setSegmentThreads( segmentThreads );
+    }
+
+    // The dialog defaults: normal weight, anti-aliased
+    if ( parser.isSet( "cdg" ) )
+        mMultiExportJob->addCDG( new CDGGenerator( project ), lyrics, total_length, parser.value( "cdg" ),
+                                 artist, title, createdBy, QFont::Normal, true );
+
+    QString errmsg = mMultiExportJob->createFiles( parser.isSet( "no-audio" ) ? 0 : pAudioPlayer );
+
+    if ( !errmsg.isEmpty() )
+        return printError( QString("Cannot create video file %1") .arg( errmsg ) );
+
+    if ( mMultiExportJob->sharedAudioCount() > 0 )
+        fprintf( mStatus, "%d of %d videos mux the audio encoded for another one\n", mMultiExportJob->sharedAudioCount(), (int) exports.size() );
+
+    connect( mMultiExportJob, SIGNAL( finished(QString)), this, SLOT(finished(QString)), Qt::QueuedConnection );
+    connect( mMultiExportJob, SIGNAL( progress(QString, int, QString, QString, QString, QString)), this, SLOT(progress(QString, int, QString, QString, QString, QString)), Qt::QueuedConnection );
+
+    mMultiExportJob->start();
+
+    // Returns when finished() is called
+    return QCoreApplication::exec();
+}
+
+int VideoExportCli::checkProfiles( const QString& directory )
+{
+    int failed = 0;
+
+    if ( !QDir().mkpath( directory ) )
+        return printError( QString("Cannot create directory %1") .arg( directory ) );
+
+    Q_FOREACH ( QString name, pVideoEncodingProfiles->videoProfiles() )
+    {
+        const VideoEncodingProfile * profile = pVideoEncodingProfiles->videoProfile( name );
+
+        if ( !FFMpegVideoEncoder::isVideoCodecAvailable( profile ) )
+        {
+            printf( "SKIP  %s: codec %s is not available\n", qPrintable( name ), qPrintable( profile->videoCodec ) );
+            continue;
+        }
+
+        // Use the profile's own format if it is limited
+        QString formatname = profile->limitFormats.isEmpty() ? "HD 720p 25 fps" : profile->limitFormats.first();
+        const VideoFormat * format = pVideoEncodingProfiles->videoFormat( formatname );
+
+        if ( !format )
+        {
+            printf( "FAIL  %s: unknown video format %s\n", qPrintable( name ), qPrintable( formatname ) );
+            fflush( stdout );
+            failed++;
+            continue;
+        }
+
+        unsigned int quality = VideoEncodingProfile::BITRATE_HIGH;
+
+        while ( quality > 0 && !profile->bitratesEnabled[quality] )
+            quality--;
+
+        QString filename = QDir( directory ).absoluteFilePath( QString( name ).replace( QRegularExpression( "[^A-Za-z0-9.-]" ), "_" ) + "." + profile->videoContainer );
+        FFMpegVideoEncoder encoder;
+        QString errmsg = encoder.createFile( filename, profile, format, quality, 0 );
+
+        // Two seconds of changing frames, so all encoder threads are busy
+        int frames = 2 * format->frame_rate_den / format->frame_rate_num;
+        qint64 time_step = (1000 * format->frame_rate_num) / format->frame_rate_den;
+        QImage image( format->width, format->height, QImage::Format_ARGB32 );
+
+        for ( int i = 0; errmsg.isEmpty() && i < frames; i++ )
+        {
+            image.fill( QColor::fromHsv( (i * 360) / frames, 255, 255 ) );
+
+            if ( encoder.encodeImage( image, i * time_step ) < 0 )
+                errmsg = QString("Encoding error at frame %1") .arg( i );
+        }
+
+        if ( errmsg.isEmpty() )
+        {
+            encoder.close();
+            errmsg = FFMpegVideoEncoder::verifyFile( filename, frames );
+        }
+
+        if ( errmsg.isEmpty() )
+            printf( "OK    %s: %s\n", qPrintable( name ), qPrintable( filename ) );
+        else
+        {
+            printf( "FAIL  %s: %s\n", qPrintable( name ), qPrintable( errmsg ) );
+            failed++;
+        }
+
+        fflush( stdout );
+    }
+
+    return failed > 0 ? 1 : 0;
+}
+
+int VideoExportCli::checkRenderer()
+{
+    // One line sung from 1s; its last timing at 2s is past the text, and the block is kept until 7s
+    Lyrics lyrics;
+    lyrics.beginLyrics();
+    lyrics.curLyricSetTime( 1000 );
+    lyrics.curLyricAppendText( "Sing " );
+    lyrics.curLyricAdd();
+    lyrics.curLyricSetTime( 1500 );
+    lyrics.curLyricAppendText( "along" );
+    lyrics.curLyricAdd();
+    lyrics.curLyricSetTime( 2000 );
+    lyrics.curLyricAddEndOfLine();
+    lyrics.endLyrics();
+
+    QRgb tosing = qRgb( 0, 0, 255 );
+    QRgb sang = qRgb( 0, 255, 0 );
+
+    typedef struct
+    {
+        const char *    name;
+        qint64          time;
+        bool            smoothWipe;
+    } RendererCheck;
+
+    const RendererCheck checks[] =
+    {
+        { "after the last syllable", 2000, false },
+        { "after the last syllable, smooth wipe", 2000, true },
+        { "in the post-delay", 3000, false },
+        { "in the post-delay, smooth wipe", 3000, true },
+    };
+
+    int failed = 0;
+
+    for ( unsigned int i = 0; i < sizeof( checks ) / sizeof( checks[0] ); i++ )
+    {
+        TextRenderer renderer( 640, 360 );
+        renderer.setLyrics( lyrics );
+        renderer.setRenderFont( QFont( "arial", 24 ) );
+        renderer.setColorBackground( Qt::black );
+        renderer.setColorToSing( QColor( tosing ) );
+        renderer.setColorSang( QColor( sang ) );
+        renderer.setSmoothWipe( checks[i].smoothWipe );
+        renderer.update( checks[i].time );
+
+        // The glyphs are anti-aliased, so only their solid insides are counted
+        QImage image = renderer.image();
+        int sangpixels = 0, tosingpixels = 0;
+
+        for ( int y = 0; y < image.height(); y++ )
+        {
+            const QRgb * line = (const QRgb *) image.constScanLine( y );
+
+            for ( int x = 0; x < image.width(); x++ )
+            {
+                QRgb color = line[x] | 0xFF000000;
+
+                if ( color == sang )
+                    sangpixels++;
+                else if ( color == tosing )
+                    tosingpixels++;
+            }
+        }
+
+        if ( sangpixels > 0 && tosingpixels == 0 )
+            printf( "OK    %s\n", checks[i].name );
+        else
+        {
+            printf( "FAIL  %s: %d sung and %d not yet sung pixels\n", checks[i].name, sangpixels, tosingpixels );
+            failed++;
+        }
+    }
+
+    fflush( stdout );
+    return failed > 0 ? 1 : 0;
+}
+
+int VideoExportCli::benchmarkPresets( const VideoEncodingProfile * profile, const VideoFormat * format, unsigned int quality,
+                                     const QString& tune, TextRenderer * renderer, qint64 total_length )
+{
+    QTemporaryDir tempdir;
+
+    if ( !tempdir.isValid() )
+        return printError( "Cannot create the temporary directory" );
+
+    // The first minute is enough to compare the presets
+    qint64 length = qMin( total_length, (qint64) 60000 );
+    qint64 time_step = (1000 * format->frame_rate_num) / format->frame_rate_den;
+
+    printf( "%s, %s, %d frames%s\n", qPrintable( profile->name ), format->name, (int) (length / time_step),
+            tune.isEmpty() ? "" : qPrintable( QString(", tuned for %1") .arg( tune ) ) );
+    printf( "%-12s %10s %12s\n", "preset", "fps", "kbit/s" );
+
+    Q_FOREACH ( QString preset, profile->speedPresets() )
+    {
+        QString filename = tempdir.filePath( preset + "." + profile->videoContainer );
+        FFMpegVideoEncoder encoder;
+        encoder.setSpeedPreset( preset, tune );
+
+        QString errmsg = encoder.createFile( filename, profile, format, quality, 0 );
+
+        if ( !errmsg.isEmpty() )
+            return printError( QString("Cannot create video file: %1") .arg( errmsg ) );
+
+        // Rendered the same way as exported, but serially
+        TextRenderer * lyricrenderer = renderer->clone();
+        bool layer = lyricrenderer->setTransparentBackground( true );
+        QColor background = lyricrenderer->backgroundColor();
+        QElapsedTimer timer;
+        int frames = 0, size = 0;
+
+        timer.start();
+
+        for ( qint64 time = 0; time < length && size >= 0; time += time_step, frames++ )
+        {
+            bool changed = lyricrenderer->update( time ) != LyricsRenderer::UPDATE_NOCHANGE;
+
+            if ( layer )
+                size = encoder.encodeLayer( lyricrenderer->image(), lyricrenderer->drawnRect(), background, time, changed );
+            else
+                size = encoder.encodeImage( lyricrenderer->image(), time, changed );
+        }
+
+        delete lyricrenderer;
+
+        if ( size < 0 || !encoder.close() )
+            return printError( QString("Encoding error with preset %1") .arg( preset ) );
+
+        qint64 elapsed = qMax( (qint64) 1, timer.elapsed() );
+        qint64 bytes = QFileInfo( filename ).size();
+
+        printf( "%-12s %10.1f %12lld\n", qPrintable( preset ), frames * 1000.0 / elapsed, (long long) (bytes * 8 / qMax( (qint64) 1, length )) );
+        fflush( stdout );
+
+        QFile::remove( filename );
+    }
+
+    return 0;
+}
+
+void VideoExportCli::progress( int progress, QString frames, QString size, QString timing, QString speed )
+{
+    fprintf( mStatus, "%3d%%  frames %s, %s, %s, %s\n", progress, qPrintable( frames ), qPrintable( size ), qPrintable( timing ), qPrintable( speed ) );
+    fflush( mStatus );
+}
+
+void VideoExportCli::progress( QString filename, int progress, QString frames, QString size, QString timing, QString speed )
+{
+    fprintf( mStatus, "%s: %3d%%  frames %s, %s, %s, %s\n", qPrintable( filename ), progress, qPrintable( frames ), qPrintable( size ), qPrintable( timing ), qPrintable( speed ) );
+    fflush( mStatus );
+}
+
+void VideoExportCli::queueProgress( int id, int progress, QString frames, QString size, QString timing, QString speed )
+{
+    Q_FOREACH ( const ExportQueue::Job& job, mExportQueue->jobs() )
+    {
+        if ( job.id == id )
+            this->progress( job.outputFile, progress, frames, size, timing, speed );
+    }
+}
+
+void VideoExportCli::queueJobChanged( int id )
+{
+    // Reported once the job is done; while running it only changes the progress
+    Q_FOREACH ( const ExportQueue::Job& job, mExportQueue->jobs() )
+    {
+        if ( job.id != id || job.state == ExportQueue::StateQueued || job.state == ExportQueue::StateRunning )
+            continue;
+
+        if ( job.state == ExportQueue::StateFinished )
+            fprintf( mStatus, "%s: Done\n", qPrintable( job.outputFile ) );
+        else
+        {
+            printError( QString( "%1: %2" ) .arg( job.outputFile ) .arg( job.errorMsg ) );
+            mQueueFailed = true;
+        }
+    }
+}
+
+void VideoExportCli::queueIdle()
+{
+    QCoreApplication::exit( mQueueFailed ? 1 : 0 );
+}
+
+void VideoExportCli::finished( QString errormsg )
+{
+    // Make sure the encoder is closed and the thread is gone before we quit; the export job
+    // waits for its threads when deleted
+    if ( mVideoGeneratorThread )
+    {
+        mVideoGeneratorThread->wait();
+
+        if ( !mVideoGeneratorThread->pipelineStatistics().isEmpty() )
+            fprintf( mStatus, "%s\n", qPrintable( mVideoGeneratorThread->pipelineStatistics() ) );
+    }
+
+    if ( !errormsg.isEmpty() )
+    {
+        printError( QString( "Failed to encode the video: %1").arg( errormsg ) );
+        QCoreApplication::exit( 1 );
+        return;
+    }
+
+    fprintf( mStatus, "Done\n" );
+    QCoreApplication::exit( 0 );
+}
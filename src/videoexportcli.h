@@ -0,0 +1,105 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+#ifndef VIDEOEXPORTCLI_H
+#define VIDEOEXPORTCLI_H
+
+#include <QObject>
+#include <QStringList>
+#include <stdio.h>
+
+#include "videoencodingprofiles.h"
+
+class VideoGeneratorThread;
+class MultiExportJob;
+class ExportQueue;
+class TextRenderer;
+class QCommandLineParser;
+class Project;
+class Lyrics;
+
+//
+// Exports a project into a video file without any GUI, so it could be run on
+// a machine with no display (and many instances could run in parallel).
+//
+// Usage: karlyriceditor --export <output file|-> [options] <project.kleproj>
+//        karlyriceditor --export <output file> [--export <output file> ...] [--cdg <file>] [options] <project.kleproj>
+//        karlyriceditor --benchmark-presets [options] <project.kleproj>
+//        karlyriceditor --queue <output file> [options] <project.kleproj>
+//        karlyriceditor --run-queue [--jobs <count>] | --list-queue | --clear-queue
+//        karlyriceditor --list-profiles
+//        karlyriceditor --check-profiles <directory>
+//        karlyriceditor --check-renderer
+//
+// All rendering parameters are taken from the project video tags, and could be
+// overridden from the command line.
+//
+class VideoExportCli : public QObject
+{
+    Q_OBJECT
+
+    public:
+        VideoExportCli();
+        ~VideoExportCli();
+
+        // Returns true if the command line requests the headless export (or profile listing/checking)
+        static bool isRequested( int argc, char ** argv );
+
+        // Runs the export until it finishes; returns the process exit code
+        int     exec( const QStringList& arguments );
+
+    private slots:
+        void    progress( int progress, QString frames, QString size, QString timing, QString speed );
+        void    progress( QString filename, int progress, QString frames, QString size, QString timing, QString speed );
+        void    finished( QString errormsg );
+        void    queueProgress( int id, int progress, QString frames, QString size, QString timing, QString speed );
+        void    queueJobChanged( int id );
+        void    queueIdle();
+
+    private:
+        // Adds the export to the export queue shared with the GUI, or runs the queued exports
+        int     queueExport( const QCommandLineParser& parser );
+        int     runQueue( int jobs );
+        int     listQueue();
+
+        // Exports several videos and the CD+G file in one pass
+        int     exportMultiple( const QCommandLineParser& parser, Project * project, const Lyrics& lyrics, qint64 total_length,
+                                const QString& artist, const QString& title );
+
+        // Encodes a short video with every profile and verifies it could be decoded
+        int     checkProfiles( const QString& directory );
+
+        // Renders a test song at the times its block is shown fully sung, and verifies the colors
+        int     checkRenderer();
+
+        // Encodes the video with every speed preset of the profile, and prints their frame rates and bitrates
+        int     benchmarkPresets( const VideoEncodingProfile * profile, const VideoFormat * format, unsigned int quality,
+                                  const QString& tune, TextRenderer * renderer, qint64 total_length );
+
+    private:
+        VideoGeneratorThread * mVideoGeneratorThread;
+        MultiExportJob       * mMultiExportJob;
+        ExportQueue          * mExportQueue;
+        bool                   mQueueFailed;
+
+        // Progress and status output; the error output if the video is written to the standard output
+        FILE                 * mStatus;
+};
+
+#endif // VIDEOEXPORTCLI_H
@@ -21,6 +21,7 @@
 #include <QApplication>
 #include <QMessageBox>
 #include <QTime>
+#include <QCryptographicHash>
 
 #include "audioplayer.h"
 #include "videogenerator.h"
@@ -28,6 +29,7 @@
 #include "dialog_export_params.h"
 #include "ffmpegvideoencoder.h"
 #include "editor.h"
+#include "settings.h"
 #include "videogeneratorthread.h"
 
 
@@ -39,87 +41,145 @@ VideoGenerator::VideoGenerator( Project * prj )
 }
 
 
-void VideoGenerator::generate( const Lyrics& lyrics, qint64 total_length )
+TextRenderer * VideoGenerator::createRenderer( Project * project,
+                                              const Lyrics& lyrics,
+                                              const VideoFormat * format,
+                                              const QString& artist,
+                                              const QString& title,
+                                              const QString& createdBy )
 {
-	// Show the dialog with video options
-	DialogExportOptions dlg( m_project, lyrics, true );
-
-	if ( dlg.exec() != QDialog::Accepted )
-		return;
-
-	// Get the video info
-	const VideoEncodingProfile * profile;
-	const VideoFormat * format;
-    unsigned int		audioEncodingType;
-	unsigned int		quality;
-
-    if ( !dlg.videoParams( &profile, &format, &audioEncodingType, &quality ) )
-		return;
-
-	// Prepare the renderer
     TextRenderer * lyricrenderer = new TextRenderer( format->width, format->height );
 
     // Must be set before lyrics
-    lyricrenderer->setDefaultVerticalAlign( (TextRenderer::VerticalAlignment) m_project->tag( Project::Tag_Video_TextAlignVertical, QString::number( TextRenderer::VerticalBottom ) ).toInt() );
+    lyricrenderer->setDefaultVerticalAlign( (TextRenderer::VerticalAlignment) project->tag( Project::Tag_Video_TextAlignVertical, QString::number( TextRenderer::VerticalBottom ) ).toInt() );
 
     // The order matters because setLyrics resets font and colors
     lyricrenderer->setLyrics( lyrics );
 
     // Title
-    lyricrenderer->setTitlePageData( dlg.m_artist,
-                                    dlg.m_title,
-                                    dlg.m_createdBy,
-                                    m_project->tag( Project::Tag_Video_titletime, "5" ).toInt() * 1000 );
+    lyricrenderer->setTitlePageData( artist,
+                                    title,
+                                    createdBy,
+                                    project->tag( Project::Tag_Video_titletime, "5" ).toInt() * 1000 );
 
 
     // Rendering font
-    QFont renderFont( m_project->tag(Project::Tag_Video_font ) );
-    int fontsize = m_project->tag(Project::Tag_Video_fontsize).toInt();
+    QFont renderFont( project->tag(Project::Tag_Video_font ) );
+    int fontsize = project->tag(Project::Tag_Video_fontsize).toInt();
 
     if ( fontsize == 0 )
         fontsize = lyricrenderer->autodetectFontSize( QSize(format->width, format->height), renderFont );
 
     renderFont.setPointSize( fontsize );
 
-	// Initialize colors from m_project
+	// Initialize colors from the project
     lyricrenderer->setRenderFont( renderFont );
-    lyricrenderer->setColorBackground( m_project->tag( Project::Tag_Video_bgcolor, "black" ) );
-    lyricrenderer->setColorTitle( m_project->tag( Project::Tag_Video_infocolor, "white" ) );
-    lyricrenderer->setColorSang( m_project->tag( Project::Tag_Video_inactivecolor, "blue" ) );
-    lyricrenderer->setColorToSing( m_project->tag( Project::Tag_Video_activecolor, "green" ) );    
+    lyricrenderer->setColorBackground( project->tag( Project::Tag_Video_bgcolor, "black" ) );
+    lyricrenderer->setColorTitle( project->tag( Project::Tag_Video_infocolor, "white" ) );
+    lyricrenderer->setColorSang( project->tag( Project::Tag_Video_inactivecolor, "blue" ) );
+    lyricrenderer->setColorToSing( project->tag( Project::Tag_Video_activecolor, "green" ) );    
 
 	// Preamble
-	if ( m_project->tag( Project::Tag_Video_preamble).toInt() != 0 )
+	if ( project->tag( Project::Tag_Video_preamble).toInt() != 0 )
         lyricrenderer->setPreambleData( 4, 5000, 8 );
 
+    lyricrenderer->setSmoothWipe( pSettings->m_videoExportSmoothWipe );
+
+    return lyricrenderer;
+}
+
+QByteArray VideoGenerator::exportFingerprint( Project * project, const QStringList& params )
+{
+    QCryptographicHash hash( QCryptographicHash::Sha1 );
+
+    hash.addData( project->musicFile().toUtf8() );
+
+    // The export file names do not change the video
+    for ( int tag = Project::Tag_Title; tag <= Project::Tag_Video_TextAlignVertical; tag++ )
+    {
+        if ( tag != Project::Tag_ExportFilenameCDG && tag != Project::Tag_ExportFilenameVideo )
+            hash.addData( project->tag( (Project::Tag) tag ).toUtf8().append( '\0' ) );
+    }
+
+    hash.addData( params.join( QChar( 0 ) ).toUtf8() );
+    return hash.result();
+}
+
+void VideoGenerator::generate( const Lyrics& lyrics, qint64 total_length )
+{
+	// Show the dialog with video options
+	DialogExportOptions dlg( m_project, lyrics, true );
+
+	if ( dlg.exec() != QDialog::Accepted )
+		return;
+
+	// Get the video info
+	const VideoEncodingProfile * profile;
+	const VideoFormat * format;
+    unsigned int		audioEncodingType;
+	unsigned int		quality;
+
+    if ( !dlg.videoParams( &profile, &format, &audioEncodingType, &quality ) )
+		return;
+
+	// Prepare the renderer
+    TextRenderer * lyricrenderer = createRenderer( m_project, lyrics, format, dlg.m_artist, dlg.m_title, dlg.m_createdBy );
+
 	// Video encoder
     FFMpegVideoEncoder * encoder = new FFMpegVideoEncoder();
+    encoder->setSegmentable( pSettings->m_videoExportSegmentThreads > 1 || pSettings->m_videoExportResumable || pSettings->m_videoExportIncremental );
+    encoder->setVariableFrameRate( qMax( 0, pSettings->m_videoExportVfrKeepalive ) );
 
 	// audioEncodingMode: 0 - encode, 1 - copy, 2 - no audio
+    encoder->setAudioCopy( audioEncodingType == 1 );
+    encoder->setSpeedPreset( dlg.m_speedPreset, dlg.m_tune );
+
+    // Calculate the time step for rendering
+    qint64 time_step = (1000 * format->frame_rate_num) / format->frame_rate_den;
+
+    // The thread measures the encoder stages, so it is created before the file
+    mVideoGeneratorThread = new VideoGeneratorThread( encoder, lyricrenderer, total_length, time_step );
+
     QString errmsg = encoder->createFile( dlg.m_outputVideo,
 										 profile,
 										 format,
 										 quality,
-                                         audioEncodingType == 1 ? 0 : pAudioPlayer );
+                                         audioEncodingType == 2 ? 0 : pAudioPlayer );
 
 	if ( !errmsg.isEmpty() )
 	{
 		QMessageBox::critical( 0,
 							  "Cannot write video",
 							  QString("Cannot create video file: %1") .arg(errmsg) );
+
+		// Also deletes the encoder and the renderer
+		delete mVideoGeneratorThread;
+		mVideoGeneratorThread = 0;
 		return;
 	}
 
-    // Calculate the time step for rendering
-    qint64 time_step = (1000 * format->frame_rate_num) / format->frame_rate_den;
-
     // Start the video encoding
-    mVideoGeneratorThread = new VideoGeneratorThread( encoder, lyricrenderer, total_length, time_step );
+    if ( pSettings->m_videoExportReport )
+        mVideoGeneratorThread->setReportFile( dlg.m_outputVideo + ".export.json" );
+
+    if ( pSettings->m_videoExportResumable || pSettings->m_videoExportIncremental )
+    {
+        QStringList params;
+        params << profile->name << format->name << QString::number( quality ) << QString::number( total_length )
+               << dlg.m_speedPreset << dlg.m_tune << QString::number( pSettings->m_videoExportVfrKeepalive )
+               << dlg.m_artist << dlg.m_title << dlg.m_createdBy;
+
+        mVideoGeneratorThread->setCheckpoint( dlg.m_outputVideo + ".checkpoint", exportFingerprint( m_project, params ), pSettings->m_videoExportIncremental );
+    }
+
+    mVideoGeneratorThread->setPipelineDepth( pSettings->m_videoExportPipelineDepth );
+    mVideoGeneratorThread->setRenderThreads( pSettings->m_videoExportRenderThreads );
+    mVideoGeneratorThread->setSegmentThreads( pSettings->m_videoExportSegmentThreads );
     mVideoGeneratorThread->start();
 
     // Connect the signals
     connect( mVideoGeneratorThread, SIGNAL( finished(QString)), this, SLOT(finished(QString)), Qt::QueuedConnection );
-    connect( mVideoGeneratorThread, SIGNAL( progress(int, QString, QString, QString)), this, SLOT(progress(int, QString, QString, QString)), Qt::QueuedConnection );
+    connect( mVideoGeneratorThread, SIGNAL( progress(int, QString, QString, QString, QString)), this, SLOT(progress(int, QString, QString, QString, QString)), Qt::QueuedConnection );
 
     // Pop up our progress dialog
     mProgress.progressBar->setMaximum( 99 );
@@ -129,23 +189,28 @@ void VideoGenerator::generate( const Lyrics& lyrics, qint64 total_length )
     mProgress.lblFrames->setText( "0" );
     mProgress.lblOutput->setText( "0 Mb" );
     mProgress.lblTime->setText( "0:00.00" );
+    mProgress.lblSpeed->setText( "" );
 
     exec();
 }
 
-void VideoGenerator::progress( int progress, QString frames, QString size, QString timing )
+void VideoGenerator::progress( int progress, QString frames, QString size, QString timing, QString speed )
 {
     mProgress.progressBar->setValue( progress );
 
     mProgress.lblFrames->setText( frames );
     mProgress.lblOutput->setText( size );
     mProgress.lblTime->setText( timing );
+    mProgress.lblSpeed->setText( speed );
     mProgress.image->setPixmap( QPixmap::fromImage( mVideoGeneratorThread->currentImage() ).scaled( mProgress.image->size() ) );
 }
 
 void VideoGenerator::finished( QString errormsg )
 {
     // This slot is called when the encoding thread is finished, which may mean aborted, or error
+    if ( !mVideoGeneratorThread->pipelineStatistics().isEmpty() )
+        qDebug( "%s", qPrintable( mVideoGeneratorThread->pipelineStatistics() ) );
+
     if ( !errormsg.isEmpty() )
         QMessageBox::critical( 0,
                                "Video encoding failed",
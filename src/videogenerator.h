@@ -24,10 +24,12 @@
 
 #include "lyrics.h"
 #include "project.h"
+#include "videoencodingprofiles.h"
 
 #include "ui_dialog_encodingprogress.h"
 
 class VideoGeneratorThread;
+class TextRenderer;
 
 class VideoGenerator : public QDialog
 {
@@ -37,8 +39,20 @@ class VideoGenerator : public QDialog
 		VideoGenerator( Project * prj );
 		void generate( const Lyrics& lyrics, qint64 total_length );
 
+		// Creates the lyric renderer set up from the project video tags; shared with command-line export
+		static TextRenderer * createRenderer( Project * project,
+											  const Lyrics& lyrics,
+											  const VideoFormat * format,
+											  const QString& artist,
+											  const QString& title,
+											  const QString& createdBy );
+
+		// Identifies the rendering and encoding parameters of the export to resume: the project tags,
+		// the music file and the other export parameters given. The lyrics are compared per segment.
+		static QByteArray exportFingerprint( Project * project, const QStringList& params );
+
     public slots:
-        void    progress( int progress, QString frames, QString size, QString timing );
+        void    progress( int progress, QString frames, QString size, QString timing, QString speed );
         void    finished( QString errormsg );
         void    buttonAbort();
 
@@ -1,8 +1,34 @@
+#include <QFile>
 #include <QTime>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QDir>
+#include <QPainter>
+#include <QTemporaryDir>
+#include <QWaitCondition>
 
 #include "videogeneratorthread.h"
+#include "boundedqueue.h"
 #include "editor.h"
 
+// Rendered image passed to the conversion stage
+typedef struct
+{
+    QImage      image;      // null if it did not change
+    QRect       drawn;      // the lyrics area if only the lyrics are drawn
+} RenderedFrame;
+
+// With checkpoints, the video is cut into segments of about this length, so an interrupted export
+// loses at most this much of encoding
+static const qint64 CHECKPOINT_SEGMENT_MS = 10000;
+
+// Converted frame passed to the encoding stage
+typedef struct
+{
+    AVFrame *   frame;
+    bool        changed;    // false if it is the copy of the previous one
+} ConvertedFrame;
+
 VideoGeneratorThread::VideoGeneratorThread(FFMpegVideoEncoder *encoder, TextRenderer *renderer, qint64 total_length, qint64 timestep )
     : QThread(0)
 {
@@ -11,6 +37,15 @@ VideoGeneratorThread::VideoGeneratorThread(FFMpegVideoEncoder *encoder, TextRend
     mTotalLength = total_length;
     mTimeStep = timestep;
     mAborted = 0;
+    mPipelineDepth = 0;
+    mRenderThreads = 1;
+    mSegmentThreads = 1;
+    mLayerRendering = false;
+    mCheckpointKept = false;
+
+    // The renderer clones share it too
+    mEncoder->setTelemetry( &mTelemetry );
+    mTextRenderer->setTelemetry( &mTelemetry );
 }
 
 VideoGeneratorThread::~VideoGeneratorThread()
@@ -30,16 +65,137 @@ void VideoGeneratorThread::abort()
     mAborted = 1;
 }
 
+void VideoGeneratorThread::setPipelineDepth( int depth )
+{
+    mPipelineDepth = qMax( 0, depth );
+}
+
+void VideoGeneratorThread::setRenderThreads( int threads )
+{
+    mRenderThreads = qMax( 1, threads );
+}
+
+void VideoGeneratorThread::setSegmentThreads( int threads )
+{
+    mSegmentThreads = qMax( 1, threads );
+}
+
+QString VideoGeneratorThread::pipelineStatistics() const
+{
+    return mPipelineStatistics;
+}
+
+void VideoGeneratorThread::setReportFile( const QString& filename )
+{
+    mReportFile = filename;
+}
+
+void VideoGeneratorThread::setCheckpoint( const QString& directory, const QByteArray& fingerprint, bool keep )
+{
+    mCheckpointDir = directory;
+    mCheckpointFingerprint = fingerprint;
+    mCheckpointKept = keep;
+}
+
 void VideoGeneratorThread::run()
 {
-    qint64 dialog_step = mTotalLength / 100;
-    qint64 time = 0;
+    mProgressTiming.start();
+    mTotalTiming.start();
 
-    int frames = 0, totalframes = mTotalLength  / mTimeStep;
-    QString finishedMsg;
-    QElapsedTimer timing, total;
+    // With the solid background the renderer draws only the lyrics, and the encoder composes them
+    // with the background directly in YUV. Must be set before the renderer is cloned.
+    mLayerRendering = mTextRenderer->setTransparentBackground( true );
+    mBackground = mTextRenderer->backgroundColor();
+
+    QString mode, finishedMsg;
+
+    if ( mSegmentThreads > 1 || !mCheckpointDir.isEmpty() )
+    {
+        mode = "segmented";
+        finishedMsg = runSegmented();
+    }
+    else if ( mPipelineDepth > 0 )
+    {
+        mode = "pipelined";
+        finishedMsg = runPipelined();
+    }
+    else
+    {
+        mode = "serial";
+        finishedMsg = runSerial();
+    }
+
+    if ( !mReportFile.isEmpty() && !writeReport( mode, finishedMsg ) )
+        qWarning( "Cannot write the export report into %s", qPrintable( mReportFile ) );
 
-    timing.start();
+    emit finished( finishedMsg );
+}
+
+bool VideoGeneratorThread::writeReport( const QString& mode, const QString& finishedMsg )
+{
+    QJsonObject info;
+    info["mode"] = mode;
+    info["pipeline_depth"] = mPipelineDepth;
+    info["render_threads"] = mRenderThreads;
+    info["segment_threads"] = mSegmentThreads;
+    info["layer_rendering"] = mLayerRendering;
+    info["frames"] = (mTotalLength + mTimeStep - 1) / mTimeStep;
+    info["elapsed_ms"] = mTotalTiming.elapsed();
+    info["statistics"] = mPipelineStatistics;
+    info["error"] = finishedMsg;
+
+    QFile file( mReportFile );
+
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+        return false;
+
+    return file.write( QJsonDocument( mTelemetry.report( info ) ).toJson() ) > 0;
+}
+
+void VideoGeneratorThread::reportProgress( qint64 time, int frames, int outputsize, const QImage& image )
+{
+    // Should we update the progress dialog?
+    if ( time != 0 && mProgressTiming.elapsed() <= 1000 )
+        return;
+
+    mProgressTiming.restart();
+
+    QImage preview = image;
+
+    // Put the lyrics on the background which the encoder adds
+    if ( mLayerRendering && !image.isNull() )
+    {
+        preview = QImage( image.size(), QImage::Format_ARGB32 );
+        preview.fill( mBackground );
+        QPainter( &preview ).drawImage( 0, 0, image );
+    }
+
+    // Save the progress image
+    mCurrentImageMutex.lock();
+    mCurrentImage = preview;
+    mCurrentImageMutex.unlock();
+
+    emit progress(
+                time / qMax( (qint64) 1, mTotalLength / 100 ),
+                QString("%1 of %2") .arg( frames ) .arg( mTotalLength  / mTimeStep ),
+                QString( "%1 Mb" ) .arg( outputsize / (1024*1024) ),
+                markToTime( mTotalTiming.elapsed() ),
+                mTelemetry.liveSummary( frames ) );
+}
+
+int VideoGeneratorThread::encodeImage( FFMpegVideoEncoder * encoder, TextRenderer * renderer, qint64 time, bool changed )
+{
+    if ( mLayerRendering )
+        return encoder->encodeLayer( renderer->image(), renderer->drawnRect(), mBackground, time, changed );
+
+    return encoder->encodeImage( renderer->image(), time, changed );
+}
+
+QString VideoGeneratorThread::runSerial()
+{
+    qint64 time = 0;
+    int frames = 0;
+    QString finishedMsg;
 
     // Rendering
     while ( time < mTotalLength )
@@ -52,10 +208,10 @@ void VideoGeneratorThread::run()
         }
 
         frames++;
-        mTextRenderer->update( time );
+        bool changed = mTextRenderer->update( time ) != LyricsRenderer::UPDATE_NOCHANGE;
         QImage image = mTextRenderer->image();
 
-        int ret = mEncoder->encodeImage( image, time );
+        int ret = encodeImage( mEncoder, mTextRenderer, time, changed );
 
         if ( ret < 0 )
         {
@@ -63,27 +219,530 @@ void VideoGeneratorThread::run()
             break;
         }
 
-        // Should we update the progress dialog?
-        if ( time == 0 || timing.elapsed() > 1000 )
+        reportProgress( time, frames, ret, image );
+        time += mTimeStep;
+    }
+
+    mPipelineStatistics = QString( "Color conversions avoided: %1 of %2 frames, row bands: %3; frames not encoded: %4" )
+                            .arg( mEncoder->skippedConversions() )
+                            .arg( frames )
+                            .arg( mEncoder->skippedBands() )
+                            .arg( mEncoder->skippedFrames() );
+
+    mEncoder->close();
+
+    return finishedMsg;
+}
+
+QString VideoGeneratorThread::runPipelined()
+{
+    // Render (this thread) -> conversion -> encoding and muxing.
+    // Converted frames are recycled through the free frame pool, so its size limits
+    // the number of frames in flight between conversion and encoding.
+    // A null rendered image means it did not change, so the previous converted frame is reused.
+    BoundedQueue<RenderedFrame> renderedImages( mPipelineDepth );
+    BoundedQueue<ConvertedFrame>  convertedFrames( mPipelineDepth );
+    BoundedQueue<AVFrame*>  freeFrames( mPipelineDepth + 2 );
+    QList<AVFrame*>         allFrames;
+
+    QAtomicInt  encodingError = 0;
+    QAtomicInt  outputSize = 0;
+    QString     finishedMsg;
+
+    for ( int i = 0; i < mPipelineDepth + 2; i++ )
+    {
+        AVFrame * frame = mEncoder->allocFrame();
+
+        if ( !frame )
         {
-            timing.restart();
-
-            // Save the progress image
-            mCurrentImageMutex.lock();
-            mCurrentImage = image;
-            mCurrentImageMutex.unlock();
-
-            emit progress(
-                        time / dialog_step,
-                        QString("%1 of %2") .arg( frames ) .arg( totalframes ),
-                        QString( "%1 Mb" ) .arg( ret / (1024*1024) ),
-                        markToTime( total.elapsed() ) );
+            finishedMsg = "Cannot allocate the video frame";
+            break;
         }
 
-        time += mTimeStep;
+        allFrames.push_back( frame );
+        freeFrames.push( frame );
+    }
+
+    // Conversion stage
+    QThread * converter = QThread::create( [&]()
+    {
+        RenderedFrame rendered;
+        AVFrame * frame;
+        AVFrame * lastFrame = 0;
+
+        while ( renderedImages.pop( &rendered ) )
+        {
+            if ( !freeFrames.pop( &frame ) )
+                break;
+
+            bool converted;
+            ConvertedFrame output;
+            output.frame = frame;
+            output.changed = !rendered.image.isNull() || !lastFrame;
+
+            if ( !output.changed )
+                converted = mEncoder->reuseFrame( frame, lastFrame );
+            else if ( mLayerRendering )
+                converted = mEncoder->convertLayer( rendered.image, rendered.drawn, mBackground, frame );
+            else
+                converted = mEncoder->convertImage( rendered.image, frame, lastFrame );
+
+            lastFrame = frame;
+
+            if ( !converted )
+            {
+                // Wake up the renderer if it waits for us
+                encodingError = 1;
+                renderedImages.close();
+                break;
+            }
+
+            if ( !convertedFrames.push( output ) )
+                break;
+        }
+
+        // Nothing more to encode
+        convertedFrames.close();
+    });
+
+    // Encoding stage
+    QThread * encoder = QThread::create( [&]()
+    {
+        ConvertedFrame converted;
+
+        while ( convertedFrames.pop( &converted ) )
+        {
+            int ret = mEncoder->encodeFrame( converted.frame, converted.changed );
+
+            if ( ret < 0 )
+            {
+                // Wake up both the renderer and the converter if they wait for us
+                encodingError = 1;
+                renderedImages.close();
+                freeFrames.close();
+                convertedFrames.close();
+                break;
+            }
+
+            outputSize = ret;
+            freeFrames.push( converted.frame );
+        }
+    });
+
+    // Render workers; each renders the chunks of frames chunk % mRenderThreads == worker into its own queue,
+    // so the frames are collected back in order by taking them from the queues in turn. Chunks keep the
+    // frames rendered by one renderer consecutive, so it still skips redrawing unchanged lyrics.
+    qint64 totalFrames = (mTotalLength + mTimeStep - 1) / mTimeStep;
+    qint64 chunkFrames = qMax( (qint64) 1, 2000 / mTimeStep );
+
+    QList< BoundedQueue<RenderedFrame>* > workerImages;
+    QList< TextRenderer* > workerRenderers;
+    QList< QThread* > workers;
+
+    for ( int w = 0; mRenderThreads > 1 && w < mRenderThreads; w++ )
+    {
+        TextRenderer * renderer = w == 0 ? mTextRenderer : mTextRenderer->clone();
+        BoundedQueue<RenderedFrame> * images = new BoundedQueue<RenderedFrame>( mPipelineDepth );
+        int workercount = mRenderThreads;
+
+        workerRenderers.push_back( renderer );
+        workerImages.push_back( images );
+
+        workers.push_back( QThread::create( [this, w, workercount, renderer, images, totalFrames, chunkFrames]()
+        {
+            for ( qint64 chunk = w; chunk * chunkFrames < totalFrames; chunk += workercount )
+            {
+                for ( qint64 frame = chunk * chunkFrames; frame < qMin( (chunk + 1) * chunkFrames, totalFrames ); frame++ )
+                {
+                    bool changed = renderer->update( frame * mTimeStep ) != LyricsRenderer::UPDATE_NOCHANGE;
+
+                    // The previous frame of the chunk start was rendered by another worker
+                    if ( frame == chunk * chunkFrames )
+                        changed = true;
+
+                    RenderedFrame rendered;
+
+                    if ( changed )
+                    {
+                        rendered.image = renderer->image();
+                        rendered.drawn = renderer->drawnRect();
+                    }
+
+                    // Closed if aborted or failed
+                    if ( !images->push( rendered ) )
+                        return;
+                }
+            }
+
+            images->close();
+        }));
+    }
+
+    if ( finishedMsg.isEmpty() )
+    {
+        converter->start();
+        encoder->start();
+
+        foreach ( QThread * worker, workers )
+            worker->start();
+
+        qint64 time = 0;
+        int frames = 0;
+        QImage lastImage;
+
+        // Rendering stage
+        while ( time < mTotalLength )
+        {
+            // Show no message in case of aborted
+            if ( mAborted )
+            {
+                finishedMsg = "Aborted by user";
+                break;
+            }
+
+            if ( encodingError )
+                break;
+
+            RenderedFrame rendered;
+
+            if ( workers.isEmpty() )
+            {
+                if ( mTextRenderer->update( time ) != LyricsRenderer::UPDATE_NOCHANGE || frames == 0 )
+                {
+                    rendered.image = mTextRenderer->image();
+                    rendered.drawn = mTextRenderer->drawnRect();
+                }
+            }
+            else if ( !workerImages[ (frames / chunkFrames) % workers.size() ]->pop( &rendered ) )
+                break;
+
+            frames++;
+
+            if ( !renderedImages.push( rendered ) )
+                break;
+
+            if ( !rendered.image.isNull() )
+                lastImage = rendered.image;
+
+            reportProgress( time, frames, outputSize, lastImage );
+            time += mTimeStep;
+        }
+
+        // Let the other stages finish the queued frames, and stop the render workers
+        renderedImages.close();
+
+        foreach ( BoundedQueue<RenderedFrame> * images, workerImages )
+            images->close();
+
+        foreach ( QThread * worker, workers )
+            worker->wait();
+
+        converter->wait();
+        encoder->wait();
     }
 
+    delete converter;
+    delete encoder;
+
+    // Render stalls summed up over all workers
+    unsigned int workerPushStalls = 0, workerPopStalls = 0;
+
+    for ( int w = 0; w < workers.size(); w++ )
+    {
+        workerPushStalls += workerImages[w]->pushStalls();
+        workerPopStalls += workerImages[w]->popStalls();
+
+        delete workers[w];
+        delete workerImages[w];
+
+        // The first worker uses the original renderer
+        if ( w > 0 )
+            delete workerRenderers[w];
+    }
+
+    if ( encodingError && finishedMsg.isEmpty() )
+        finishedMsg = QString("Encoding error while creating the video file" );
+
+    mPipelineStatistics = QString( "Pipeline depth %1: render waited for conversion %2 times; "
+                                   "conversion waited for render %3 times, for encoding %4 times; "
+                                   "encoding waited for conversion %5 times" )
+                            .arg( mPipelineDepth )
+                            .arg( renderedImages.pushStalls() )
+                            .arg( renderedImages.popStalls() )
+                            .arg( freeFrames.popStalls() + convertedFrames.pushStalls() )
+                            .arg( convertedFrames.popStalls() );
+
+    mPipelineStatistics += QString( "; color conversions avoided: %1, row bands: %2; frames not encoded: %3" )
+                            .arg( mEncoder->skippedConversions() )
+                            .arg( mEncoder->skippedBands() )
+                            .arg( mEncoder->skippedFrames() );
+
+    if ( !workers.isEmpty() )
+        mPipelineStatistics += QString( "; %1 render threads: waited for conversion %2 times, collected frames waited for render %3 times" )
+                                .arg( workers.size() )
+                                .arg( workerPushStalls )
+                                .arg( workerPopStalls );
+
     mEncoder->close();
 
-    emit finished( finishedMsg );
+    foreach ( AVFrame * frame, allFrames )
+        mEncoder->freeFrame( frame );
+
+    return finishedMsg;
+}
+
+QString VideoGeneratorThread::runSegmented()
+{
+    // The video is cut into segments of whole GOPs. Each worker takes the next segment, renders it
+    // with its own renderer copy and encodes it with its own encoder into a segment file. This thread
+    // appends the segments into the output file in order as soon as they are ready, adding the audio.
+    // With checkpoints the segments are kept, at least until the whole export succeeds, together with
+    // the hash of their content. A restarted export, or the export of the corrected lyrics, encodes only
+    // the segments which are not there or whose content changed, and reuses the others.
+    QTemporaryDir tempdir;
+    QDir segmentDir( mCheckpointDir.isEmpty() ? tempdir.path() : mCheckpointDir );
+    QString finishedMsg;
+
+    qint64 totalFrames = (mTotalLength + mTimeStep - 1) / mTimeStep;
+    qint64 gop = mEncoder->gopSize();
+
+    // Several segments per worker, so the workers finishing early do not wait for the last one.
+    // Checkpoint segments must not depend on the number of workers, so they could be resumed by any.
+    qint64 segmentFrames;
+
+    if ( mCheckpointDir.isEmpty() )
+        segmentFrames = qMax( (qint64) 1, totalFrames / (mSegmentThreads * 4) );
+    else
+        segmentFrames = qMax( (qint64) 1, CHECKPOINT_SEGMENT_MS / mTimeStep );
+
+    segmentFrames = ((segmentFrames + gop - 1) / gop) * gop;
+
+    int totalSegments = (totalFrames + segmentFrames - 1) / segmentFrames;
+
+    enum { SEGMENT_PENDING, SEGMENT_DONE, SEGMENT_FAILED };
+    QVector<int>    segmentState( totalSegments, SEGMENT_PENDING );
+    QMutex          segmentMutex;
+    QWaitCondition  segmentFinished;
+    int             nextSegment = 0;
+    QAtomicInt      framesEncoded = 0;
+    QAtomicInt      stopWorkers = 0;
+    QAtomicInt      conversionsSkipped = 0;
+    QAtomicInt      bandsSkipped = 0;
+    QAtomicInt      framesSkipped = 0;
+
+    if ( mCheckpointDir.isEmpty() && !tempdir.isValid() )
+        return "Cannot create the temporary directory for video segments";
+
+    if ( !mCheckpointDir.isEmpty() && !QDir().mkpath( mCheckpointDir ) )
+        return QString( "Cannot create the checkpoint directory %1" ) .arg( mCheckpointDir );
+
+    // Segments done by the previous export which are drawn the same now
+    QVector<QByteArray> segmentHashes( totalSegments );
+    int reusedSegments = 0;
+
+    if ( !mCheckpointDir.isEmpty() )
+    {
+        QMap<int, QByteArray> previous = loadCheckpoint( totalFrames, segmentFrames );
+
+        for ( int segment = 0; segment < totalSegments; segment++ )
+        {
+            qint64 start = segment * segmentFrames;
+            qint64 end = qMin( start + segmentFrames, totalFrames );
+
+            segmentHashes[ segment ] = mTextRenderer->contentHash( start * mTimeStep, end * mTimeStep, mTimeStep );
+
+            if ( previous.value( segment ) == segmentHashes[ segment ] && segmentDir.exists( QString("segment%1.nut").arg( segment ) ) )
+            {
+                segmentState[ segment ] = SEGMENT_DONE;
+                framesEncoded += (int) (end - start);
+                reusedSegments++;
+            }
+        }
+    }
+
+    QList<QThread*> workers;
+    QList<TextRenderer*> workerRenderers;
+
+    for ( int w = 0; w < mSegmentThreads; w++ )
+    {
+        TextRenderer * renderer = mTextRenderer->clone();
+        workerRenderers.push_back( renderer );
+
+        workers.push_back( QThread::create( [&, renderer]()
+        {
+            while ( true )
+            {
+                segmentMutex.lock();
+
+                while ( nextSegment < totalSegments && segmentState[ nextSegment ] != SEGMENT_PENDING )
+                    nextSegment++;
+
+                int segment = nextSegment++;
+                segmentMutex.unlock();
+
+                if ( segment >= totalSegments || stopWorkers || mAborted )
+                    break;
+
+                FFMpegVideoEncoder encoder;
+                bool success = encoder.createSegmentFile( segmentDir.filePath( QString("segment%1.nut").arg( segment ) ), mEncoder ).isEmpty();
+
+                for ( qint64 frame = segment * segmentFrames; success && frame < qMin( (segment + 1) * segmentFrames, totalFrames ); frame++ )
+                {
+                    if ( stopWorkers || mAborted )
+                    {
+                        success = false;
+                        break;
+                    }
+
+                    // A new encoder always converts its first image
+                    bool changed = renderer->update( frame * mTimeStep ) != LyricsRenderer::UPDATE_NOCHANGE;
+
+                    if ( encodeImage( &encoder, renderer, frame * mTimeStep, changed ) < 0 )
+                        success = false;
+
+                    framesEncoded++;
+                }
+
+                conversionsSkipped += encoder.skippedConversions();
+                bandsSkipped += encoder.skippedBands();
+                framesSkipped += encoder.skippedFrames();
+                success = encoder.close() && success;
+
+                segmentMutex.lock();
+                segmentState[ segment ] = success ? SEGMENT_DONE : SEGMENT_FAILED;
+
+                if ( success && !mCheckpointDir.isEmpty() )
+                    saveCheckpoint( segmentState, SEGMENT_DONE, segmentHashes, totalFrames, segmentFrames );
+
+                segmentFinished.wakeAll();
+                segmentMutex.unlock();
+            }
+        }));
+
+        workers.last()->start();
+    }
+
+    // The preview is rendered by the original renderer, which is not a part of the export
+    mTextRenderer->setTelemetry( 0 );
+
+    int outputSize = 0;
+
+    for ( int segment = 0; segment < totalSegments; segment++ )
+    {
+        int state = SEGMENT_PENDING;
+
+        while ( state == SEGMENT_PENDING && !mAborted )
+        {
+            segmentMutex.lock();
+
+            if ( segmentState[ segment ] == SEGMENT_PENDING )
+                segmentFinished.wait( &segmentMutex, 500 );
+
+            state = segmentState[ segment ];
+            segmentMutex.unlock();
+
+            // The preview image is rendered here, as the workers' renderers are busy
+            if ( mProgressTiming.elapsed() > 1000 )
+            {
+                qint64 time = framesEncoded.loadRelaxed() * mTimeStep;
+                mTextRenderer->update( time );
+                reportProgress( time, framesEncoded.loadRelaxed(), outputSize, mTextRenderer->image() );
+            }
+        }
+
+        // Show no message in case of aborted
+        if ( mAborted )
+        {
+            finishedMsg = "Aborted by user";
+            break;
+        }
+
+        QString segmentFile = segmentDir.filePath( QString("segment%1.nut").arg( segment ) );
+
+        if ( state == SEGMENT_FAILED || (outputSize = mEncoder->appendSegment( segmentFile, segment * segmentFrames )) < 0 )
+        {
+            finishedMsg = QString("Encoding error while creating the video file" );
+            break;
+        }
+
+        // Not needed anymore, unless kept for resuming
+        if ( mCheckpointDir.isEmpty() )
+            QFile::remove( segmentFile );
+    }
+
+    stopWorkers = 1;
+
+    for ( int w = 0; w < workers.size(); w++ )
+    {
+        workers[w]->wait();
+
+        delete workers[w];
+        delete workerRenderers[w];
+    }
+
+    mPipelineStatistics = QString( "%1 segment threads: %2 segments of %3 frames; color conversions avoided: %4, row bands: %5; frames not encoded: %6" )
+                            .arg( workers.size() )
+                            .arg( totalSegments )
+                            .arg( segmentFrames )
+                            .arg( conversionsSkipped.loadRelaxed() )
+                            .arg( bandsSkipped.loadRelaxed() )
+                            .arg( framesSkipped.loadRelaxed() );
+
+    if ( !mCheckpointDir.isEmpty() )
+        mPipelineStatistics += QString( "; reused %1 of %2 segments from the previous export" ) .arg( reusedSegments ) .arg( totalSegments );
+
+    bool success = mEncoder->close() && finishedMsg.isEmpty();
+
+    // Unless kept for the incremental export, the checkpoint is only needed to resume the interrupted one
+    if ( success && !mCheckpointDir.isEmpty() && !mCheckpointKept )
+        QDir( mCheckpointDir ).removeRecursively();
+
+    return finishedMsg;
+}
+
+QMap<int, QByteArray> VideoGeneratorThread::loadCheckpoint( qint64 totalFrames, qint64 segmentFrames )
+{
+    QMap<int, QByteArray> segments;
+    QFile file( QDir( mCheckpointDir ).filePath( "manifest.json" ) );
+
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return segments;
+
+    QJsonObject manifest = QJsonDocument::fromJson( file.readAll() ).object();
+
+    // The segments of a different export, or cut differently, are not used
+    if ( manifest["fingerprint"].toString() != QString::fromLatin1( mCheckpointFingerprint.toHex() )
+    || manifest["frames"].toInteger() != totalFrames
+    || manifest["segment_frames"].toInteger() != segmentFrames )
+        return segments;
+
+    QJsonObject done = manifest["segments"].toObject();
+
+    for ( QJsonObject::const_iterator it = done.begin(); it != done.end(); ++it )
+        segments[ it.key().toInt() ] = QByteArray::fromHex( it.value().toString().toLatin1() );
+
+    return segments;
+}
+
+void VideoGeneratorThread::saveCheckpoint( const QVector<int>& segmentState, int doneState, const QVector<QByteArray>& segmentHashes,
+                                           qint64 totalFrames, qint64 segmentFrames )
+{
+    // Segment files with the hash of the content they were encoded from
+    QJsonObject done;
+
+    for ( int segment = 0; segment < segmentState.size(); segment++ )
+        if ( segmentState[ segment ] == doneState )
+            done[ QString::number( segment ) ] = QString::fromLatin1( segmentHashes[ segment ].toHex() );
+
+    QJsonObject manifest;
+    manifest["fingerprint"] = QString::fromLatin1( mCheckpointFingerprint.toHex() );
+    manifest["frames"] = totalFrames;
+    manifest["segment_frames"] = segmentFrames;
+    manifest["segments"] = done;
+
+    // Replaced at once, so a crash never leaves a broken manifest
+    QSaveFile file( QDir( mCheckpointDir ).filePath( "manifest.json" ) );
+
+    if ( !file.open( QIODevice::WriteOnly ) || file.write( QJsonDocument( manifest ).toJson() ) < 0 || !file.commit() )
+        qWarning( "Cannot write the checkpoint into %s", qPrintable( mCheckpointDir ) );
 }
@@ -4,9 +4,11 @@
 #include <QThread>
 #include <QMutex>
 #include <QImage>
+#include <QElapsedTimer>
 
 #include "ffmpegvideoencoder.h"
 #include "textrenderer.h"
+#include "exporttelemetry.h"
 
 
 class VideoGeneratorThread : public QThread
@@ -14,13 +16,41 @@ class VideoGeneratorThread : public QThread
     Q_OBJECT
 
     public:
+        // The stage times of the encoder and the renderer are measured, so the encoder file must be
+        // created after this (the audio thread is started together with the file).
         explicit VideoGeneratorThread(FFMpegVideoEncoder * encoder, TextRenderer * renderer, qint64 total_length, qint64 timestep);
         ~VideoGeneratorThread();
 
         QImage currentImage() const;
 
+        // Number of frames which could be queued between render, conversion and encoding stages,
+        // each running in its own thread. Zero means all stages run serially in this thread.
+        void    setPipelineDepth( int depth );
+
+        // Number of threads rendering the lyrics in the pipelined mode. Each thread uses its own
+        // renderer copy and renders its own chunks of frames, which are then encoded in order.
+        void    setRenderThreads( int threads );
+
+        // Number of threads encoding the video segments in parallel, each with its own renderer copy
+        // and encoder. The encoder must be made segmentable before the file is created. Takes
+        // precedence over the pipelining if more than one.
+        void    setSegmentThreads( int threads );
+
+        // Per-stage stall counters of the last run, human-readable
+        QString pipelineStatistics() const;
+
+        // Writes the per-stage timing of the run into this JSON file when finished
+        void    setReportFile( const QString& filename );
+
+        // Keeps the encoded video segments and their manifest in this directory, so an interrupted
+        // export is resumed from the segments already done. The fingerprint identifies the rendering and
+        // encoding parameters, the segments encoded with different ones are not used. The segments whose
+        // lyrics changed are encoded again, so if the directory is kept after the export succeeds, the
+        // next export of the corrected lyrics only encodes what changed. The encoder must be segmentable.
+        void    setCheckpoint( const QString& directory, const QByteArray& fingerprint, bool keep );
+
     signals:
-        void    progress( int progress, QString frames, QString size, QString timing );
+        void    progress( int progress, QString frames, QString size, QString timing, QString speed );
         void    finished( QString errortext );
 
     public slots:
@@ -30,6 +60,17 @@ class VideoGeneratorThread : public QThread
         void run() override;
 
     private:
+        // Return the error message, empty if succeeded
+        QString runSerial();
+        QString runPipelined();
+        QString runSegmented();
+        bool    writeReport( const QString& mode, const QString& finishedMsg );
+        QMap<int, QByteArray> loadCheckpoint( qint64 totalFrames, qint64 segmentFrames );
+        void    saveCheckpoint( const QVector<int>& segmentState, int doneState, const QVector<QByteArray>& segmentHashes,
+                                qint64 totalFrames, qint64 segmentFrames );
+        void    reportProgress( qint64 time, int frames, int outputsize, const QImage& image );
+        int     encodeImage( FFMpegVideoEncoder * encoder, TextRenderer * renderer, qint64 time, bool changed );
+
         mutable QMutex      mCurrentImageMutex;
         QImage      mCurrentImage;
 
@@ -38,6 +79,27 @@ class VideoGeneratorThread : public QThread
         qint64                  mTimeStep;
         qint64                  mTotalLength;
         QAtomicInt              mAborted;
+        int                     mPipelineDepth;
+        int                     mRenderThreads;
+        int                     mSegmentThreads;
+
+        // The renderer draws only the lyrics, and the encoder adds the solid background
+        bool                    mLayerRendering;
+        QColor                  mBackground;
+        QString                 mPipelineStatistics;
+
+        // Stage timings, shared by all renderers and encoders
+        ExportTelemetry         mTelemetry;
+        QString                 mReportFile;
+
+        // Resumable and incremental export
+        QString                 mCheckpointDir;
+        QByteArray              mCheckpointFingerprint;
+        bool                    mCheckpointKept;
+
+        // Used by progress reporting
+        QElapsedTimer           mProgressTiming;
+        QElapsedTimer           mTotalTiming;
 };
 
 #endif // VIDEOGENERATORTHREAD_H
@@ -0,0 +1,331 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+
+#include <string.h>
+
+#include "yuvconverter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define YUVCONVERTER_X86
+	#include <immintrin.h>
+#endif
+
+// Converts the pixels from..to of two rows (the same row twice for the odd last row);
+// from is even, to is either even or the image width
+typedef void (*ConvertRowsFunc)( const quint32 * row0, const quint32 * row1, int from, int to,
+								 uchar * y0, uchar * y1, uchar * u, uchar * v );
+
+// BT.601 limited range in 8.8 fixed point, the same as in FFMpegVideoEncoder::convertLayer.
+// The chroma is calculated from the sums of the 2x2 block.
+static inline int pixelToY( quint32 px )
+{
+	return 16 + ( ( 66 * ((px >> 16) & 0xFF) + 129 * ((px >> 8) & 0xFF) + 25 * (px & 0xFF) + 128 ) >> 8 );
+}
+
+static inline int sumsToU( int r, int g, int b )	{ return 128 + ( ( -38 * r -  74 * g + 112 * b + 512 ) >> 10 ); }
+static inline int sumsToV( int r, int g, int b )	{ return 128 + ( ( 112 * r -  94 * g -  18 * b + 512 ) >> 10 ); }
+
+static void convertRowsScalar( const quint32 * row0, const quint32 * row1, int from, int to,
+							   uchar * y0, uchar * y1, uchar * u, uchar * v )
+{
+	for ( int x = from; x < to; x += 2 )
+	{
+		// The odd last column is taken twice for the chroma
+		int x1 = x + 1 < to ? x + 1 : x;
+		quint32 pixels[4] = { row0[x], row0[x1], row1[x], row1[x1] };
+
+		y0[x] = pixelToY( pixels[0] );
+		y0[x1] = pixelToY( pixels[1] );
+		y1[x] = pixelToY( pixels[2] );
+		y1[x1] = pixelToY( pixels[3] );
+
+		int r = 0, g = 0, b = 0;
+
+		for ( int i = 0; i < 4; i++ )
+		{
+			r += (pixels[i] >> 16) & 0xFF;
+			g += (pixels[i] >> 8) & 0xFF;
+			b += pixels[i] & 0xFF;
+		}
+
+		u[ x / 2 ] = sumsToU( r, g, b );
+		v[ x / 2 ] = sumsToV( r, g, b );
+	}
+}
+
+#if defined (YUVCONVERTER_X86)
+
+// Two 16-bit coefficients in a 32-bit lane, for multiplying the B,R and G,A pairs of a pixel
+static inline int coeffPair( int low, int high )
+{
+	return (int) ( ((quint32) (quint16) high << 16) | (quint16) low );
+}
+
+//
+// The vector code works on the 32-bit pixels: masking them with 0x00FF00FF gives the 16-bit B and R,
+// and shifted by 8 bits the G and A. Multiplying those pairs with the coefficient pairs and adding
+// them (madd) gives the sum for each pixel exactly as the scalar code calculates it.
+// For the chroma the pairs of both rows and two neighbour pixels are added first.
+//
+__attribute__((target("sse2")))
+static void convertRowsSse2( const quint32 * row0, const quint32 * row1, int from, int to,
+							 uchar * y0, uchar * y1, uchar * u, uchar * v )
+{
+	const __m128i mask = _mm_set1_epi32( 0x00FF00FF );
+	const __m128i yBR = _mm_set1_epi32( coeffPair( 25, 66 ) );
+	const __m128i yGA = _mm_set1_epi32( coeffPair( 129, 0 ) );
+	const __m128i uBR = _mm_set1_epi32( coeffPair( 112, -38 ) );
+	const __m128i uGA = _mm_set1_epi32( coeffPair( -74, 0 ) );
+	const __m128i vBR = _mm_set1_epi32( coeffPair( -18, 112 ) );
+	const __m128i vGA = _mm_set1_epi32( coeffPair( -94, 0 ) );
+	const __m128i lumaRound = _mm_set1_epi32( 128 );
+	const __m128i lumaOffset = _mm_set1_epi32( 16 );
+	const __m128i chromaRound = _mm_set1_epi32( 512 );
+	const __m128i chromaOffset = _mm_set1_epi32( 128 );
+
+	int x = from;
+
+	for ( ; x + 4 <= to; x += 4 )
+	{
+		__m128i p0 = _mm_loadu_si128( (const __m128i*) (row0 + x) );
+		__m128i p1 = _mm_loadu_si128( (const __m128i*) (row1 + x) );
+
+		__m128i br0 = _mm_and_si128( p0, mask );
+		__m128i ga0 = _mm_and_si128( _mm_srli_epi32( p0, 8 ), mask );
+		__m128i br1 = _mm_and_si128( p1, mask );
+		__m128i ga1 = _mm_and_si128( _mm_srli_epi32( p1, 8 ), mask );
+
+		__m128i l0 = _mm_add_epi32( _mm_madd_epi16( br0, yBR ), _mm_madd_epi16( ga0, yGA ) );
+		__m128i l1 = _mm_add_epi32( _mm_madd_epi16( br1, yBR ), _mm_madd_epi16( ga1, yGA ) );
+		l0 = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( l0, lumaRound ), 8 ), lumaOffset );
+		l1 = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( l1, lumaRound ), 8 ), lumaOffset );
+
+		__m128i luma = _mm_packus_epi16( _mm_packs_epi32( l0, l1 ), _mm_setzero_si128() );
+		quint32 value = _mm_cvtsi128_si32( luma );
+		memcpy( y0 + x, &value, 4 );
+		value = _mm_cvtsi128_si32( _mm_srli_si128( luma, 4 ) );
+		memcpy( y1 + x, &value, 4 );
+
+		// Sums of the 2x2 blocks in the even lanes
+		__m128i br = _mm_add_epi16( br0, br1 );
+		__m128i ga = _mm_add_epi16( ga0, ga1 );
+		br = _mm_add_epi16( br, _mm_srli_epi64( br, 32 ) );
+		ga = _mm_add_epi16( ga, _mm_srli_epi64( ga, 32 ) );
+
+		__m128i cu = _mm_add_epi32( _mm_madd_epi16( br, uBR ), _mm_madd_epi16( ga, uGA ) );
+		__m128i cv = _mm_add_epi32( _mm_madd_epi16( br, vBR ), _mm_madd_epi16( ga, vGA ) );
+		cu = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( cu, chromaRound ), 10 ), chromaOffset );
+		cv = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( cv, chromaRound ), 10 ), chromaOffset );
+
+		// Lanes 0 and 2 of both into U0 U1 V0 V1
+		__m128i chroma = _mm_unpacklo_epi64( _mm_shuffle_epi32( cu, _MM_SHUFFLE( 2, 0, 2, 0 ) ),
+											 _mm_shuffle_epi32( cv, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+		chroma = _mm_packus_epi16( _mm_packs_epi32( chroma, chroma ), _mm_setzero_si128() );
+		value = _mm_cvtsi128_si32( chroma );
+		memcpy( u + x / 2, &value, 2 );
+		value >>= 16;
+		memcpy( v + x / 2, &value, 2 );
+	}
+
+	convertRowsScalar( row0, row1, x, to, y0, y1, u, v );
+}
+
+__attribute__((target("avx2")))
+static void convertRowsAvx2( const quint32 * row0, const quint32 * row1, int from, int to,
+							 uchar * y0, uchar * y1, uchar * u, uchar * v )
+{
+	const __m256i mask = _mm256_set1_epi32( 0x00FF00FF );
+	const __m256i yBR = _mm256_set1_epi32( coeffPair( 25, 66 ) );
+	const __m256i yGA = _mm256_set1_epi32( coeffPair( 129, 0 ) );
+	const __m256i uBR = _mm256_set1_epi32( coeffPair( 112, -38 ) );
+	const __m256i uGA = _mm256_set1_epi32( coeffPair( -74, 0 ) );
+	const __m256i vBR = _mm256_set1_epi32( coeffPair( -18, 112 ) );
+	const __m256i vGA = _mm256_set1_epi32( coeffPair( -94, 0 ) );
+	const __m256i lumaRound = _mm256_set1_epi32( 128 );
+	const __m256i lumaOffset = _mm256_set1_epi32( 16 );
+	const __m256i chromaRound = _mm256_set1_epi32( 512 );
+	const __m256i chromaOffset = _mm256_set1_epi32( 128 );
+
+	// U from the even lanes into the low half, V into the high one
+	const __m256i evenLanes = _mm256_setr_epi32( 0, 2, 4, 6, 0, 2, 4, 6 );
+
+	int x = from;
+
+	for ( ; x + 8 <= to; x += 8 )
+	{
+		__m256i p0 = _mm256_loadu_si256( (const __m256i*) (row0 + x) );
+		__m256i p1 = _mm256_loadu_si256( (const __m256i*) (row1 + x) );
+
+		__m256i br0 = _mm256_and_si256( p0, mask );
+		__m256i ga0 = _mm256_and_si256( _mm256_srli_epi32( p0, 8 ), mask );
+		__m256i br1 = _mm256_and_si256( p1, mask );
+		__m256i ga1 = _mm256_and_si256( _mm256_srli_epi32( p1, 8 ), mask );
+
+		__m256i l0 = _mm256_add_epi32( _mm256_madd_epi16( br0, yBR ), _mm256_madd_epi16( ga0, yGA ) );
+		__m256i l1 = _mm256_add_epi32( _mm256_madd_epi16( br1, yBR ), _mm256_madd_epi16( ga1, yGA ) );
+		l0 = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( l0, lumaRound ), 8 ), lumaOffset );
+		l1 = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( l1, lumaRound ), 8 ), lumaOffset );
+
+		__m128i luma0 = _mm_packs_epi32( _mm256_castsi256_si128( l0 ), _mm256_extracti128_si256( l0, 1 ) );
+		__m128i luma1 = _mm_packs_epi32( _mm256_castsi256_si128( l1 ), _mm256_extracti128_si256( l1, 1 ) );
+		__m128i luma = _mm_packus_epi16( luma0, luma1 );
+		_mm_storel_epi64( (__m128i*) (y0 + x), luma );
+		_mm_storel_epi64( (__m128i*) (y1 + x), _mm_srli_si128( luma, 8 ) );
+
+		// Sums of the 2x2 blocks in the even lanes
+		__m256i br = _mm256_add_epi16( br0, br1 );
+		__m256i ga = _mm256_add_epi16( ga0, ga1 );
+		br = _mm256_add_epi16( br, _mm256_srli_epi64( br, 32 ) );
+		ga = _mm256_add_epi16( ga, _mm256_srli_epi64( ga, 32 ) );
+
+		__m256i cu = _mm256_add_epi32( _mm256_madd_epi16( br, uBR ), _mm256_madd_epi16( ga, uGA ) );
+		__m256i cv = _mm256_add_epi32( _mm256_madd_epi16( br, vBR ), _mm256_madd_epi16( ga, vGA ) );
+		cu = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( cu, chromaRound ), 10 ), chromaOffset );
+		cv = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( cv, chromaRound ), 10 ), chromaOffset );
+
+		__m128i chroma = _mm_packs_epi32( _mm256_castsi256_si128( _mm256_permutevar8x32_epi32( cu, evenLanes ) ),
+										  _mm256_castsi256_si128( _mm256_permutevar8x32_epi32( cv, evenLanes ) ) );
+		chroma = _mm_packus_epi16( chroma, chroma );
+		quint32 value = _mm_cvtsi128_si32( chroma );
+		memcpy( u + x / 2, &value, 4 );
+		value = _mm_cvtsi128_si32( _mm_srli_si128( chroma, 4 ) );
+		memcpy( v + x / 2, &value, 4 );
+	}
+
+	convertRowsScalar( row0, row1, x, to, y0, y1, u, v );
+}
+
+#endif // YUVCONVERTER_X86
+
+// Picks the conversion code once
+static ConvertRowsFunc selectConverter( const char ** name )
+{
+#if defined (YUVCONVERTER_X86)
+	__builtin_cpu_init();
+
+	if ( __builtin_cpu_supports( "avx2" ) )
+	{
+		*name = "avx2";
+		return convertRowsAvx2;
+	}
+
+	if ( __builtin_cpu_supports( "sse2" ) )
+	{
+		*name = "sse2";
+		return convertRowsSse2;
+	}
+#endif
+
+	*name = "scalar";
+	return convertRowsScalar;
+}
+
+static const char * converterName;
+static const ConvertRowsFunc converter = selectConverter( &converterName );
+
+
+const char * YuvConverter::name()
+{
+	return converterName;
+}
+
+void YuvConverter::convert( const uchar * src, int srcstride, int width, int rows, uchar * const dst[3], const int dststride[3] )
+{
+	// The background usually has one color, so its YUV values are kept
+	quint32 solidColor = 0;
+	uchar solidYuv[3] = { 0, 0, 0 };
+	bool solidKnown = false;
+
+	for ( int top = 0; top < rows; top += BLOCK_SIZE )
+	{
+		int blockrows = qMin( BLOCK_SIZE, rows - top );
+
+		// Only the full blocks are checked; the rest is converted
+		int blocksEnd = blockrows == BLOCK_SIZE ? width - width % BLOCK_SIZE : 0;
+		int convertFrom = 0;
+
+		for ( int left = 0; left <= blocksEnd; left += BLOCK_SIZE )
+		{
+			bool solid = false;
+
+			if ( left < blocksEnd )
+			{
+				quint32 color = *( (const quint32*) (src + top * srcstride) + left );
+				quint32 pattern[ BLOCK_SIZE ];
+
+				for ( int i = 0; i < BLOCK_SIZE; i++ )
+					pattern[i] = color;
+
+				solid = true;
+
+				for ( int y = top; y < top + BLOCK_SIZE && solid; y++ )
+					solid = memcmp( (const quint32*) (src + y * srcstride) + left, pattern, sizeof(pattern) ) == 0;
+
+				if ( !solid )
+					continue;
+
+				if ( !solidKnown || color != solidColor )
+				{
+					int r = (color >> 16) & 0xFF, g = (color >> 8) & 0xFF, b = color & 0xFF;
+
+					solidYuv[0] = pixelToY( color );
+					solidYuv[1] = sumsToU( 4 * r, 4 * g, 4 * b );
+					solidYuv[2] = sumsToV( 4 * r, 4 * g, 4 * b );
+					solidColor = color;
+					solidKnown = true;
+				}
+			}
+
+			// Convert everything since the previous solid block up to this one (or the image end)
+			int convertTo = solid ? left : width;
+
+			if ( convertFrom < convertTo )
+			{
+				for ( int y = top; y < top + blockrows; y += 2 )
+				{
+					int y1 = qMin( y + 1, rows - 1 );
+
+					converter( (const quint32*) (src + y * srcstride),
+							   (const quint32*) (src + y1 * srcstride),
+							   convertFrom,
+							   convertTo,
+							   dst[0] + y * dststride[0],
+							   dst[0] + y1 * dststride[0],
+							   dst[1] + (y / 2) * dststride[1],
+							   dst[2] + (y / 2) * dststride[2] );
+				}
+			}
+
+			if ( !solid )
+				break;
+
+			for ( int y = top; y < top + BLOCK_SIZE; y++ )
+				memset( dst[0] + y * dststride[0] + left, solidYuv[0], BLOCK_SIZE );
+
+			for ( int y = top / 2; y < (top + BLOCK_SIZE) / 2; y++ )
+			{
+				memset( dst[1] + y * dststride[1] + left / 2, solidYuv[1], BLOCK_SIZE / 2 );
+				memset( dst[2] + y * dststride[2] + left / 2, solidYuv[2], BLOCK_SIZE / 2 );
+			}
+
+			convertFrom = left + BLOCK_SIZE;
+		}
+	}
+}
@@ -0,0 +1,50 @@
+/**************************************************************************
+ *  Karlyriceditor - a lyrics editor and CD+G / video export for Karaoke  *
+ *  songs.                                                                *
+ *  Copyright (C) 2009-2013 George Yunaev, support@ulduzsoft.com          *
+ *                                                                        *
+ *  This program is free software: you can redistribute it and/or modify  *
+ *  it under the terms of the GNU General Public License as published by  *
+ *  the Free Software Foundation, either version 3 of the License, or     *
+ *  (at your option) any later version.                                   *
+ *																	      *
+ *  This program is distributed in the hope that it will be useful,       *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *  GNU General Public License for more details.                          *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public License     *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ **************************************************************************/
+
+
+#ifndef YUVCONVERTER_H
+#define YUVCONVERTER_H
+
+#include <QtGlobal>
+
+//
+// Same-size BGRA to YUV 4:2:0 conversion, faster than swscale for the lyrics images.
+// The images are mostly a solid background, so each 16x16 block of a single color is just
+// filled with its precomputed YUV values; the rest is converted with the SSE2 or AVX2 code,
+// whichever the CPU supports, or with the plain C++ code on the other CPUs. The result is BT.601
+// limited range, as swscale produces by default, with the chroma averaged over each 2x2 block,
+// so any band of rows converts the same as within the whole image.
+//
+class YuvConverter
+{
+    public:
+        // Size of the solid color blocks
+        static const int BLOCK_SIZE = 16;
+
+        // The conversion code used, for the reports: "avx2", "sse2" or "scalar"
+        static const char * name();
+
+        // Converts the BGRA rows into the YUV planes. The first row must be on a whole chroma row;
+        // if the number of rows is odd, the last row is taken twice for the chroma.
+        // Could be called from several threads at once.
+        static void convert( const uchar * src, int srcstride, int width, int rows,
+                             uchar * const dst[3], const int dststride[3] );
+};
+
+#endif // YUVCONVERTER_H